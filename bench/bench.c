@@ -0,0 +1,320 @@
+/*
+a benchmark for ex1: runs the shell on generated scripts, without a terminal, and measures how long every run takes
+ */
+
+#define _GNU_SOURCE //mkdtemp()
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+
+#define SUCCESS 1
+#define INVALID_INPUT -1
+#define SYSTEM_FAILURES 2
+
+//a kind of workload: a script is generated once, and the shell runs it again & again
+struct category {
+    char *name;
+    char *description;
+    int ops; //how many commands one run of the script executes
+    void (*generate)(FILE *script, int ops);
+};
+
+//the results of a category
+struct result {
+    double p50, p99; //seconds per run
+    double ops_per_sec;
+};
+
+void generate_trivial(FILE *script, int ops);
+
+void generate_chain(FILE *script, int ops);
+
+void generate_pipeline(FILE *script, int ops);
+
+void generate_expansion(FILE *script, int ops);
+
+void generate_redirection(FILE *script, int ops);
+
+void generate_loop(FILE *script, int ops);
+
+double now_seconds();
+
+double run_shell(char *shell, char *script_path, char *dir);
+
+int compare_doubles(const void *a, const void *b);
+
+double percentile(double *sorted, int count, double p);
+
+int run_category(char *shell, struct category *c, char *dir, int samples, struct result *r);
+
+void save_json(char *path, char *shell, int samples, struct result *results);
+
+double baseline_p50(char *baseline, char *name);
+
+char *read_file(char *path);
+
+struct category categories[] = {
+        {"trivial",    "N external commands, one per line",      200,  generate_trivial},
+        {"chain",      "one line of N ;-separated builtins",     2000, generate_chain},
+        {"pipeline",   "a pipeline N stages deep",               64,   generate_pipeline},
+        {"expansion",  "N lines, each expanding 20 variables",   1000, generate_expansion},
+        {"redirect",   "N commands writing to files with >",     500,  generate_redirection},
+        {"loop",       "a while loop of N iterations",           5000, generate_loop},
+        {NULL, NULL, 0, NULL}
+};
+
+//bench [-s samples] [-o results.json] [-b baseline.json] [shell]: the shell is ./ex1 by default.
+//with a baseline (the JSON of an earlier run), the change of every p50 is printed too
+int main(int argc, char *argv[]) {
+    char *shell = "./ex1", *json_path = "bench_results.json", *baseline = NULL;
+    int samples = 30, opt;
+    char dir[] = "/tmp/ex1-bench-XXXXXX", shell_path[PATH_MAX];
+
+    while ((opt = getopt(argc, argv, "s:o:b:")) != -1) {
+        if (opt == 's')
+            samples = atoi(optarg);
+        else if (opt == 'o')
+            json_path = optarg;
+        else if (opt == 'b' && (baseline = read_file(optarg)) == NULL)
+            return 2;
+        else if (opt != 'b') {
+            fprintf(stderr, "usage: %s [-s samples] [-o results.json] [-b baseline.json] [shell]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind < argc)
+        shell = argv[optind];
+    //the shell runs in dir, so a relative path is resolved here
+    if (samples < 1 || access(shell, X_OK) != 0 || realpath(shell, shell_path) == NULL) {
+        fprintf(stderr, "%s: no executable shell, or no samples\n", shell);
+        return 2;
+    }
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 2;
+    }
+
+    int count = 0;
+    for (; categories[count].name != NULL; count++);
+    struct result *results = calloc(count, sizeof(struct result));
+    if (results == NULL) {
+        perror("malloc failed");
+        return 2;
+    }
+
+    printf("%-10s %6s %8s %10s %10s %12s%s\n", "category", "ops", "samples", "p50 ms", "p99 ms", "ops/s",
+           baseline != NULL ? "   vs baseline" : "");
+    for (int i = 0; i < count; i++) {
+        if (run_category(shell_path, &categories[i], dir, samples, &results[i]) != SUCCESS)
+            return 1;
+        printf("%-10s %6d %8d %10.3f %10.3f %12.0f", categories[i].name, categories[i].ops, samples,
+               results[i].p50 * 1e3, results[i].p99 * 1e3, results[i].ops_per_sec);
+        double old = baseline != NULL ? baseline_p50(baseline, categories[i].name) : 0;
+        if (old > 0)
+            printf("   %+.1f%%", (results[i].p50 * 1e3 - old) / old * 100);
+        printf("\n");
+        fflush(stdout);
+    }
+    save_json(json_path, shell, samples, results);
+    printf("saved %s\n", json_path);
+
+    rmdir(dir); //the scripts & the files of 'redirect' were removed already
+    free(results);
+    free(baseline);
+    return 0;
+}
+
+//fork & exec are the whole cost: /bin/true does nothing
+void generate_trivial(FILE *script, int ops) {
+    for (int i = 0; i < ops; i++)
+        fprintf(script, "/bin/true\n");
+}
+
+//a long line for the lexer & the ; splitting, with builtins so no process is created
+void generate_chain(FILE *script, int ops) {
+    for (int i = 0; i < ops; i++)
+        fprintf(script, "%secho word%d", i == 0 ? "" : "; ", i);
+    fprintf(script, "\n");
+}
+
+//pipe setup & a launch per stage, and the data going through all of them
+void generate_pipeline(FILE *script, int ops) {
+    fprintf(script, "echo data");
+    for (int i = 1; i < ops; i++)
+        fprintf(script, " | cat");
+    fprintf(script, "\n");
+}
+
+//the variable store & the expansion of the lexer
+void generate_expansion(FILE *script, int ops) {
+    for (int i = 0; i < 20; i++)
+        fprintf(script, "VAR%d=value_of_variable_%d\n", i, i);
+    for (int i = 0; i < ops; i++) {
+        fprintf(script, "echo");
+        for (int j = 0; j < 20; j++)
+            fprintf(script, " $VAR%d", (i + j) % 20);
+        fprintf(script, "\n");
+    }
+}
+
+//opening the '>' targets, with a builtin so only the redirection is measured. the shell runs in the benchmark's directory
+void generate_redirection(FILE *script, int ops) {
+    for (int i = 0; i < ops; i++)
+        fprintf(script, "echo line %d > out%d\n", i, i % 16);
+}
+
+//a loop is parsed once: every iteration only expands & runs its builtins again
+void generate_loop(FILE *script, int ops) {
+    fprintf(script, "N=\n");
+    fprintf(script, "while test \"$N\" != \"%0*d\"; do\n", ops, 0);
+    fprintf(script, "    N=\"$N\"0\n");
+    fprintf(script, "    if test $N = 0; then echo first > /dev/null; fi\n");
+    fprintf(script, "done\n");
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//runs the shell on the script in dir, with its output thrown away. returns the time it took, or -1 if it failed
+double run_shell(char *shell, char *script_path, char *dir) {
+    int status;
+    double start = now_seconds();
+    pid_t p = fork();
+    if (p < 0) {
+        perror("forking failed");
+        return -1;
+    }
+    if (p == 0) {
+        int null_fd = open("/dev/null", O_RDWR);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        if (chdir(dir) == -1) {
+            perror(dir);
+            _exit(127);
+        }
+        execl(shell, shell, script_path, (char *) NULL);
+        perror(shell);
+        _exit(127);
+    }
+    if (waitpid(p, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "%s %s failed\n", shell, script_path);
+        return -1;
+    }
+    return now_seconds() - start;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+//the value at p (0..1) of sorted[], by the nearest rank
+double percentile(double *sorted, int count, double p) {
+    int rank = (int) (p * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+//generates the script of the category, runs it twice to warm up the caches, and then samples times
+int run_category(char *shell, struct category *c, char *dir, int samples, struct result *r) {
+    char script_path[256];
+    double *times = malloc(samples * sizeof(double));
+    if (times == NULL) {
+        perror("malloc failed");
+        return SYSTEM_FAILURES;
+    }
+    snprintf(script_path, sizeof(script_path), "%s/%s.sh", dir, c->name);
+    FILE *script = fopen(script_path, "w");
+    if (script == NULL) {
+        perror(script_path);
+        free(times);
+        return SYSTEM_FAILURES;
+    }
+    c->generate(script, c->ops);
+    fclose(script);
+
+    int ok = SUCCESS;
+    for (int i = -2; i < samples && ok == SUCCESS; i++) {
+        double t = run_shell(shell, script_path, dir);
+        if (t < 0)
+            ok = INVALID_INPUT;
+        else if (i >= 0)
+            times[i] = t;
+    }
+    if (ok == SUCCESS) {
+        qsort(times, samples, sizeof(double), compare_doubles);
+        r->p50 = percentile(times, samples, 0.50);
+        r->p99 = percentile(times, samples, 0.99);
+        r->ops_per_sec = c->ops / r->p50;
+    }
+
+    unlink(script_path);
+    for (int i = 0; i < 16 && c->generate == generate_redirection; i++) {
+        snprintf(script_path, sizeof(script_path), "%s/out%d", dir, i);
+        unlink(script_path);
+    }
+    free(times);
+    return ok;
+}
+
+//the results as JSON, so runs of different versions of the shell can be compared
+void save_json(char *path, char *shell, int samples, struct result *results) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "{\n  \"shell\": \"%s\",\n  \"samples\": %d,\n  \"categories\": [\n", shell, samples);
+    for (int i = 0; categories[i].name != NULL; i++) {
+        fprintf(f, "    {\"name\": \"%s\", \"description\": \"%s\", \"ops\": %d, \"p50_ms\": %.4f, \"p99_ms\": %.4f, "
+                   "\"ops_per_sec\": %.1f}%s\n", categories[i].name, categories[i].description, categories[i].ops,
+                results[i].p50 * 1e3, results[i].p99 * 1e3, results[i].ops_per_sec,
+                categories[i + 1].name != NULL ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+}
+
+//the p50_ms of the category in a JSON that save_json() wrote, 0 if it isn't there
+double baseline_p50(char *baseline, char *name) {
+    char key[64];
+    double p50 = 0;
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    char *entry = strstr(baseline, key);
+    if (entry != NULL && (entry = strstr(entry, "\"p50_ms\": ")) != NULL)
+        sscanf(entry + strlen("\"p50_ms\": "), "%lf", &p50);
+    return p50;
+}
+
+char *read_file(char *path) {
+    FILE *f = fopen(path, "r");
+    char *content;
+    long size;
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    content = malloc(size + 1);
+    if (content == NULL || fread(content, 1, size, f) != (size_t) size) {
+        fprintf(stderr, "%s: can't read the file\n", path);
+        free(content);
+        fclose(f);
+        return NULL;
+    }
+    content[size] = '\0';
+    fclose(f);
+    return content;
+}
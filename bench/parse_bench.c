@@ -0,0 +1,131 @@
+/*
+a microbenchmark of the parser: parses a corpus of command lines in-process, again & again, and reports MB/s.
+nothing is executed, so only parse_line() is measured
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../parse.h"
+
+#define CORPUS_LINES 100000 //how many lines are generated when no corpus file is given
+
+char *read_corpus(char *path, size_t *size);
+
+char *generate_corpus(size_t *size);
+
+double now_seconds();
+
+//parse_bench [-n iterations] [corpus]: the corpus is a file of command lines, generated if it isn't given
+int main(int argc, char *argv[]) {
+    int iterations = 20, lines = 0, arg = 1;
+    size_t size;
+    char *corpus, *copy, *line, *newline, *next;
+    struct parser parser;
+    double start, parsing = 0;
+    long pipelines = 0, words = 0;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        iterations = atoi(argv[2]);
+        arg = 3;
+    }
+    corpus = arg < argc ? read_corpus(argv[arg], &size) : generate_corpus(&size);
+    if (corpus == NULL || iterations < 1)
+        return 2;
+    copy = malloc(size + 1);
+    if (copy == NULL) {
+        perror("malloc failed");
+        return 2;
+    }
+    memset(&parser, 0, sizeof(parser));
+
+    for (int i = 0; i < iterations; i++) {
+        memcpy(copy, corpus, size + 1); //the parser changes the line in place, so every iteration gets a fresh copy
+        lines = 0;
+        start = now_seconds();
+        for (line = copy; *line != 0; line = next) {
+            newline = strchr(line, '\n');
+            next = newline != NULL ? newline + 1 : line + strlen(line);
+            if (newline != NULL)
+                *newline = 0;
+            if (parse_line(&parser, line) == PARSE_NO_MEMORY) {
+                fprintf(stderr, "malloc failed\n");
+                return 1;
+            }
+            pipelines += parser.pipeline_count;
+            words += parser.word_count;
+            lines++;
+        }
+        parsing += now_seconds() - start;
+    }
+
+    printf("%d lines, %.2f MB, %d iterations\n", lines, size / 1e6, iterations);
+    printf("%.1f MB/s, %.0f lines/s, %.1f ns/line (%ld pipelines, %ld words)\n", size * iterations / parsing / 1e6,
+           lines * (double) iterations / parsing, parsing * 1e9 / lines / iterations, pipelines, words);
+    free_parser(&parser);
+    free(copy);
+    free(corpus);
+    return 0;
+}
+
+char *read_corpus(char *path, size_t *size) {
+    FILE *f = fopen(path, "r");
+    char *corpus;
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    (*size) = ftell(f);
+    rewind(f);
+    corpus = malloc((*size) + 1);
+    if (corpus == NULL || fread(corpus, 1, *size, f) != (*size)) {
+        fprintf(stderr, "%s: can't read the corpus\n", path);
+        free(corpus);
+        fclose(f);
+        return NULL;
+    }
+    corpus[*size] = 0;
+    fclose(f);
+    return corpus;
+}
+
+//a mix of the lines people type: simple commands, quotes, variables, pipelines, redirections, $(...), loops, functions
+//& ; chains
+char *generate_corpus(size_t *size) {
+    const char *lines[] = {
+            "ls -l /usr/bin\n",
+            "echo \"hello world; not a separator\" > out.txt\n",
+            "NAME=some value with spaces\n",
+            "echo $NAME $HOME/dir${x} \"$PATH\"\n",
+            "cat file.txt | grep -v pattern | sort | uniq -c | sort -rn | head -20\n",
+            "make -j8 all; echo done; echo $?\n",
+            "time -j find . -name \"*.c\" | xargs wc -l &\n",
+            "printf \"%s %d\\n\" word 42 > /dev/null; true; false\n",
+            "sort < in.txt 2>&1 >> out.txt; tr a-z A-Z <<< \"$WORD\" 2> /dev/null\n",
+            "COUNT=$(ls $DIR | wc -l); echo \"found $(cat $FILE | grep -c x) in `pwd`\"\n",
+            "for f in $(ls); do if test -s $f; then wc -l $f && echo ok || echo empty; fi; done\n",
+            "archive() { for f; do tar czf \"$f.tgz\" $f || return 1; done; shift; echo $# $@; }\n",
+    };
+    int count = sizeof(lines) / sizeof(lines[0]);
+    size_t total = 0;
+    for (int i = 0; i < CORPUS_LINES; i++)
+        total += strlen(lines[i % count]);
+    char *corpus = malloc(total + 1), *end;
+    if (corpus == NULL) {
+        perror("malloc failed");
+        return NULL;
+    }
+    end = corpus;
+    for (int i = 0; i < CORPUS_LINES; i++)
+        end = stpcpy(end, lines[i % count]);
+    (*size) = total;
+    return corpus;
+}
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
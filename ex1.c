@@ -2,17 +2,34 @@
 an updated shell
  */
 
+#define _GNU_SOURCE //pipe2(), POSIX_SPAWN_USEVFORK, splice(), F_SETPIPE_SZ, wait4(), memfd_create(), CPU_COUNT()
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <fcntl.h>
-
-#define MAX_ENV_VARS 100
-#define MAX_INPUT_LENGTH 510
-#define MAX_ARGS 10
-#define MAX_COMMANDS 10
+#include <signal.h>
+#include <errno.h>
+#include <spawn.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/signalfd.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <termios.h> //also CTRL()
+#include "parse.h"
 
 #define SPACE " "
 #define SPACE_CHAR ' '
@@ -22,798 +39,7198 @@ an updated shell
 #define SUCCESS 1
 #define EXIT 3
 
+#define OUT_PIECES 64 //how many pieces of builtin output are collected for one writev()
+
+#define INPUT_BUFFER_SIZE 65536 //the first buffer for reading scripts & pipes, it doubles for longer lines
+
+#define ARENA_CHUNK_SIZE 4096 //the first chunk of an arena, the next ones double
+
+#define METER_CHUNK (1 << 20) //the most bytes one splice() moves between metered stages
+
+//how a command is launched: posix_spawn() (vfork-like, no page-table copy), the classic fork()+execvp(),
+//or by the fork server, a small process that was forked when the shell started
+#define LAUNCH_FORK 0
+#define LAUNCH_SPAWN 1
+#define LAUNCH_ZYGOTE 2
+
+#define HISTORY_HEAD 8 //the first bytes of every entry, kept in its record so !prefix is searched without the log
+
+#define HISTORY_WINDOW 65536 //how much of the log memmem() searches at a time when it's searched backwards
+
+#define ZYGOTE_MESSAGE_SIZE (1 << 20) //the biggest launch request (argv[] & the environment) the fork server receives
+
+#define METRICS_BUCKETS 16 //the bounds of a latency histogram, in metric_bounds[]
+#define METRICS_INTERVAL 10 //the seconds between the writes of METRICS_FILE, unless METRICS_INTERVAL is set
+
+#define GLOB_BUFFER_SIZE (1 << 18) //the buffer of getdents64(): a directory of 100k entries is read in ~10 calls
+
+//the kinds of tokens of a compiled glob
+#define GLOB_TEXT 0 //plain characters
+#define GLOB_ANY 1 // ?
+#define GLOB_STAR 2 // *
+#define GLOB_CLASS 3 // [...]
+
+//the keys of the line editor that are escape sequences of the terminal, after the bytes
+#define KEY_NONE -1 //the end of the input
+#define KEY_UP 256
+#define KEY_DOWN 257
+#define KEY_RIGHT 258
+#define KEY_LEFT 259
+#define KEY_HOME 260
+#define KEY_END 261
+#define KEY_DELETE 262
+
+#define COMPLETION_LIST_MAX 200 //more candidates than this are only counted
+#define PATH_TRIE_DIRS 64 //the directories of $PATH the trie has (a bit each), the ones after them aren't completed
+
+#define TRACE_EVENTS 4096 //the events the trace ring holds (a power of 2). a full ring is written to the trace file
+
+#define SNAPSHOT_MAGIC "ex1rc01" //changed whenever the layout of a snapshot (or of a packed tree) changes
+
+//ioprio_set() has no glibc wrapper: the class is in the bits from IOPRIO_CLASS_SHIFT up, the level (0-7) below them
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+//the kinds of entries of the variables' table. a function & an alias may have the name of a variable
+#define ENTRY_VARIABLE 0
+#define ENTRY_FUNCTION 1
+#define ENTRY_ALIAS 2
+
+//the states of a process of a job
+#define JOB_RUNNING 0
+#define JOB_STOPPED 1
+#define JOB_DONE 2
+
+#define SKIPPED_STAGE -2 //the pid of a stage whose redirections couldn't be opened: it didn't run, and its status is 1
+
+//a chunk of an arena. the chunks are linked from the newest to the oldest
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size, used;
+    char data[];
+};
+
+struct arena {
+    struct arena_chunk *head;
+    size_t used; //bytes handed out from all the chunks
+};
+
+//how much of an arena was handed out at some point: arena_release() frees everything that was allocated after it
+struct arena_mark {
+    struct arena_chunk *head;
+    size_t head_used, used;
+};
+
+/*where the commands come from: a script file, a pipe, or the string of -c.
+ the unread input is buffer[start..end). lines are null terminated inside the buffer, which is reused for the whole input.
+ a terminal is read by getline() into the same buffer instead*/
+struct input {
+    int fd; //-1 for the -c string, which is already all in the buffer
+    char *buffer;
+    size_t size; //0 if the buffer isn't ours
+    size_t start, end;
+    int eof;
+};
+
+//a process of a job: a single command or one stage of a pipeline
+struct process {
+    pid_t pid; //-1 if it couldn't be launched
+    int state;
+    int status; //from waitpid(), once the process stopped or finished
+    struct rusage usage; //from wait4(), once the process finished
+    double started; //when it was launched, for the metrics
+    char *text; //the command of the stage, inside the job's command
+    struct job *job;
+};
+
+//a command line that was launched as processes: a single command or a pipeline
+struct job {
+    int id; //jobs[id - 1]
+    int num_procs;
+    int live, stopped; //how many processes didn't finish yet, and how many of them are stopped
+    int background;
+    char *command; //the texts of the stages, one after the other
+    char ***saved_args; //a queued job (BG_LIMIT): copies of the stages' argv[] & redirections, until it's launched
+    struct redirect **saved_redirects;
+    struct process procs[];
+};
+
+/*a metered pipe between two stages of a pipeline (PIPE_METER): the stage writes to one pipe, and the shell
+ splice()s it into a second pipe the next stage reads. from & to are the shell's ends of the two pipes*/
+struct pipe_link {
+    int from, to; //-1 when the link isn't metered or was closed
+    long long bytes;
+    double end; //when the stage's output ended
+    int waiting; //the next stage's pipe is full, data waits for it to read
+    double stall, stall_start; //how long the data waited for the next stage
+    long long queued_sum; //bytes in the next stage's pipe, summed over the samples
+    long samples;
+    int queued_max;
+};
+
+//what 'time' measures for one command line segment: the shell's own usage from the start (builtins, forwarding),
+//and the processes of the job that ran, copied when it finished
+struct time_report {
+    int json;
+    double start;
+    struct rusage self;
+    int num_procs;
+    struct process *procs;
+};
+
+//a latency histogram: counts[i] - how many took up to metric_bounds[i] seconds (& more than the bound before it),
+//counts[METRICS_BUCKETS] - how many took longer than all the bounds
+struct histogram {
+    long counts[METRICS_BUCKETS + 1];
+    long count;
+    double sum;
+};
+
+//how many times a command (by its name) finished, and how many of those failed (exit status != 0, or killed)
+struct command_metric {
+    char *name; //NULL - an empty slot
+    unsigned long hash;
+    long runs, failures;
+};
+
+//what the shell measures about the commands it runs, for 'stats' & METRICS_FILE
+struct metrics {
+    struct command_metric *commands; //an open addressing table, by name
+    int capacity, count; //the capacity is always a power of 2
+    long exit_codes[256];
+    long signals[NSIG]; //killed by a signal
+    struct histogram launch; //from the start of a launch (fork/spawn) until the command was executed
+    struct histogram run; //from the exec until the process was reaped
+    double next_dump; //when METRICS_FILE is written next
+};
+
+//a phase of the shell's work while tracing: a 'complete' event of the Chrome trace format
+struct trace_event {
+    const char *name; //a string constant
+    long long start, duration; //nanoseconds of CLOCK_MONOTONIC
+    char detail[32]; //the command it's about, cut. "" - none
+};
+
+/*the recording of the phases (EX1_TRACE, 'trace'). the events that weren't written yet are ring[written..head),
+ by their index modulo TRACE_EVENTS. only the shell's own thread adds & writes them, so the ring needs no lock*/
+struct trace {
+    FILE *file; //NULL - no trace was started
+    char *path;
+    struct trace_event *ring;
+    unsigned long head, written;
+};
+
+//what a snapshot of the rc file was made for: the rc file's contents & the shell binary that ran it
+struct snapshot_key {
+    char magic[8];
+    long long rc_size;
+    struct timespec rc_mtime;
+    unsigned long rc_hash;
+    long long shell_size;
+    struct timespec shell_mtime;
+};
+
+//an entry of a snapshot is this, then its name & value (null terminated), then the packed tree of a function/alias
+struct snapshot_entry {
+    int kind; //ENTRY_*
+    int name_len, value_len;
+    size_t tree_size; //0 for a variable
+};
+
+//a slot of 'parallel': the child shell that runs a command, and the memory files its output is kept in
+struct parallel_slot {
+    pid_t pid; //0 - the slot is free
+    int out_fd, err_fd;
+};
+
+/*what is applied to a launched process between fork & exec: the limits of ulimit, and the prefixes of the command
+ (nice, ionice, taskset, prlimit). a field that is 0 isn't applied*/
+struct launch_options {
+    int cpus_set; //sched_setaffinity() to cpus
+    cpu_set_t cpus;
+    int nice; //added to the niceness
+    int io_class, io_level; //ioprio_set()
+    int limits_set; //bit r - setrlimit(r, &limits[r])
+    struct rlimit limits[RLIM_NLIMITS];
+};
+
+//a resource of ulimit & prlimit: ulimit -<option> counts it in units, prlimit --<name>= in bytes/seconds/files
+struct limit_name {
+    char option;
+    char *name;
+    int resource;
+    int unit;
+    char *description;
+};
+
+/*a launch request to the fork server. the message is this header, followed by the null terminated strings:
+ the command's path (if has_path), argv[] & the environment. stdin, stdout & stderr are sent with it as fds*/
+struct zygote_request {
+    int argc, envc;
+    int has_path;
+    int has_options;
+    struct launch_options options;
+};
+
+//the answer of the fork server: the command's pid, or -1 if no process was created, and the errno of clone()/exec
+struct zygote_reply {
+    pid_t pid;
+    int err; //0 - the command was executed
+};
+
+//a record of the history's index: where an entry starts in the log, and its first bytes (zero padded)
+struct history_record {
+    unsigned long long offset;
+    char head[HISTORY_HEAD];
+};
+
+//the mapped history files. count is how many whole records are mapped, the entries are numbered from 1
+struct history {
+    int tried; //open_history() was called already
+    int log_fd, index_fd; //-1 if they aren't open
+    char *log;
+    size_t log_size;
+    struct history_record *index;
+    size_t index_size;
+    long count;
+};
+
+//a redirection of a command, expanded & ready to be opened when the command is launched
+struct redirect {
+    int type; //REDIRECT_*, REDIRECT_NONE ends the redirections of a command
+    char *target; //the file, the word of <<<, NULL for 2>&1 & here-docs
+    int fd; //the memory file of a here-doc's body, -1 for the others
+};
+
+//a function or an alias: its body, parsed once when it was defined & copied out of the line (copy_tree())
+struct definition {
+    struct parser tree;
+    int running; //calls of the function that didn't return yet
+    int replaced; //it was redefined or unset while it ran - it's freed when the last call returns
+};
+
+//the arguments of a command while its words are expanded (in line_arena): a word may become several arguments
+struct arg_list {
+    char **args; //null terminated
+    int count, capacity;
+};
+
+//a token of a glob: plain characters (text[0..len)), ?, * or a class, whose bytes are the bits of set
+struct glob_token {
+    int type; //GLOB_*
+    char *text;
+    int len;
+    unsigned char set[32];
+};
+
+//a component of a glob (between the '/'s), compiled once for all the names it's matched with
+struct glob_pattern {
+    char *text; //the component in the pattern, text[0..len)
+    int len;
+    struct glob_token *tokens;
+    int count;
+    int literal; //it has no wildcards, it's only appended to the path
+    int min_len; //the shortest name it can match
+    int dot; //it starts with '.', so it matches the names that start with '.'
+};
+
+//a record of getdents64(), which has no glibc wrapper on older systems
+struct dirent64_record {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/*a directory that was read for a glob during the current line: its entries one after the other, each one its d_type
+ & its null terminated name. it's found by the directory's device & inode, so a 'cd' doesn't confuse the listings*/
+struct listing {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime, ctime; //of the directory when it was read
+    char *entries;
+    size_t size, capacity;
+    struct listing *next;
+};
+
+//the line of the line editor: input.buffer[0..len), the cursor is before input.buffer[pos]
+struct editor {
+    size_t len, pos;
+    int column; //the cursor's column from the start of the line, on the screen
+    long history_at; //the history entry that is shown, history.count + 1 - the line that is written
+    char *draft; //the line that was written, while history entries are shown (in line_arena)
+};
+
+//a node of the trie of the executables of $PATH: a character of a name, its first child & its next sibling.
+//dirs has bit i if the name that ends here is an executable in the i-th directory of $PATH
+struct trie_node {
+    int child, sibling;
+    unsigned long long dirs;
+    char c;
+};
+
+//a directory of $PATH, and its mtime when its executables were added to the trie
+struct trie_dir {
+    char *path;
+    int read;
+    struct timespec mtime;
+};
+
+struct path_trie {
+    struct trie_node *nodes; //nodes[0] is the root, the empty name
+    int count, capacity;
+    char *path; //the $PATH it was built for
+    char *dir_text; //a copy of it, split into the directories' paths
+    struct trie_dir dirs[PATH_TRIE_DIRS];
+    int dir_count;
+};
+
+//a command that runs inside the shell
+struct builtin {
+    char *name;
+    int (*run)(char **args, int argc);
+};
+
 void print_prompt(char *, char *, int, int);
 
 char *read_command();
 
-void split_multiple_commands(char **);
+char *read_script_line();
+
+int open_input(int argc, char *argv[]);
+
+int split_multiple_commands(char *, int from_input);
+
+int read_compound(char *line);
+
+int syntax_error_at_end();
 
-int split_single_command(char **, char *command, int *);
+int split_single_command(char ***args, struct redirect **redirects, struct command *c);
 
-int execute_single_command(char **, int, char **);
+int assign_variable(struct command *c);
 
-int execute_pipe_commands(char *);
+void free_and_exit(int status);
+
+int execute_single_command(char **, struct redirect *, int);
+
+int execute_pipe_commands(struct pipeline *pipeline);
+
+void launch_stages(char ***args, struct redirect **redirects, int num_commands, struct pipe_link *links, pid_t *pids);
 
 void make_fork(pid_t *p);
 
-int make_exec(char **args);
+int make_exec(char *path, char **args);
+
+int open_redirections(struct redirect *r, int out_fd, int fds[3]);
+
+int open_redirection_target(struct redirect *r, int out_fd, int fds[3]);
+
+void close_redirections(int fds[3]);
+
+int redirects_stdout(struct redirect *r);
+
+int read_heredocs(int first);
+
+int write_heredoc_line(int fd, char *line, int expand);
+
+void close_heredocs();
+
+int launch_command(char **args, int in_fd, int out_fd, int err_fd, pid_t *p);
+
+int spawn_command(char *path, char **args, int in_fd, int out_fd, int err_fd, pid_t *p);
+
+int fork_command(char *path, char **args, int in_fd, int out_fd, int err_fd, pid_t *p);
+
+void init_launcher();
+
+void set_sigchld_blocked(int blocked);
+
+void exec_error(int fd, char *name, char *call, int err);
+
+//functions of the fork server
+int start_zygote();
+
+void stop_zygote();
+
+int zygote_command(char *path, char **args, int in_fd, int out_fd, int err_fd, pid_t *p);
+
+void zygote_loop(int sock, struct sigaction *saved);
+
+pid_t zygote_launch(char *path, char **argv, char **envp, int *fds, struct sigaction *saved,
+                    struct launch_options *options, int *err);
+
+//functions of the launch options
+int is_launch_prefix(char *name);
+
+char **set_launch_options(char **args, struct launch_options *o, int cpu);
+
+int parse_nice(char **args, struct launch_options *o);
+
+int parse_ionice(char **args, struct launch_options *o);
+
+int parse_taskset(char **args, struct launch_options *o);
+
+int parse_cpu_list(char *list, cpu_set_t *set);
+
+int parse_prlimit(char **args, struct launch_options *o);
+
+struct limit_name *find_limit(char option, char *name, size_t len);
+
+int parse_limit_value(char *value, int unit, rlim_t *limit);
+
+void reset_launch_options();
+
+void apply_launch_options(struct launch_options *o);
 
-int wait_to_child(pid_t p, int run_in_background);
+int nth_cpu(cpu_set_t *set, int n);
 
-void remove_spaces_and_quotes(char *);
+int ulimit_builtin(char **args, int argc);
 
-void remove_quotes(char *);
+void get_limit(struct launch_options *o, int resource, struct rlimit *limit);
 
-int is_assignment(char *, char *);
+void print_limit(struct limit_name *l, int hard, int described);
 
-int deal_with_echo(char *command, char *argv[12], int *args_index);
+//functions of the expansion
+int expand_values(struct word *w, char **values, int allow_unassigned);
 
-void divide_string(char *str, char **first, char **second, char **third, int *arg_index);
+int expand_word(struct word *w, char **word, int allow_unassigned);
 
-int count_arguments(char **arr, int n);
+int expand_fields(struct word *w, struct arg_list *list, int allow_unassigned);
 
-void catch_child(int);
+int add_arg(struct arg_list *list, char *arg);
+
+int is_all_parameters(struct word *w, struct var_ref *ref);
+
+int run_substitution(char *text, int len, char **output);
+
+int run_substitution_line(char *line);
+
+int changes_shell(char *line);
+
+//functions of the pathname expansion
+int add_field(struct word *w, struct arg_list *list, char *field);
+
+int expand_glob(char *pattern, struct arg_list *list);
+
+int compile_glob(struct glob_pattern *p, char *text, int len);
+
+int class_end(char *text, int start, int len);
+
+void compile_class(struct glob_token *t, char *text, int len);
+
+int glob_match(struct glob_pattern *p, const char *name, int len);
+
+int glob_path(char *path, int len, struct glob_pattern *components, int count, struct arg_list *list);
+
+int add_path(struct arg_list *list, char *path, int len);
+
+int read_listing(char *dir, struct listing **l);
+
+void forget_listings();
+
+int compare_strings(const void *a, const void *b);
 
 void catch_stop(int);
 
+//functions that manage the jobs
+void init_jobs();
+
+int start_job(char ***args, pid_t *pids, int num_procs, int run_in_background);
+
+struct job *add_job(char ***args, pid_t *pids, int num_procs, int run_in_background);
+
+struct job *create_job(char ***args, int num_procs, int run_in_background);
+
+int add_process(struct job *job, int i, pid_t pid);
+
+void update_process(struct process *proc, int status, struct rusage *usage);
+
+struct process *find_process(pid_t pid);
+
+int grow_pid_table();
+
+void unhash_pid(pid_t pid);
+
+void reap_children();
+
+void wait_for_children();
+
+void wait_for_job(struct job *job);
+
+void continue_job(struct job *job);
+
+void remove_job(struct job *job);
+
+void notify_jobs();
+
+struct job *find_job(char *spec, char *caller);
+
+void print_job(struct job *job, int long_format);
+
+void describe_state(struct job *job, struct process *proc, char *state, size_t size);
+
+int exit_code(int status);
+
+unsigned int hash_pid(pid_t pid);
+
+int background_full();
+
+int queue_job(char ***args, struct redirect **redirects, int num_commands);
+
+void start_queued_jobs();
+
+void start_remaining_jobs();
+
+int launch_queued_job(struct job *job);
+
+char **copy_argv(char **args);
+
+struct redirect *copy_redirects(struct redirect *r);
+
+void free_saved_args(struct job *job);
+
+void free_jobs();
+
+//functions of the pipeline meter
+double now_seconds();
+
+void set_pipe_size(int fd, int size);
+
+int open_pipe_link(struct pipe_link *link, int pipefd[2], int pipe_size);
+
+void forward_pipeline(struct pipe_link *links, int count, struct job *job);
+
+void hand_off_forwarding(struct pipe_link *links, int count);
+
+void print_meter_report(struct pipe_link *links, char ***args, int num_commands, double start);
+
+//functions of 'time'
+void start_timing(struct time_report *report, struct pipeline *pipeline);
+
+void print_time_report(struct time_report *report);
+
+double tv_seconds(struct timeval tv);
+
+//functions of the metrics
+void count_command(char *name, int status);
+
+void count_process(struct process *proc);
+
+void observe(struct histogram *h, double seconds);
+
+struct command_metric *find_command_metric(char *name, unsigned long hash);
+
+int grow_command_metrics();
+
+void write_metrics(FILE *f);
+
+void write_histogram(FILE *f, char *name, char *help, struct histogram *h);
+
+void write_label(FILE *f, char *value);
+
+void dump_metrics(int force);
+
+double histogram_quantile(struct histogram *h, double q);
+
+void print_histogram(char *title, struct histogram *h);
+
+int compare_command_metrics(const void *a, const void *b);
+
+int stats_builtin(char **args, int argc);
+
+void free_metrics();
+
+void uncount_command(char **args, struct redirect *redirects);
+
+//functions of the tracing
+void init_trace();
+
+int start_trace(char *path);
+
+void stop_trace();
+
+long long trace_clock();
+
+void trace_add(const char *name, long long start, const char *detail);
+
+void flush_trace();
+
+void write_json_string(FILE *f, const char *s);
+
+int trace_builtin(char **args, int argc);
+
+//functions of the rc file
+void load_rc();
+
+char *read_rc(char *path, size_t *len, struct snapshot_key *key);
+
+int run_rc(char *text, size_t len);
+
+int load_snapshot(char *path, struct snapshot_key *key);
+
+int apply_snapshot(char *map, size_t size, int count);
+
+int write_snapshot(char *path, struct snapshot_key *key);
+
+//functions that manage arenas
+void *arena_alloc(struct arena *, size_t);
+
+char *arena_strndup(struct arena *, const char *, size_t);
+
+char *arena_strdup(struct arena *, const char *);
+
+void arena_reset(struct arena *);
+
+void arena_mark(struct arena *, struct arena_mark *);
+
+void arena_release(struct arena *, struct arena_mark *);
+
+void arena_free(struct arena *);
+
 //functions that manages env_vars[]
 int my_setenv(char *, char *);
 
 char *my_getenv(char *);
 
+char *get_option(char *name);
+
+void my_unsetenv(char *);
+
+int set_env_entry(char *name, int kind, char *value);
+
+void unset_env_entry(char *name, int kind);
+
+int find_env_slot(char *name, unsigned long hash, int kind);
+
+//functions of the functions & aliases
+int define(char *name, int kind, char *text, struct definition *d);
+
+struct definition *find_definition(char *name, int kind);
+
+void free_definition(struct definition *d);
+
+int define_function(struct node *node);
+
+int run_function(struct definition *f, char **args, struct redirect *redirects);
+
+int launch_function(struct definition *f, char **args, int in_fd, int out_fd, int err_fd, pid_t *p);
+
+struct definition *find_alias(struct word *w);
+
+int expand_alias(struct definition *alias, struct arg_list *list);
+
+char *special_parameter(char c);
+
+int grow_env_vars();
+
+int compact_env_strings();
+
+int can_fill_slot(int hole, int j, int home);
+
 void free_env_vars();
 
-//The struct represents an environment variable: name & value
-struct env_var {
-    char *name;
-    char *value;
-};
+//functions that manage the command path cache
+unsigned long hash_string(const char *);
+
+char *find_command(char *name);
+
+struct hashed_command *hash_command(char *name);
+
+int grow_hashed_commands();
+
+void clear_hashed_commands();
+
+int hash_builtin(char **args, int argc);
+
+//functions of the builtins
+void init_builtins();
+
+struct builtin *find_builtin(char *name);
+
+int run_builtin(struct builtin *b, char **args, struct redirect *redirects);
+
+int redirect_shell(struct redirect *redirects, int saved[3]);
+
+void restore_shell(int saved[3]);
+
+int launch_builtin(struct builtin *b, char **args, int in_fd, int out_fd, int err_fd, pid_t *p);
+
+void out_add(const char *str, size_t len);
+
+int out_flush();
+
+char *unescape(char *str, size_t *len, int *stop, int is_echo);
+
+int evaluate_test(char **args, int n);
+
+int echo_builtin(char **args, int argc);
+
+int printf_builtin(char **args, int argc);
+
+int test_builtin(char **args, int argc);
 
-int cmd_count = 0, arg_count = 0, decreased_counters = 0; //need to be global, so  catch_child() will be able to change them
-pid_t run_now, stopped_process;
+int pwd_builtin(char **args, int argc);
+
+int true_builtin(char **args, int argc);
+
+int false_builtin(char **args, int argc);
+
+int exit_builtin(char **args, int argc);
+
+int cd_builtin(char **args, int argc);
+
+int unset_builtin(char **args, int argc);
+
+int bg_builtin(char **args, int argc);
+
+int fg_builtin(char **args, int argc);
+
+int jobs_builtin(char **args, int argc);
+
+int wait_builtin(char **args, int argc);
+
+int history_builtin(char **args, int argc);
+
+int break_builtin(char **args, int argc);
+
+int continue_builtin(char **args, int argc);
+
+int return_builtin(char **args, int argc);
+
+int shift_builtin(char **args, int argc);
+
+int alias_builtin(char **args, int argc);
+
+int define_alias(char *name, char *value);
+
+int unalias_builtin(char **args, int argc);
+
+int unalias_builtin(char **args, int argc);
+
+//functions of the compound commands
+int run_list(int node);
+
+int run_pipeline(struct pipeline *pipeline);
+
+int run_if(struct node *node);
+
+int run_while(struct node *node);
+
+int run_for(struct node *node);
+
+int leave_loop();
+
+//functions of the history
+int open_history();
+
+void close_history();
+
+int map_history();
+
+void repair_history();
+
+void make_history_record(struct history_record *record, size_t offset, const char *line, size_t len);
+
+void add_history(char *line);
+
+char *history_entry(long n, size_t *len);
+
+long history_entry_at(size_t offset);
+
+size_t history_end();
+
+long history_find_prefix(const char *prefix, size_t len, long before);
+
+long history_find_text(const char *text, size_t len, long before);
+
+char *expand_history(char *line);
+
+//functions of the line editor
+void init_editor();
+
+char *edit_line();
+
+int read_key();
+
+void edit_key(struct editor *e, int key);
+
+int edit_reserve(size_t len);
+
+void edit_insert(struct editor *e, const char *text, size_t len);
+
+void edit_delete(struct editor *e, size_t from, size_t to);
+
+void edit_history(struct editor *e, long n);
+
+void edit_refresh(struct editor *e);
+
+void edit_redisplay(struct editor *e);
+
+void edit_bell();
+
+int columns(const char *text, size_t len);
+
+void complete_word(struct editor *e);
+
+int is_command_position(size_t start);
+
+int complete_variables(char *prefix, struct arg_list *list);
+
+int complete_commands(char *prefix, struct arg_list *list);
+
+int collect_trie(int node, char *name, size_t len, struct arg_list *list);
+
+int complete_paths(char *word, struct arg_list *list);
+
+void list_candidates(struct editor *e, struct arg_list *list, int skip);
+
+int refresh_path_trie();
+
+int read_path_dir(char *path, unsigned long long bit);
+
+int add_trie_node(int parent);
+
+void free_path_trie();
+
+//functions of 'parallel'
+int parallel_builtin(char **args, int argc);
+
+int start_parallel_command(struct parallel_slot *slot, char *command);
+
+void write_job_output(int from, int to);
+
+int count_cores();
+
+//The struct represents an environment variable: name & value (both in env_strings) & the hash of the name.
+//functions & aliases are entries of the same table, with a kind of their own
+struct env_var {
+    char *name;
+    char *value; //the text of an alias, "" for a function
+    unsigned long hash;
+    int kind; //ENTRY_*
+    struct definition *definition; //a function's or an alias's parsed body, NULL for a variable
+};
+
+int cmd_count = 0, arg_count = 0;
+pid_t shell_pid; //a forked child shell (a function in a pipeline, parallel) has another pid
+int launch_mode = LAUNCH_SPAWN; //selected by EX1_LAUNCH=fork|spawn|zygote in the environment
+int zygote_fd = -1; //the shell's end of the fork server's socket
+extern char **environ;
+int interactive = 1; //reading from a terminal: print the prompt & exit after 3 enters
+int last_status = 0; //the exit status of the last command, the shell exits with it
+struct input input = {STDIN_FILENO, NULL, 0, 0, 0, 0};
+
+//the line editor reads the terminal (init_editor()): cooked is the terminal's mode for everything else,
+//edit_prompt is what was printed before the line, and is printed again when the line is
+int editing = 0;
+struct termios cooked;
+char *edit_prompt = "";
+struct path_trie trie;
+
+//the output of the builtins that wasn't written yet
+struct iovec out_pieces[OUT_PIECES];
+int out_count = 0;
+
+//this is a data structure to maintain environment variables:
+//a hash table of structs, where each struct represents an environment variable (NULL name - empty slot)
+struct env_var *env_vars = NULL;
+int env_var_capacity = 0, env_var_count = 0; //the capacity is always a power of 2
+struct arena env_strings = {NULL, 0};
+size_t env_garbage = 0; //bytes of replaced values & removed variables in env_strings
+
+//the arguments, argv[] arrays & expanded strings of the current input line.
+//they all live until the line was executed, and are freed together by arena_reset() in main()
+struct arena line_arena = {NULL, 0};
+
+//the tree of the current input line: its pipelines, commands & words. the arrays are reused for every line
+struct parser parser;
+
+//the tree a $(...) line is parsed into to see if it can run in the shell itself (changes_shell())
+struct parser substitution_check;
+
+//the directories the globs of the line read, newest first, and the buffer they're read with
+struct listing *listings = NULL;
+char *glob_buffer = NULL;
+
+//the memory files of the bodies of the line's here-docs, by the index of their redirection (in line_arena)
+int *heredoc_fds = NULL;
+
+//a cached command: its name, the full path it was found in, and how many times it was executed from there
+struct hashed_command {
+    char *name;
+    char *path;
+    int hits;
+};
+
+struct hashed_command *hashed_commands = NULL;
+int hashed_capacity = 0, hashed_count = 0; //the capacity is always a power of 2
+char *hashed_path = NULL; //the $PATH the table was built for
+
+//the job table: jobs[id - 1], NULL for a free id. a new job gets the id after the highest one in use
+struct job **jobs = NULL;
+int job_capacity = 0, job_count = 0, last_job_id = 0;
+int current_job = 0; //the id %% & %+ refer to, 0 - the newest job
+int finished_jobs = 0; //jobs whose processes all finished, but are still in the table
+int queued_jobs = 0; //background jobs that wait for BG_LIMIT to let them start
+int last_background_job = 0; //the id of the last '&' job & the pid of its last stage, for $!
+pid_t last_background_pid = 0;
+
+//the processes that didn't finish yet, by pid: an open addressing table of pointers into the jobs
+struct process **pid_table = NULL;
+int pid_capacity = 0, pid_count = 0; //the capacity is always a power of 2
+
+int child_fd = -1; //a signalfd for SIGCHLD, which is blocked in the shell
+
+struct time_report *time_report = NULL; //the 'time' of the segment that runs now, NULL if it isn't timed
+
+//how many loops run now, and how many of them break / continue asked to leave
+int loop_depth = 0, break_count = 0, continue_count = 0;
+
+//$0, $1...$n: the arguments of the function that runs, or of the script. positional[0] is always the script's $0
+char **positional = NULL;
+int positional_count = 0; //n
+int function_depth = 0, returning = 0; //how many function calls run now, and if 'return' ends the innermost one
+int function_count = 0, alias_count = 0; //how many there are in env_vars[], so commands skip the lookups without them
+
+struct history history = {0, -1, -1, NULL, 0, NULL, 0, 0};
+
+//the limits ulimit set for the commands (the shell itself isn't limited), and what the next launch applies:
+//NULL - nothing, &shell_options - only the limits, or the options of a command with prefixes
+struct metrics metrics;
+const double metric_bounds[METRICS_BUCKETS] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+                                               0.25, 0.5, 1, 5, 30, 300};
+
+struct launch_options shell_options;
+struct launch_options *launch_options = NULL;
+
+//every probe tests tracing before it reads the clock, so a shell that doesn't trace pays only for the test
+int tracing = 0;
+struct trace trace = {NULL, NULL, NULL, 0, 0};
+
+//the builtins (but alias, unalias & unset) & jobs that ran: the rc file is snapshotted only if its lines ran none
+int effect_count = 0;
+
+struct limit_name limit_names[] = {
+        {'c', "core",    RLIMIT_CORE,    1024, "core file size (KB)"},
+        {'d', "data",    RLIMIT_DATA,    1024, "data seg size (KB)"},
+        {'f', "fsize",   RLIMIT_FSIZE,   1024, "file size (KB)"},
+        {'l', "memlock", RLIMIT_MEMLOCK, 1024, "max locked memory (KB)"},
+        {'n', "nofile",  RLIMIT_NOFILE,  1,    "open files"},
+        {'s', "stack",   RLIMIT_STACK,   1024, "stack size (KB)"},
+        {'t', "cpu",     RLIMIT_CPU,     1,    "cpu time (seconds)"},
+        {'u', "nproc",   RLIMIT_NPROC,   1,    "max user processes"},
+        {'v', "as",      RLIMIT_AS,      1024, "virtual memory (KB)"},
+        {0, NULL, 0, 0, NULL}
+};
+
+//here the program actually runs.
+//ex1 - reads commands from the user (or from a pipe), ex1 <script> - runs the script, ex1 -c <commands> - runs the commands
+int main(int argc, char *argv[]) {
+    char prompt[512], cwd[512]; //current working directory
+    char *command;
+    int enter_count = 0, ret;
+    long long traced;
+
+    signal(SIGTSTP, catch_stop);
+    shell_pid = getpid();
+    init_jobs();
+    init_launcher();
+    init_builtins();
+    init_trace();
+    if (open_input(argc, argv) != SUCCESS)
+        return 2;
+    init_editor();
+    if (interactive)
+        load_rc();
+
+    while (1) {
+        notify_jobs();
+        if (interactive)
+            print_prompt(prompt, cwd, sizeof(prompt), sizeof(cwd));
+        traced = tracing ? trace_clock() : 0;
+        command = read_command();
+        if (traced)
+            trace_add("read_command", traced, NULL);
+        if (command == NULL) { //end of input
+            start_remaining_jobs();
+            free_and_exit(last_status);
+        }
+
+        if ((command[0]) != '\n') {
+            if (interactive && (command = expand_history(command)) != NULL)
+                add_history(command); //before the parser changes the line in place
+            ret = command != NULL ? split_multiple_commands(command, 1) : SUCCESS;
+            if (ret == EXIT)
+                start_remaining_jobs();
+            if (ret == SYSTEM_FAILURES || ret == EXIT)
+                free_and_exit(ret == EXIT ? last_status : 1);
+            enter_count = 0;
+        } else { //the user pressed 'enter' only, increase enter_count
+            enter_count++;
+        }
+        if (interactive && enter_count == 3) { //The user pressed enter 3 times consecutively - exit
+            start_remaining_jobs();
+            free_and_exit(last_status);
+        }
+        arena_reset(&line_arena); //everything that was parsed from the line is freed at once
+        forget_listings();
+    }
+    return 0;
+}
+
+void print_prompt(char *prompt, char *cwd, int p_size, int c_size) {
+    if (getcwd(cwd, c_size) == NULL) { // Get current working directory
+        perror("getcwd() error");
+        exit(1);
+    }
+    // Generate the prompt string
+    snprintf(prompt, p_size, "#cmd:%d|#args:%d @%s ", cmd_count, arg_count, cwd);
+    printf("%s", prompt);
+    edit_prompt = prompt;
+    fflush(stdout);
+}
+
+//selects where the commands are read from. a terminal is interactive, anything else is read as a script
+int open_input(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "usage: %s [script | -c commands]\n", argv[0]);
+            return INVALID_INPUT;
+        }
+        input.fd = -1; //the commands are already in memory
+        input.buffer = argv[2];
+        input.end = strlen(argv[2]);
+        input.eof = 1;
+        interactive = 0;
+        //ex1 -c commands [$0 [$1...]]
+        positional = argc > 3 ? argv + 3 : argv;
+        positional_count = argc > 3 ? argc - 4 : 0;
+        return SUCCESS;
+    }
+    //ex1 [script [$1...]]: $0 is the script
+    positional = argc > 1 ? argv + 1 : argv;
+    positional_count = argc > 1 ? argc - 2 : 0;
+    if (argc > 1) {
+        input.fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (input.fd == -1) {
+            perror(argv[1]);
+            return INVALID_INPUT;
+        }
+    }
+    interactive = input.fd == STDIN_FILENO && isatty(STDIN_FILENO);
+    return SUCCESS;
+}
+
+char *read_command() { //get the command from the user
+    if (!interactive)
+        return read_script_line();
+    if (editing)
+        return edit_line();
+
+    ssize_t command_len;//might be negative
+    command_len = getline(&input.buffer, &input.size, stdin); //the buffer is reused for every line
+
+    if (command_len == -1) { //end of input (ctrl+D)
+        printf("\n");
+        return NULL;
+    }
+    if (command_len > 1 && input.buffer[command_len - 1] == '\n') {
+        input.buffer[command_len - 1] = '\0';  // remove newline character if there are any other chars in the input
+    }
+    return input.buffer;
+}
+
+//returns the next line of the script, null terminated inside the input buffer, or NULL at the end of the input.
+//the buffer is filled by big read()s, and a line that doesn't fit in it is moved to its beginning
+char *read_script_line() {
+    char *line, *newline;
+    ssize_t n;
+    while (1) {
+        newline = input.start < input.end ? memchr(input.buffer + input.start, '\n', input.end - input.start) : NULL;
+        if (newline != NULL) {
+            (*newline) = 0;
+            line = input.buffer + input.start;
+            input.start = newline + 1 - input.buffer;
+            return line;
+        }
+        if (input.eof) { //the last line may not end with a newline
+            if (input.start == input.end)
+                return NULL;
+            input.buffer[input.end] = 0; //there is always a spare byte after the data
+            line = input.buffer + input.start;
+            input.start = input.end;
+            return line;
+        }
+        if (input.start > 0) { //keep only the unread part
+            memmove(input.buffer, input.buffer + input.start, input.end - input.start);
+            input.end -= input.start;
+            input.start = 0;
+        }
+        if (input.end + 1 >= input.size) {
+            size_t size = input.size == 0 ? INPUT_BUFFER_SIZE : input.size * 2;
+            char *grown = realloc(input.buffer, size);
+            if (grown == NULL) {
+                perror("malloc failed");
+                return NULL;
+            }
+            input.buffer = grown;
+            input.size = size;
+        }
+        n = read(input.fd, input.buffer + input.end, input.size - input.end - 1);
+        if (n == -1 && errno == EINTR) //interrupted by SIGCHLD
+            continue;
+        if (n == -1)
+            perror("read error");
+        if (n <= 0)
+            input.eof = 1;
+        else
+            input.end += n;
+    }
+}
+
+//builds argv[] for the command & return it to split_multiple_commands.
+//It deals with regular commands as well as with setting environment variables.
+//argv[] & the expanded words are allocated from line_arena. redirects are the command's redirections (or NULL).
+//It returns 'SUCCESS' if the input is a legal command, and there were no memory allocation errors
+int split_single_command(char ***args, struct redirect **redirects, struct command *c) {
+    struct arg_list list = {NULL, 0, c->word_count + 1};
+    int ret;
+    long long traced = tracing ? trace_clock() : 0;
+
+    (*args) = NULL;
+    (*redirects) = NULL;
+    if (c->error != NULL) {
+        printf("%s\n", c->error);
+        last_status = 2;
+        return INVALID_INPUT;
+    }
+    if (c->word_count == 0) //it isn't a command
+        return INVALID_INPUT;
+    if (c->is_assignment)
+        return assign_variable(c);
+
+    list.args = arena_alloc(&line_arena, list.capacity * sizeof(char *));
+    if (list.args == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    if (c->redirection_count > 0) {
+        (*redirects) = arena_alloc(&line_arena, (c->redirection_count + 1) * sizeof(struct redirect));
+        if ((*redirects) == NULL) {
+            printf("malloc failed\n");
+            return SYSTEM_FAILURES;
+        }
+    }
+    for (int i = 0; i < c->redirection_count; i++) {
+        struct redirection *r = &parser.redirections[c->first_redirection + i];
+        struct redirect *to = &(*redirects)[i];
+        to->type = r->type;
+        to->target = NULL;
+        to->fd = r->type == REDIRECT_HEREDOC ? heredoc_fds[c->first_redirection + i] : -1;
+        if (r->target.text != NULL && r->type != REDIRECT_HEREDOC &&
+            (ret = expand_word(&r->target, &to->target, 0)) != SUCCESS)
+            return ret;
+        arg_count += r->target.text != NULL ? 2 : 1; //the operator & its target are counted as arguments
+    }
+    if (c->redirection_count > 0)
+        (*redirects)[c->redirection_count].type = REDIRECT_NONE;
+    list.args[0] = NULL;
+    struct definition *alias = find_alias(&parser.words[c->first_word]);
+    if (alias != NULL && (ret = expand_alias(alias, &list)) != SUCCESS)
+        return ret;
+    for (int i = alias != NULL; i < c->word_count; i++) {
+        //echo prints an unassigned variable as nothing, other commands refuse to run
+        ret = expand_fields(&parser.words[c->first_word + i], &list,
+                            list.count > 0 && strcmp(list.args[0], "echo") == 0);
+        if (ret != SUCCESS)
+            return ret;
+    }
+    if (list.count == 0) //the words were only blank $(...)s
+        return INVALID_INPUT;
+    (*args) = list.args;
+
+    cmd_count++;
+    arg_count += list.count;
+    if (traced)
+        trace_add("expand", traced, list.args[0]);
+    return SUCCESS;
+}
+
+//<name>=<value> sets a shell variable. the value is the rest of the command: its words joined by single spaces.
+//It returns INVALID_INPUT, because the input is actually valid, but not a command
+int assign_variable(struct command *c) {
+    char *words[c->word_count];
+    char *name, *value, *equal;
+    size_t len = 0;
+    int ret;
+
+    for (int i = 0; i < c->word_count; i++) {
+        ret = expand_word(&parser.words[c->first_word + i], &words[i], 0);
+        if (ret != SUCCESS)
+            return ret;
+        len += strlen(words[i]) + 1;
+    }
+    equal = strchr(words[0], '='); //the name has no variables, so it's the same '=' as in the word
+    name = arena_strndup(&line_arena, words[0], equal - words[0]);
+    value = arena_alloc(&line_arena, len);
+    if (name == NULL || value == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    strcpy(value, equal + 1);
+    for (int i = 1; i < c->word_count; i++) {
+        strcat(value, SPACE);
+        strcat(value, words[i]);
+    }
+    if (my_setenv(name, value) == SYSTEM_FAILURES)
+        return SYSTEM_FAILURES;
+    last_status = 0;
+    return INVALID_INPUT;
+}
+
+/*handle with commands seperated by ; (or by &, which runs the command before it in the background)
+gets the full message the user entered & parses it once into pipelines (parse.c).
+sends each single command to split_single_command(), which initialises argv[] or set an environment variable
+if initialisation succeeded, the function sends argv[] to execute_single_command() that executes it.
+ argv[] & its arguments are allocated from line_arena, so they are freed with the rest of the line in main().
+ returns EXIT or SYSTEM_FAILURES if the shell should exit, SUCCESS otherwise
+ */
+int split_multiple_commands(char *command, int from_input) {
+    if (command == NULL)
+        return SUCCESS;
+
+    int is_command;
+    long long traced = tracing ? trace_clock() : 0;
+
+    //reading the bodies of here-docs reuses the input's buffer, which the line is in
+    if (strstr(command, "<<") != NULL && (command = arena_strdup(&line_arena, command)) == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    is_command = parse_line(&parser, command);
+    heredoc_fds = NULL;
+    if (is_command == PARSE_INCOMPLETE) //an if/while/for that goes on in the next lines
+        is_command = from_input ? read_compound(command) : syntax_error_at_end();
+
+    if (is_command == PARSE_NO_MEMORY) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    if (is_command == PARSE_ERROR) { //unbalanced quotes or a misplaced keyword - nothing runs
+        printf("%s\n", parser.error);
+        last_status = 2;
+        return SUCCESS;
+    }
+    if (heredoc_fds == NULL && read_heredocs(0) != SUCCESS) { //a multi-line command read its here-docs already
+        close_heredocs();
+        return SYSTEM_FAILURES;
+    }
+    if (traced) //the line (& the lines of its compound commands & here-docs) was read & parsed
+        trace_add("parse", traced, NULL);
+    is_command = run_list(parser.root);
+    close_heredocs();
+    return is_command == SYSTEM_FAILURES || is_command == EXIT ? is_command : SUCCESS;
+}
+
+/*reads the next lines of the input into the tree, until the compound commands (and && / ||) of the line are closed.
+ the next read reuses the input's buffer, so the lines are copied into line_arena - the line that was already parsed
+ is copied too, and its words are moved there. the bodies of here-docs are read right after the line they're in*/
+int read_compound(char *line) {
+    char *copy = arena_strndup(&line_arena, line, parser.line_len), *next;
+    int ret = PARSE_INCOMPLETE, first = 0;
+
+    if (copy == NULL)
+        return PARSE_NO_MEMORY;
+    move_line(&parser, line, copy);
+    while (ret == PARSE_INCOMPLETE) {
+        if (read_heredocs(first) != SUCCESS)
+            return PARSE_NO_MEMORY;
+        first = parser.redirection_count;
+        if (interactive) {
+            printf("> ");
+            fflush(stdout);
+            edit_prompt = "> ";
+        }
+        if ((next = read_command()) == NULL)
+            return syntax_error_at_end();
+        if ((next = arena_strdup(&line_arena, next)) == NULL)
+            return PARSE_NO_MEMORY;
+        ret = parse_more(&parser, next);
+    }
+    if (ret == PARSE_OK && read_heredocs(first) != SUCCESS)
+        return PARSE_NO_MEMORY;
+    return ret;
+}
+
+//the input ended inside a compound command, or after && / ||. the error names what the innermost one is missing
+int syntax_error_at_end() {
+    int node = parser.frames[parser.frame_count - 1].node, type = node == -1 ? -1 : parser.nodes[node].type;
+
+    if (type == -1)
+        parser.error = "Error: Unexpected end of input: a command is missing after '&&' or '||'";
+    else if (type == NODE_IF)
+        parser.error = "Error: Unexpected end of input: 'fi' is missing";
+    else if (type == NODE_GROUP || type == NODE_FUNCTION)
+        parser.error = "Error: Unexpected end of input: '}' is missing";
+    else
+        parser.error = "Error: Unexpected end of input: 'done' is missing";
+    return PARSE_ERROR;
+}
+
+//frees the input & all the shell's data structures, and exits
+void free_and_exit(int status) {
+    if (input.size > 0)
+        free(input.buffer);
+    if (input.fd > STDIN_FILENO)
+        close(input.fd);
+    dump_metrics(1);
+    stop_trace();
+    free_env_vars();
+    free_parser(&parser);
+    free_parser(&substitution_check);
+    free_jobs();
+    close_history();
+    free_metrics();
+    forget_listings();
+    free(glob_buffer);
+    free_path_trie();
+    arena_free(&line_arena);
+    exit(status);
+}
+
+void make_fork(pid_t *p) {
+    long long traced = tracing ? trace_clock() : 0;
+
+    (*p) = fork();
+    if ((*p) == 0) //a child shell doesn't write the father's events again
+        tracing = 0;
+    else if (traced)
+        trace_add("fork", traced, NULL);
+}
+
+//path is the command's cached full path, or NULL to search $PATH
+int make_exec(char *path, char **args) {
+    int err;
+    if (path != NULL)
+        execv(path, args);
+    else
+        execvp(args[0], args);
+    err = errno; //illegal command - execvp returned
+    exec_error(STDERR_FILENO, args[0], path != NULL ? "execv" : "execvp", err);
+    errno = err;
+    return INVALID_INPUT;//normally shouldn't come here
+}
+
+//a command couldn't be executed: which call failed & why, like "nosuch: execvp: No such file or directory".
+//it's written to the command's stderr (fd, -1 for the shell's), so 2> hides it like any error of the command
+void exec_error(int fd, char *name, char *call, int err) {
+    dprintf(fd != -1 ? fd : STDERR_FILENO, "%s: %s: %s\n", name, call, strerror(err));
+}
+
+/*opens the redirections of a command into fds[]: its stdin, stdout & stderr, -1 for the ones that aren't redirected.
+ they are applied in the order they were written, so '2>&1 > file' leaves stderr where stdout was.
+ out_fd is the stdout the command gets without redirections (-1 - the shell's own), so 2>&1 of a stage of a
+ pipeline goes into the pipe. the fds are close-on-exec, so only their dup2()ed copies survive in the command,
+ and are closed by close_redirections() once the command was launched*/
+int open_redirections(struct redirect *r, int out_fd, int fds[3]) {
+    fds[0] = fds[1] = fds[2] = -1;
+    for (; r != NULL && r->type != REDIRECT_NONE; r++) {
+        if (open_redirection_target(r, out_fd, fds) != SUCCESS) {
+            close_redirections(fds);
+            last_status = 1;
+            return INVALID_INPUT;
+        }
+    }
+    return SUCCESS;
+}
+
+//opens one redirection into its place in fds[], instead of an earlier one of the same fd
+int open_redirection_target(struct redirect *r, int out_fd, int fds[3]) {
+    int fd = -1, target = r->type == REDIRECT_IN || r->type == REDIRECT_HEREDOC || r->type == REDIRECT_HERESTRING ? 0 :
+                          r->type == REDIRECT_OUT || r->type == REDIRECT_APPEND || r->type == REDIRECT_OUT_TO_ERR ? 1 : 2;
+    size_t len;
+
+    switch (r->type) {
+        case REDIRECT_IN:
+            fd = open(r->target, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIRECT_OUT:
+        case REDIRECT_ERR:
+            fd = open(r->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            break;
+        case REDIRECT_APPEND:
+        case REDIRECT_ERR_APPEND:
+            fd = open(r->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            break;
+        case REDIRECT_ERR_TO_OUT: //a copy of what stdout is at this point
+            fd = fcntl(fds[1] != -1 ? fds[1] : out_fd != -1 ? out_fd : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+            break;
+        case REDIRECT_OUT_TO_ERR: //stderr isn't a pipe in any stage, without 2> it's the shell's
+            fd = fcntl(fds[2] != -1 ? fds[2] : STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+            break;
+        case REDIRECT_HEREDOC: //the body was read with the line. it's read from its beginning by every command
+            if ((fd = fcntl(r->fd, F_DUPFD_CLOEXEC, 0)) != -1)
+                lseek(fd, 0, SEEK_SET);
+            break;
+        case REDIRECT_HERESTRING: //a memory file, so nothing is written to the disk & the command can seek it
+            len = strlen(r->target);
+            if ((fd = memfd_create("herestring", MFD_CLOEXEC)) == -1)
+                break;
+            r->target[len] = '\n'; //the word is in line_arena & is written with a newline after it, for one write()
+            if (write(fd, r->target, len + 1) != (ssize_t) len + 1) {
+                close(fd);
+                fd = -1;
+            }
+            r->target[len] = '\0';
+            lseek(fd, 0, SEEK_SET);
+            break;
+    }
+    if (fd == -1) {
+        if (r->type == REDIRECT_HERESTRING || r->type == REDIRECT_HEREDOC || r->type == REDIRECT_ERR_TO_OUT ||
+            r->type == REDIRECT_OUT_TO_ERR)
+            perror("redirection");
+        else
+            printf("cannot open file\n");
+        return INVALID_INPUT;
+    }
+    if (fds[target] != -1)
+        close(fds[target]);
+    fds[target] = fd;
+    return SUCCESS;
+}
+
+void close_redirections(int fds[3]) {
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+//the command's stdout goes to a file (or to stderr), and not to the pipe of its stage
+int redirects_stdout(struct redirect *r) {
+    for (; r != NULL && r->type != REDIRECT_NONE; r++)
+        if (r->type == REDIRECT_OUT || r->type == REDIRECT_APPEND || r->type == REDIRECT_OUT_TO_ERR)
+            return 1;
+    return 0;
+}
+
+/*reads the bodies of the here-docs of redirections[first..], in the order they were written: the next lines of the
+ input, up to a line that is their delimiter. every body is kept in a memory file (no temp file) for its command.
+ the $NAMEs of the body are expanded, unless the delimiter was quoted*/
+int read_heredocs(int first) {
+    struct redirection *r;
+    char *line, *delimiter;
+    size_t len;
+    int *fds, count = 0;
+
+    for (int i = first; i < parser.redirection_count; i++)
+        count += parser.redirections[i].type == REDIRECT_HEREDOC;
+    if (count == 0)
+        return SUCCESS;
+    //the fds of the earlier lines of a multi-line command are kept
+    fds = arena_alloc(&line_arena, parser.redirection_count * sizeof(int));
+    if (fds == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    for (int i = 0; i < parser.redirection_count; i++)
+        fds[i] = heredoc_fds != NULL && i < first ? heredoc_fds[i] : -1;
+    heredoc_fds = fds;
+    for (int i = first; i < parser.redirection_count; i++) {
+        r = &parser.redirections[i];
+        if (r->type != REDIRECT_HEREDOC)
+            continue;
+        delimiter = r->target.text;
+        if ((heredoc_fds[i] = memfd_create("heredoc", MFD_CLOEXEC)) == -1) {
+            perror("memfd_create");
+            return SYSTEM_FAILURES;
+        }
+        while (1) {
+            if (interactive) {
+                printf("> ");
+                fflush(stdout);
+                edit_prompt = "> ";
+            }
+            if ((line = read_command()) == NULL) {
+                fprintf(stderr, "warning: here-document delimited by end-of-file (wanted `%s')\n", delimiter);
+                break;
+            }
+            len = strlen(line);
+            if (len > 0 && line[len - 1] == '\n')
+                line[len - 1] = '\0';
+            if (strcmp(line, delimiter) == 0)
+                break;
+            if (write_heredoc_line(heredoc_fds[i], line, !r->target.quoted) != SUCCESS) {
+                perror("heredoc");
+                return SYSTEM_FAILURES;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+//writes a line of a here-doc's body & its newline, with its $NAMEs replaced by their values (unassigned - nothing)
+int write_heredoc_line(int fd, char *line, int expand) {
+    struct iovec pieces[OUT_PIECES];
+    int count = 0;
+    char *name, *value, saved;
+
+    while (1) {
+        char *dollar = expand ? strchr(line, '$') : NULL;
+        while (dollar != NULL && !is_name_char(dollar[1], 1))
+            dollar = strchr(dollar + 1, '$');
+        if (count + 3 > OUT_PIECES || dollar == NULL) { //the text before the next $NAME might not fit
+            if (dollar == NULL) {
+                pieces[count].iov_base = line;
+                pieces[count++].iov_len = strlen(line);
+                pieces[count].iov_base = "\n";
+                pieces[count++].iov_len = 1;
+            }
+            if (writev(fd, pieces, count) == -1)
+                return INVALID_INPUT;
+            if (dollar == NULL)
+                return SUCCESS;
+            count = 0;
+        }
+        pieces[count].iov_base = line;
+        pieces[count++].iov_len = dollar - line;
+        name = dollar + 1;
+        for (line = name; is_name_char(*line, 0); line++);
+        saved = *line; //the name is looked up null terminated inside the line
+        *line = '\0';
+        value = my_getenv(name);
+        *line = saved;
+        if (value != NULL) {
+            pieces[count].iov_base = value;
+            pieces[count++].iov_len = strlen(value);
+        }
+    }
+}
+
+void close_heredocs() {
+    for (int i = 0; heredoc_fds != NULL && i < parser.redirection_count; i++)
+        if (heredoc_fds[i] != -1)
+            close(heredoc_fds[i]);
+    heredoc_fds = NULL;
+}
+
+/*launches args as a new process, with stdin/stdout/stderr replaced by in_fd/out_fd/err_fd (-1 keeps the shell's own).
+ the fds must be close-on-exec, so only their dup2()ed copies survive in the command.
+ returns SUCCESS with the child's pid in p, INVALID_INPUT if the command couldn't be executed (spawn only -
+ a forked child reports it by its exit value), or SYSTEM_FAILURES if no process could be created*/
+int launch_command(char **args, int in_fd, int out_fd, int err_fd, pid_t *p) {
+    fflush(stdout); //the shell's own output must come before the command's, also when stdout isn't a terminal
+    double start = now_seconds();
+    long long traced = tracing ? trace_clock() : 0;
+    char *path = find_command(args[0]); //resolved here, so the cache is filled in the shell & not in a child
+    int ret;
+
+    //every engine returns once the command was executed, so this is the fork -> exec latency
+    if (launch_mode == LAUNCH_SPAWN)
+        ret = spawn_command(path, args, in_fd, out_fd, err_fd, p);
+    else if (launch_mode == LAUNCH_ZYGOTE)
+        ret = zygote_command(path, args, in_fd, out_fd, err_fd, p);
+    else
+        ret = fork_command(path, args, in_fd, out_fd, err_fd, p);
+    if (ret == SUCCESS)
+        observe(&metrics.launch, now_seconds() - start);
+    if (traced)
+        trace_add("exec", traced, args[0]);
+    return ret;
+}
+
+/*posix_spawnp() doesn't copy the shell's page tables: glibc runs the child on clone(CLONE_VM|CLONE_VFORK),
+ so the cost doesn't grow with the shell's memory. The redirections are applied by file actions,
+ and exec errors are reported back to the shell directly instead of by the child's exit value.
+ falls back to fork() when spawn itself can't create the process, and for launch options: posix_spawn() can't
+ set the affinity, the niceness or the limits of the child, and setting them in the shell can't be undone*/
+int spawn_command(char *path, char **args, int in_fd, int out_fd, int err_fd, pid_t *p) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults, mask;
+    int err;
+
+    if (launch_options != NULL)
+        return fork_command(path, args, in_fd, out_fd, err_fd, p);
+
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return fork_command(path, args, in_fd, out_fd, err_fd, p);
+    if (posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return fork_command(path, args, in_fd, out_fd, err_fd, p);
+    }
+    if (in_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    if (out_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    if (err_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+
+    //return deal with signals to default, like the forked child does
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGTSTP);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    sigemptyset(&mask); //SIGCHLD is blocked in the shell
+    posix_spawnattr_setsigmask(&attr, &mask);
+#ifdef POSIX_SPAWN_USEVFORK
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_USEVFORK);
+#else
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+#endif
+
+    if (path != NULL)
+        err = posix_spawn(p, path, &actions, &attr, args, environ);
+    else
+        err = posix_spawnp(p, args[0], &actions, &attr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err == 0)
+        return SUCCESS;
+    if (err == EAGAIN || err == ENOMEM || err == ENOSYS) //the process wasn't created - try the classic way
+        return fork_command(path, args, in_fd, out_fd, err_fd, p);
+    exec_error(err_fd, args[0], path != NULL ? "posix_spawn" : "posix_spawnp", err); //illegal command
+    last_status = 127;
+    return INVALID_INPUT;
+}
+
+/*the classic launch: fork() the shell, redirect in the child & execvp(). the father waits until the exec happened
+ or failed, like spawn does: a close-on-exec pipe is closed empty by a good exec, and gets the errno of a bad one*/
+int fork_command(char *path, char **args, int in_fd, int out_fd, int err_fd, pid_t *p) {
+    int errpipe[2], err;
+    ssize_t n;
+
+    if (pipe2(errpipe, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return SYSTEM_FAILURES;
+    }
+    make_fork(p);
+    if ((*p) < 0) {//forking failed
+        perror("forking failed");
+        close(errpipe[0]);
+        close(errpipe[1]);
+        return SYSTEM_FAILURES;
+    }
+    if ((*p) == 0) {//child's process
+        signal(SIGCHLD, SIG_DFL);//return deal with signals to default
+        signal(SIGTSTP, SIG_DFL);
+        set_sigchld_blocked(0);
+        if (in_fd != -1)
+            dup2(in_fd, STDIN_FILENO);
+        if (out_fd != -1)
+            dup2(out_fd, STDOUT_FILENO);
+        if (err_fd != -1)
+            dup2(err_fd, STDERR_FILENO);
+        if (launch_options != NULL)
+            apply_launch_options(launch_options);
+
+        make_exec(path, args);
+        //illegal command - execvp returned
+        err = errno;
+        n = write(errpipe[1], &err, sizeof(err));
+        exit(127); //the father knows whether the command was legal by the exit value.
+    }
+    close(errpipe[1]);
+    while ((n = read(errpipe[0], &err, sizeof(err))) == -1 && errno == EINTR);
+    close(errpipe[0]);
+    if (n == sizeof(err)) { //the child printed why, and exited
+        waitpid(*p, NULL, 0);
+        last_status = 127;
+        return INVALID_INPUT;
+    }
+    return SUCCESS;
+}
+
+//selects the launch engine: EX1_LAUNCH=fork restores the fork()+execvp() path, zygote starts the fork server,
+//spawn is the default
+void init_launcher() {
+    char *mode = getenv("EX1_LAUNCH");
+    if (mode == NULL || strcmp(mode, "spawn") == 0)
+        launch_mode = LAUNCH_SPAWN;
+    else if (strcmp(mode, "fork") == 0)
+        launch_mode = LAUNCH_FORK;
+    else if (strcmp(mode, "zygote") == 0)
+        launch_mode = start_zygote() == SUCCESS ? LAUNCH_ZYGOTE : LAUNCH_SPAWN;
+    else
+        fprintf(stderr, "EX1_LAUNCH should be fork, spawn or zygote, using spawn\n");
+}
+
+void set_sigchld_blocked(int blocked) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(blocked ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+//executes the command in a new process, as a job. the father waits until his child is completed.
+//the redirections are opened here, in the father, so the launch engines only have to dup2() them
+int execute_single_command(char **args, struct redirect *redirects, int run_in_background) {
+    if (args == NULL || args[0] == NULL) {
+        cmd_count--;
+        fprintf(stderr, "no arguments\n");
+        return INVALID_INPUT;
+    }
+    pid_t p = -1;
+    int fds[3], ret;
+    struct definition *f = function_count > 0 ? find_definition(args[0], ENTRY_FUNCTION) : NULL;
+    struct builtin *b = f == NULL ? find_builtin(args[0]) : NULL;
+
+    if (f != NULL) //runs in the shell too
+        return run_function(f, args, redirects);
+    if (b != NULL) //no process is needed
+        return run_builtin(b, args, redirects);
+    if (run_in_background && background_full())
+        return queue_job(&args, &redirects, 1);
+    if (is_launch_prefix(args[0])) { //nice, taskset...: launched like a stage, so a builtin after them is a process too
+        launch_stages(&args, &redirects, 1, NULL, &p);
+        return start_job(&args, &p, 1, run_in_background);
+    }
+    if (open_redirections(redirects, -1, fds) != SUCCESS)
+        return INVALID_INPUT;
+    ret = launch_command(args, fds[0], fds[1], fds[2], &p);
+    close_redirections(fds);
+    if (ret == SYSTEM_FAILURES)
+        return ret;
+    if (ret != SUCCESS) { //the job still records the command's 127
+        p = -1;
+        uncount_command(args, redirects);
+    }
+
+    // Wait for child process to complete
+    return start_job(&args, &p, 1, run_in_background);
+}
+
+//a command that couldn't be executed isn't counted in the prompt: its arguments & redirections are taken back
+void uncount_command(char **args, struct redirect *redirects) {
+    cmd_count--;
+    for (; *args != NULL; args++)
+        arg_count--;
+    for (; redirects != NULL && redirects->type != REDIRECT_NONE; redirects++)
+        arg_count -= redirects->type == REDIRECT_ERR_TO_OUT || redirects->type == REDIRECT_OUT_TO_ERR ? 1 : 2;
+}
+
+//every stage is parsed in the father before anything is launched, so the stages can be spawned without a fork.
+//each stage reads the previous pipe & writes to the next one (or to its own '>' file)
+int execute_pipe_commands(struct pipeline *pipeline) {
+    int num_commands = pipeline->command_count, run_in_background = pipeline->background;
+    char ***args = arena_alloc(&line_arena, num_commands * sizeof(char **));
+    struct redirect **redirects = arena_alloc(&line_arena, num_commands * sizeof(struct redirect *));
+    pid_t *pids = arena_alloc(&line_arena, num_commands * sizeof(pid_t));
+    long long traced = tracing ? trace_clock() : 0;
+    if (args == NULL || redirects == NULL || pids == NULL) {
+        perror("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+
+    // build argv[] of every command of the pipeline
+    int is_valid = SUCCESS;
+    for (int i = 0; i < num_commands && is_valid == SUCCESS; i++)
+        is_valid = split_single_command(&args[i], &redirects[i], &parser.commands[pipeline->first_command + i]);
+    if (is_valid != SUCCESS) //nothing runs
+        return is_valid == SYSTEM_FAILURES ? SYSTEM_FAILURES : SUCCESS;
+    if (run_in_background)
+        arg_count++; //'&' is counted as an argument
+    if (run_in_background && background_full())
+        return queue_job(args, redirects, num_commands);
+
+    char *value = get_option("PIPE_METER");
+    struct pipe_link *links = NULL; //only a foreground pipeline can be metered, the shell forwards its data
+    double started = now_seconds();
+
+    if (value != NULL && strcmp(value, "0") != 0 && !run_in_background) {
+        links = arena_alloc(&line_arena, num_commands * sizeof(struct pipe_link));
+        if (links == NULL) {
+            perror("malloc failed\n");
+            return SYSTEM_FAILURES;
+        }
+        memset(links, 0, num_commands * sizeof(struct pipe_link));
+    }
+    launch_stages(args, redirects, num_commands, links, pids);
+
+    //all the stages are one job: the father waits for every one of them, not only for the last
+    if (links == NULL) {
+        if (start_job(args, pids, num_commands, run_in_background) != SUCCESS)
+            return SYSTEM_FAILURES;
+    } else { //the job is known while the data is forwarded, so a stage that stops (^Z) is seen there
+        struct job *job = add_job(args, pids, num_commands, 0);
+        if (job == NULL)
+            return SYSTEM_FAILURES;
+        forward_pipeline(links, num_commands - 1, job);
+        wait_for_job(job);
+        print_meter_report(links, args, num_commands, started);
+    }
+    if (traced)
+        trace_add("pipeline", traced, args[0][0]);
+    return SUCCESS;
+}
+
+//launches the stages of a pipeline (or a single command): each stage reads the previous pipe & writes to the next one
+//(or to its own '>' file). pids[] gets the processes, -1 for a stage that couldn't be executed, SKIPPED_STAGE for one
+//whose redirections failed.
+//links[] is given for a metered pipeline, NULL otherwise. with PIPE_SPREAD=1 every stage is pinned to a core of its own
+void launch_stages(char ***args, struct redirect **redirects, int num_commands, struct pipe_link *links, pid_t *pids) {
+    int prev_read = -1;
+    int pipefd[2], fds[3];
+    int in_fd, out_fd, ret, skipped;
+    char *value = get_option("PIPE_SIZE");
+    int pipe_size = value != NULL ? atoi(value) : 0;
+    struct launch_options options;
+    cpu_set_t allowed;
+    char **command;
+    int cores = 0;
+    long long traced;
+
+    value = get_option("PIPE_SPREAD");
+    if (value != NULL && strcmp(value, "0") != 0 && num_commands > 1 &&
+        sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        cores = CPU_COUNT(&allowed);
+
+    for (int i = 0; i < num_commands; i++) {
+        traced = tracing ? trace_clock() : 0;
+        pipefd[0] = pipefd[1] = -1;
+        if (i != num_commands - 1 && pipe2(pipefd, O_CLOEXEC) == -1) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+        if (pipe_size > 0 && pipefd[0] != -1)
+            set_pipe_size(pipefd[1], pipe_size);
+        if (links != NULL) {
+            links[i].from = links[i].to = -1;
+            if (pipefd[0] != -1 && !redirects_stdout(redirects[i]) &&
+                open_pipe_link(&links[i], pipefd, pipe_size) != SUCCESS)
+                exit(EXIT_FAILURE);
+        }
+        //the stage's own redirections win over the pipes. a stage whose redirections can't be opened doesn't run
+        //(the message was printed): its pipe ends are closed below, so its neighbours get EOF / EPIPE
+        skipped = open_redirections(redirects[i], pipefd[1], fds) != SUCCESS;
+        in_fd = fds[0] != -1 ? fds[0] : prev_read;
+        out_fd = fds[1] != -1 ? fds[1] : pipefd[1];
+
+        pids[i] = -1; //a stage that couldn't be executed stays -1, and its status is 127
+        command = skipped ? NULL : args[i];
+        if (command != NULL && (cores > 0 || is_launch_prefix(command[0])))
+            command = set_launch_options(command, &options, cores > 0 ? nth_cpu(&allowed, i % cores) : -1);
+        struct definition *f = command != NULL && function_count > 0 ? find_definition(command[0], ENTRY_FUNCTION) : NULL;
+        struct builtin *b = command != NULL && f == NULL ? find_builtin(command[0]) : NULL;
+        if (command == NULL) //its redirections failed, or a wrong prefix: the message was printed
+            ret = INVALID_INPUT;
+        else if (f != NULL)
+            ret = launch_function(f, command, in_fd, out_fd, fds[2], &pids[i]);
+        else if (b != NULL)
+            ret = launch_builtin(b, command, in_fd, out_fd, fds[2], &pids[i]);
+        else
+            ret = launch_command(command, in_fd, out_fd, fds[2], &pids[i]);
+        reset_launch_options();
+        if (ret == SYSTEM_FAILURES)
+            exit(EXIT_FAILURE);
+        if (ret != SUCCESS) {
+            pids[i] = skipped ? SKIPPED_STAGE : -1;
+            uncount_command(args[i], redirects[i]);
+        }
+
+        // the father doesn't need the ends that were handed to the stage
+        close_redirections(fds);
+        if (prev_read != -1)
+            close(prev_read);
+        if (pipefd[1] != -1)
+            close(pipefd[1]);
+        prev_read = pipefd[0]; // Save the read end of the current pipe for the next command
+        if (traced) //the pipe, the redirections & the launch of the stage
+            trace_add("stage", traced, args[i][0]);
+    }
+}
+
+
+/********************************************* COMPOUND COMMANDS ****************************************************************/
+//the line is a list of nodes: pipelines, and if/while/until/for whose parts are lists too (see parse.h).
+//a loop runs its parsed body again & again - only the words are expanded again, and what the expansion took from
+//line_arena is released after every iteration, so a long loop doesn't grow the arena
+
+//runs the nodes of a list, each one after its && / || said so. stops early for exit, break, continue & return
+int run_list(int index) {
+    int ret = SUCCESS;
+
+    for (; index != -1; index = parser.nodes[index].next) {
+        struct node *node = &parser.nodes[index];
+        if ((node->connector == CONNECT_AND && last_status != 0) ||
+            (node->connector == CONNECT_OR && last_status == 0))
+            continue;
+        switch (node->type) {
+            case NODE_PIPELINE:
+                ret = run_pipeline(&parser.pipelines[node->pipeline]);
+                break;
+            case NODE_IF:
+                ret = run_if(node);
+                break;
+            case NODE_WHILE:
+            case NODE_UNTIL:
+                ret = run_while(node);
+                break;
+            case NODE_FOR:
+                ret = run_for(node);
+                break;
+            case NODE_GROUP:
+                ret = run_list(node->body);
+                break;
+            default:
+                ret = define_function(node);
+        }
+        if (ret == SYSTEM_FAILURES || ret == EXIT || break_count > 0 || continue_count > 0 || returning)
+            break;
+    }
+    return ret;
+}
+
+int run_pipeline(struct pipeline *pipeline) {
+    char **args;
+    struct redirect *redirects;
+    struct time_report report;
+    int ret = SUCCESS;
+
+    if (pipeline->timed != TIME_NONE)
+        start_timing(&report, pipeline);
+
+    if (pipeline->command_count > 1)//pipe command
+        ret = execute_pipe_commands(pipeline);
+    else if (pipeline->command_count == 1) {//not pipe command
+        ret = split_single_command(&args, &redirects, &parser.commands[pipeline->first_command]);
+        if (ret == SUCCESS) { //the command is readable (not space or null)
+            if (pipeline->background)
+                arg_count++; //'&' is counted as an argument
+            ret = execute_single_command(args, redirects, pipeline->background);//here everything happens:)
+        }
+    }
+    if (pipeline->timed != TIME_NONE)
+        print_time_report(&report);
+    dump_metrics(0);
+    return ret;
+}
+
+//the status of an if is the one of the part that ran, 0 if none did
+int run_if(struct node *node) {
+    int ret = run_list(node->cond);
+
+    if (ret == SYSTEM_FAILURES || ret == EXIT || break_count > 0 || continue_count > 0 || returning)
+        return ret;
+    if (last_status == 0)
+        return run_list(node->body);
+    if (node->other != -1)
+        return run_list(node->other);
+    last_status = 0;
+    return SUCCESS;
+}
+
+//while runs the body as long as the condition succeeds, until as long as it fails.
+//the status is the one of the last run of the body, 0 if it didn't run
+int run_while(struct node *node) {
+    struct arena_mark mark;
+    int ret, status = 0;
+
+    arena_mark(&line_arena, &mark);
+    loop_depth++;
+    while (1) {
+        ret = run_list(node->cond);
+        if (ret == SYSTEM_FAILURES || ret == EXIT || leave_loop())
+            break;
+        if ((last_status == 0) != (node->type == NODE_WHILE))
+            break;
+        ret = run_list(node->body);
+        status = last_status;
+        if (ret == SYSTEM_FAILURES || ret == EXIT || leave_loop())
+            break;
+        arena_release(&line_arena, &mark);
+    }
+    loop_depth--;
+    if (ret != SYSTEM_FAILURES && ret != EXIT)
+        last_status = status;
+    return ret;
+}
+
+//the words after 'in' are expanded once, before the first iteration (a $(...) output is split into several values).
+//without 'in' the values are the positional parameters
+int run_for(struct node *node) {
+    struct arg_list list = {NULL, 0, (node->word_count == -1 ? positional_count : node->word_count) + 1};
+    struct arena_mark mark;
+    char *name = parser.words[node->first_word].text;
+    int ret = SUCCESS;
+
+    list.args = arena_alloc(&line_arena, list.capacity * sizeof(char *));
+    if (list.args == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    list.args[0] = NULL;
+    for (int i = 1; i <= node->word_count; i++) {
+        if ((ret = expand_fields(&parser.words[node->first_word + i], &list, 0)) != SUCCESS)
+            return ret;
+    }
+    for (int i = 1; node->word_count == -1 && i <= positional_count; i++)
+        add_arg(&list, positional[i]); //there's room for all of them
+
+
+    last_status = 0;
+    arena_mark(&line_arena, &mark);
+    loop_depth++;
+    for (int i = 0; i < list.count; i++) {
+        if (my_setenv(name, list.args[i]) == SYSTEM_FAILURES) {
+            ret = SYSTEM_FAILURES;
+            break;
+        }
+        ret = run_list(node->body);
+        if (ret == SYSTEM_FAILURES || ret == EXIT || leave_loop())
+            break;
+        arena_release(&line_arena, &mark);
+    }
+    loop_depth--;
+    return ret;
+}
+
+//after a part of a loop ran: returns 1 if the loop must stop - for break, return, or a continue of an outer loop
+int leave_loop() {
+    if (returning)
+        return 1;
+    if (break_count > 0) {
+        break_count--;
+        return 1;
+    }
+    if (continue_count > 0) {
+        continue_count--;
+        return continue_count > 0;
+    }
+    return 0;
+}
+
+/********************************************* FUNCTIONS & ALIASES ****************************************************************/
+//a function's body is parsed with the line that defines it, and the tree is copied into the variables' table.
+//a call runs that tree in the shell itself, the same way $(...) runs its line: the global parser is swapped for it.
+//only the external commands inside a function are launched as processes. an alias is kept parsed too: a simple command
+//whose words take the place of the first word of a command
+
+//name() { ... } - keeps a copy of the body. a here-doc's body belongs to the line, so a function can't have one
+int define_function(struct node *node) {
+    char *name = parser.words[node->first_word].text;
+    struct definition *d = calloc(1, sizeof(struct definition));
+
+    if (d == NULL || copy_tree(&d->tree, &parser, node->body) != PARSE_OK) {
+        if (d != NULL)
+            free_parser(&d->tree);
+        free(d);
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    if (d->tree.heredoc_count > 0) {
+        fprintf(stderr, "%s: a function can't have a here-doc, use a here-string (<<<)\n", name);
+        free_definition(d);
+        last_status = 1;
+        return SUCCESS;
+    }
+    if (define(name, ENTRY_FUNCTION, "", d) != SUCCESS)
+        return SYSTEM_FAILURES;
+    last_status = 0;
+    return SUCCESS;
+}
+
+//sets the entry of the function/alias, and replaces its old definition
+int define(char *name, int kind, char *text, struct definition *d) {
+    int i = set_env_entry(name, kind, text);
+
+    if (i == -1) {
+        free_definition(d);
+        return SYSTEM_FAILURES;
+    }
+    if (env_vars[i].definition != NULL)
+        free_definition(env_vars[i].definition);
+    else if (kind == ENTRY_FUNCTION)
+        function_count++;
+    else
+        alias_count++;
+    env_vars[i].definition = d;
+    return SUCCESS;
+}
+
+struct definition *find_definition(char *name, int kind) {
+    if (env_var_count == 0)
+        return NULL;
+    int i = find_env_slot(name, hash_string(name), kind);
+    return env_vars[i].name != NULL ? env_vars[i].definition : NULL;
+}
+
+//a function that is still running is only marked, and is freed when it returns
+void free_definition(struct definition *d) {
+    if (d->running > 0) {
+        d->replaced = 1;
+        return;
+    }
+    free_parser(&d->tree);
+    free(d);
+}
+
+/*runs the function's body with args[1..] as $1...$n. its redirections are put in place of the shell's
+ stdin/stdout/stderr while it runs, like for a builtin. break/continue don't leave the caller's loops*/
+int run_function(struct definition *f, char **args, struct redirect *redirects) {
+    char *name = args[0];
+    struct parser outer = parser;
+    char **outer_positional = positional;
+    int outer_count = positional_count, outer_loop_depth = loop_depth;
+    int *outer_heredocs = heredoc_fds;
+    int saved[3], argc = 0, ret;
+
+    if (function_depth >= 1000) { //a function that calls itself for ever would overflow the stack
+        fprintf(stderr, "%s: too many nested function calls\n", args[0]);
+        last_status = 1;
+        return INVALID_INPUT;
+    }
+    if (redirect_shell(redirects, saved) != SUCCESS)
+        return INVALID_INPUT;
+    for (; args[argc] != NULL; argc++);
+    args[0] = positional[0]; //$0 stays the script's
+    positional = args;
+    positional_count = argc - 1;
+    parser = f->tree;
+    heredoc_fds = NULL;
+    loop_depth = 0;
+    function_depth++;
+    f->running++;
+
+    ret = run_list(parser.root);
+
+    f->running--;
+    function_depth--;
+    returning = break_count = continue_count = 0;
+    loop_depth = outer_loop_depth;
+    heredoc_fds = outer_heredocs;
+    parser = outer;
+    positional = outer_positional;
+    positional_count = outer_count;
+    restore_shell(saved);
+    count_command(name, last_status << 8);
+    if (f->replaced && f->running == 0)
+        free_definition(f);
+    return ret == SYSTEM_FAILURES || ret == EXIT ? ret : SUCCESS;
+}
+
+//runs the function as a pipeline stage: in a forked child, like a builtin. the child is a shell of its own,
+//so the commands of the function are its children
+int launch_function(struct definition *f, char **args, int in_fd, int out_fd, int err_fd, pid_t *p) {
+    fflush(stdout);
+    make_fork(p);
+    if ((*p) < 0) {//forking failed
+        perror("forking failed");
+        return SYSTEM_FAILURES;
+    }
+    if ((*p) == 0) {//child's process
+        if (in_fd != -1)
+            dup2(in_fd, STDIN_FILENO);
+        if (out_fd != -1)
+            dup2(out_fd, STDOUT_FILENO);
+        if (err_fd != -1)
+            dup2(err_fd, STDERR_FILENO);
+        if (launch_options != NULL)
+            apply_launch_options(launch_options);
+        reset_launch_options(); //its commands inherit them, they aren't applied again
+        stop_zygote(); //its commands would be children of the father, which this shell can't wait for
+        free_jobs();
+        init_jobs();
+        interactive = 0;
+        int ret = run_function(f, args, NULL);
+        fflush(stdout);
+        _exit(ret == SYSTEM_FAILURES ? 1 : last_status);
+    }
+    return SUCCESS;
+}
+
+//the alias the first word of a command names, NULL if it isn't one. a quoted word isn't replaced
+struct definition *find_alias(struct word *w) {
+    if (alias_count == 0 || w->quoted || w->var_count > 0)
+        return NULL;
+    return find_definition(w->text, ENTRY_ALIAS);
+}
+
+//adds the alias's words to the arguments. they are expanded now, like any word, with the alias's tree as the parser
+int expand_alias(struct definition *alias, struct arg_list *list) {
+    struct parser outer = parser;
+    struct command *c;
+    int ret = SUCCESS;
+
+    parser = alias->tree;
+    c = &parser.commands[0];
+    for (int i = 0; i < c->word_count && ret == SUCCESS; i++)
+        ret = expand_fields(&parser.words[c->first_word + i], list, 0);
+    parser = outer;
+    return ret;
+}
+
+//the value of $0-$9, $#, $*, $? & $! (in line_arena). $@ is "$*" here, expand_fields() splits it into the arguments.
+//$! of a job that is still queued by BG_LIMIT is its %n, as it has no pid yet
+char *special_parameter(char c) {
+    char number[16], *value, *end;
+    size_t len = 0;
+    int n;
+
+    if (c >= '0' && c <= '9') {
+        n = c - '0';
+        return positional != NULL && n <= positional_count ? positional[n] : "";
+    }
+    if (c == '?' || c == '#') {
+        snprintf(number, sizeof(number), "%d", c == '?' ? last_status : positional_count);
+        return arena_strdup(&line_arena, number);
+    }
+    if (c == '!') {
+        if (last_background_job == 0)
+            return "";
+        if (last_background_pid > 0)
+            snprintf(number, sizeof(number), "%d", (int) last_background_pid);
+        else
+            snprintf(number, sizeof(number), "%%%d", last_background_job);
+        return arena_strdup(&line_arena, number);
+    }
+    for (int i = 1; i <= positional_count; i++)
+        len += strlen(positional[i]) + 1;
+    if ((value = end = arena_alloc(&line_arena, len + 1)) == NULL)
+        return NULL;
+    (*end) = 0;
+    for (int i = 1; i <= positional_count; i++) {
+        if (i > 1)
+            *end++ = SPACE_CHAR;
+        end = stpcpy(end, positional[i]);
+    }
+    return value;
+}
+
+/********************************************* EXPANSION ****************************************************************/
+//the line is parsed by parse.c, which only records where the $NAME references & $(command)s of every word are.
+//they are replaced by the values here, when the command is about to run
+
+//the values of a word's references: a variable's value, or the output of a command (which runs now).
+//an unassigned variable is an error, unless allow_unassigned is set - then it's replaced by nothing
+int expand_values(struct word *w, char **values, int allow_unassigned) {
+    int ret;
+
+    for (int i = 0; i < w->var_count; i++) {
+        struct var_ref *ref = &parser.vars[w->first_var + i];
+        if (ref->type == VAR_COMMAND) {
+            //$(command) is 2 characters before the command, `command` is 1
+            int skip = w->text[ref->offset] == '$' ? 2 : 1;
+            if ((ret = run_substitution(w->text + ref->offset + skip, ref->len - skip, &values[i])) != SUCCESS)
+                return ret;
+            continue;
+        }
+        if (ref->len == 1 && is_special_parameter(w->text[ref->offset + 1])) {
+            if ((values[i] = special_parameter(w->text[ref->offset + 1])) == NULL) {
+                printf("malloc failed\n");
+                return SYSTEM_FAILURES;
+            }
+            continue;
+        }
+        char name[ref->len + 1];
+        memcpy(name, w->text + ref->offset + 1, ref->len);
+        name[ref->len] = 0;
+        values[i] = my_getenv(name);
+        if (values[i] == NULL) {
+            if (!allow_unassigned) {
+                printf("%s isn't assigned\n", name);
+                last_status = 1;
+                return INVALID_INPUT;
+            }
+            values[i] = "";
+        }
+    }
+    return SUCCESS;
+}
+
+//returns in word the word's text with every reference replaced by its value.
+//a word without references is its text itself, otherwise it's built in line_arena
+int expand_word(struct word *w, char **word, int allow_unassigned) {
+    if (w->var_count == 0) {
+        (*word) = w->text;
+        return SUCCESS;
+    }
+    char *values[w->var_count];
+    size_t len = strlen(w->text);
+    int ret = expand_values(w, values, allow_unassigned);
+    if (ret != SUCCESS)
+        return ret;
+    for (int i = 0; i < w->var_count; i++)
+        len += strlen(values[i]) - (parser.vars[w->first_var + i].len + 1);
+
+    char *expanded = arena_alloc(&line_arena, len + 1), *end;
+    if (expanded == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    end = expanded;
+    int copied = 0; //how much of the word's text was handled
+    for (int i = 0; i < w->var_count; i++) {
+        struct var_ref *ref = &parser.vars[w->first_var + i];
+        memcpy(end, w->text + copied, ref->offset - copied);
+        end += ref->offset - copied;
+        end = stpcpy(end, values[i]);
+        copied = ref->offset + ref->len + 1;
+    }
+    strcpy(end, w->text + copied);
+    (*word) = expanded;
+    return SUCCESS;
+}
+
+/*adds the word to the arguments of a command. the output of a $(command) outside quotes is split into words at
+ spaces, tabs & newlines, so the word may become several arguments - or none, if the output is blank
+ and nothing else is in the word ("" or other text keeps it). $@ (quoted or not) is an argument for every
+ positional parameter, and "$@" is none when there are no parameters*/
+int expand_fields(struct word *w, struct arg_list *list, int allow_unassigned) {
+    int split = 0, ret;
+    char *word;
+
+    for (int i = 0; i < w->var_count; i++) {
+        struct var_ref *ref = &parser.vars[w->first_var + i];
+        split |= (ref->type == VAR_COMMAND && !ref->quoted) || is_all_parameters(w, ref);
+    }
+    if (!split) {
+        if ((ret = expand_word(w, &word, allow_unassigned)) != SUCCESS)
+            return ret;
+        return add_field(w, list, word);
+    }
+
+    char *values[w->var_count];
+    if ((ret = expand_values(w, values, allow_unassigned)) != SUCCESS)
+        return ret;
+    //every field is at most the whole expanded word, so one buffer of that size holds them all one after the other
+    size_t len = strlen(w->text) + 1;
+    for (int i = 0; i < w->var_count; i++)
+        len += strlen(values[i]) + 1;
+    char *field = arena_alloc(&line_arena, len), *end, *value;
+    if (field == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    end = field;
+    //started - the current field exists even if it's still empty
+    int copied = 0, started = w->quoted && strcmp(w->text, "$@") != 0;
+    for (int i = 0; i <= w->var_count; i++) {
+        struct var_ref *ref = i < w->var_count ? &parser.vars[w->first_var + i] : NULL;
+        int text_end = ref != NULL ? ref->offset : (int) strlen(w->text);
+        memcpy(end, w->text + copied, text_end - copied);
+        end += text_end - copied;
+        started |= text_end > copied;
+        if (ref == NULL)
+            break;
+        copied = ref->offset + ref->len + 1;
+        if (is_all_parameters(w, ref)) {
+            for (int j = 1; j <= positional_count; j++) {
+                if (j > 1) { //the end of a field
+                    *end++ = 0;
+                    if ((ret = add_field(w, list, field)) != SUCCESS)
+                        return ret;
+                    field = end;
+                }
+                end = stpcpy(end, positional[j]);
+                started = 1;
+            }
+            continue;
+        }
+        if (ref->type != VAR_COMMAND || ref->quoted) {
+            end = stpcpy(end, values[i]);
+            started |= values[i][0] != 0;
+            continue;
+        }
+        for (value = values[i]; *value != 0; value++) {
+            if (*value != ' ' && *value != '\t' && *value != '\n') {
+                *end++ = *value;
+                started = 1;
+            } else if (started) { //the end of a field
+                *end++ = 0;
+                if ((ret = add_field(w, list, field)) != SUCCESS)
+                    return ret;
+                field = end;
+                started = 0;
+            }
+        }
+    }
+    *end = 0;
+    return started ? add_field(w, list, field) : SUCCESS;
+}
+
+int is_all_parameters(struct word *w, struct var_ref *ref) {
+    return ref->type == VAR_NAME && ref->len == 1 && w->text[ref->offset + 1] == '@';
+}
+
+//appends an argument to the list, and grows it (in line_arena) when it's full. the list is always null terminated
+int add_arg(struct arg_list *list, char *arg) {
+    if (list->count + 1 >= list->capacity) {
+        char **grown = arena_alloc(&line_arena, list->capacity * 2 * sizeof(char *));
+        if (grown == NULL) {
+            printf("malloc failed\n");
+            return SYSTEM_FAILURES;
+        }
+        memcpy(grown, list->args, list->count * sizeof(char *));
+        list->args = grown;
+        list->capacity *= 2;
+    }
+    list->args[list->count++] = arg;
+    list->args[list->count] = NULL;
+    return SUCCESS;
+}
+
+/*runs the command line of a $(...), and returns in output what it wrote to stdout, without the newlines at its end
+ (in line_arena). while the line runs, the shell's stdout is a memory file: a builtin writes into it without a fork,
+ and a command is launched as usual, with the memory file as its stdout.
+ (the shell waits for the line before it reads the output, so a pipe that filled up would never be emptied).
+ the line has a parse tree of its own, because the tree of the outer line is still in use.
+ a line that could change the shell (see changes_shell()) runs in a forked child shell, like in bash*/
+int run_substitution(char *text, int len, char **output) {
+    struct parser outer = parser;
+    struct time_report *outer_report = time_report;
+    int *outer_heredocs = heredoc_fds, outer_interactive = interactive;
+    int outer_loop_depth = loop_depth, outer_function_depth = function_depth; //break & return end only the $(...)
+    int fd, saved_stdout, ret;
+    off_t size;
+    char *line = arena_strndup(&line_arena, text, len); //the parser changes the line, and a word may be expanded again
+
+    if (line == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    fd = memfd_create("substitution", MFD_CLOEXEC);
+    if (fd == -1 || (saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10)) == -1) {
+        perror("substitution");
+        if (fd != -1)
+            close(fd);
+        last_status = 1;
+        return INVALID_INPUT;
+    }
+    fflush(stdout);
+    dup2(fd, STDOUT_FILENO);
+    memset(&parser, 0, sizeof(parser));
+    time_report = NULL;
+    interactive = 0; //job numbers & prompts of here-docs aren't part of the output
+    loop_depth = function_depth = 0;
+
+    ret = run_substitution_line(line);
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    free_parser(&parser);
+    parser = outer;
+    time_report = outer_report;
+    heredoc_fds = outer_heredocs;
+    interactive = outer_interactive;
+    loop_depth = outer_loop_depth;
+    function_depth = outer_function_depth;
+    break_count = continue_count = returning = 0;
+    if (ret == SYSTEM_FAILURES) {
+        close(fd);
+        return SYSTEM_FAILURES;
+    }
+
+    size = lseek(fd, 0, SEEK_END);
+    (*output) = arena_alloc(&line_arena, size > 0 ? size + 1 : 1);
+    if ((*output) == NULL) {
+        close(fd);
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    if (size > 0 && pread(fd, *output, size, 0) != size)
+        size = 0;
+    close(fd);
+    while (size > 0 && (*output)[size - 1] == '\n')
+        size--;
+    (*output)[size] = 0;
+    return SUCCESS; //exit inside $(...) only ends the substitution
+}
+
+//runs the line of a $(...), whose stdout is in place already: in the shell itself, or in a child shell if it
+//could change the shell. last_status is the line's
+int run_substitution_line(char *line) {
+    pid_t p;
+    int status, ret;
+
+    if (!changes_shell(line))
+        return split_multiple_commands(line, 0);
+    make_fork(&p);
+    if (p < 0) {
+        perror("forking failed");
+        return SYSTEM_FAILURES;
+    }
+    if (p == 0) { //a shell of its own, like the child of a function in a pipeline
+        reset_launch_options();
+        stop_zygote();
+        free_jobs();
+        init_jobs();
+        ret = split_multiple_commands(line, 0);
+        fflush(stdout);
+        _exit(ret == SYSTEM_FAILURES ? 1 : last_status);
+    }
+    while (waitpid(p, &status, 0) == -1 && errno == EINTR);
+    last_status = exit_code(status);
+    return SUCCESS;
+}
+
+/*if running the line could change the shell: it has an assignment, a compound command, a function, an alias,
+ '&', a command named by a $NAME, or a builtin other than echo, printf, pwd, test, true & false (cd, unset, exit...).
+ a line of only those builtins & external commands, which is what most $(...)s are, runs without a fork.
+ a line that can't be parsed runs in the shell too, and only reports its error*/
+int changes_shell(char *line) {
+    const char *harmless[] = {"echo", "printf", "pwd", "test", "[", "true", "false", NULL};
+    char *copy = arena_strdup(&line_arena, line); //the parser changes the line in place
+    struct command *c;
+    struct builtin *b;
+    char *name;
+    int i, j;
+
+    if (copy == NULL || parse_line(&substitution_check, copy) != PARSE_OK)
+        return 0;
+    for (i = 0; i < substitution_check.node_count; i++) {
+        if (substitution_check.nodes[i].type != NODE_PIPELINE)
+            return 1;
+    }
+    for (i = 0; i < substitution_check.pipeline_count; i++) {
+        if (substitution_check.pipelines[i].background)
+            return 1;
+    }
+    for (i = 0; i < substitution_check.command_count; i++) {
+        c = &substitution_check.commands[i];
+        if (c->word_count == 0)
+            continue;
+        if (c->is_assignment || substitution_check.words[c->first_word].var_count > 0)
+            return 1;
+        name = substitution_check.words[c->first_word].text;
+        if ((function_count > 0 && find_definition(name, ENTRY_FUNCTION) != NULL) ||
+            (alias_count > 0 && find_definition(name, ENTRY_ALIAS) != NULL))
+            return 1;
+        if ((b = find_builtin(name)) == NULL)
+            continue;
+        for (j = 0; harmless[j] != NULL && strcmp(harmless[j], b->name) != 0; j++);
+        if (harmless[j] == NULL)
+            return 1;
+    }
+    return 0;
+}
+
+//the shell itself isn't stopped by ^Z. the stopped foreground job is found by waitpid() in wait_for_job().
+//(SIG_IGN would be inherited by the commands, a handler is reset by exec)
+void catch_stop(int sig) {
+    (void) sig;
+    signal(SIGTSTP, catch_stop);
+    //kill(run_now, SIGTSTP);  // don't need to send signal - they are all from the same group
+}
+
+/********************************************* PATHNAME EXPANSION ****************************************************************/
+//an unquoted word with *, ? or [...] is replaced by the paths it matches, sorted - or stays as it is if nothing
+//matches. the components of the pattern are compiled once, and a directory is read by big getdents64() calls,
+//which give the type of every entry with its name, so no entry is stat()ed. a directory that was read is kept until
+//the line ends, so the patterns of a line read it once
+
+//a field of a word: globbed if the word had no quotes ("*.c" stays as it is)
+int add_field(struct word *w, struct arg_list *list, char *field) {
+    if (w->quoted || strpbrk(field, "*?[") == NULL)
+        return add_arg(list, field);
+    return expand_glob(field, list);
+}
+
+//adds the paths the pattern matches to the arguments, or the pattern itself if there are none
+int expand_glob(char *pattern, struct arg_list *list) {
+    struct glob_pattern *components;
+    char path[PATH_MAX];
+    int count = 1, first = list->count, i = 0, ret, magic = 0;
+    char *text = pattern, *slash;
+
+    for (char *c = pattern; *c != 0; c++)
+        count += *c == '/';
+    components = arena_alloc(&line_arena, count * sizeof(struct glob_pattern));
+    if (components == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    for (; i < count; i++, text = slash + 1) {
+        slash = strchr(text, '/');
+        if (compile_glob(&components[i], text, slash != NULL ? (int) (slash - text) : (int) strlen(text)) != SUCCESS)
+            return SYSTEM_FAILURES;
+        magic |= !components[i].literal;
+    }
+    if (!magic) //a '[' without a ']'
+        return add_arg(list, pattern);
+    if ((ret = glob_path(path, 0, components, count, list)) != SUCCESS)
+        return ret;
+    if (list->count == first)
+        return add_arg(list, pattern);
+    qsort(list->args + first, list->count - first, sizeof(char *), compare_strings);
+    return SUCCESS;
+}
+
+/*compiles a component of a pattern (text[0..len), without '/') into tokens: runs of plain characters, '?', '*'
+ (several in a row are one) & [...] classes, which are bitmaps of the 256 bytes. [!...] & [^...] negate a class,
+ a ']' right after the '[' is in it, and a '[' without a ']' is a plain character*/
+int compile_glob(struct glob_pattern *p, char *text, int len) {
+    struct glob_token *t;
+    int i = 0, end;
+
+    p->tokens = arena_alloc(&line_arena, (len + 1) * sizeof(struct glob_token));
+    if (p->tokens == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    p->text = text;
+    p->len = len;
+    p->count = p->min_len = 0;
+    p->literal = 1;
+    p->dot = len > 0 && text[0] == '.';
+    while (i < len) {
+        end = text[i] == '[' ? class_end(text, i, len) : -1;
+        if (text[i] == '*' || text[i] == '?' || end != -1) {
+            p->literal = 0;
+            if (text[i] == '*' && p->count > 0 && p->tokens[p->count - 1].type == GLOB_STAR) {
+                i++;
+                continue;
+            }
+            t = &p->tokens[p->count++];
+            t->type = text[i] == '*' ? GLOB_STAR : text[i] == '?' ? GLOB_ANY : GLOB_CLASS;
+            p->min_len += t->type != GLOB_STAR;
+            if (t->type == GLOB_CLASS) {
+                compile_class(t, text + i + 1, end - i - 1);
+                i = end;
+            }
+            i++;
+            continue;
+        }
+        if (p->count == 0 || p->tokens[p->count - 1].type != GLOB_TEXT) { //a new run of plain characters
+            t = &p->tokens[p->count++];
+            t->type = GLOB_TEXT;
+            t->text = text + i;
+            t->len = 0;
+        }
+        p->tokens[p->count - 1].len++;
+        p->min_len++;
+        i++;
+    }
+    return SUCCESS;
+}
+
+//the index of the ']' that closes the class at text[start], -1 if it isn't closed
+int class_end(char *text, int start, int len) {
+    int i = start + 1;
+    if (i < len && (text[i] == '!' || text[i] == '^'))
+        i++;
+    if (i < len && text[i] == ']')
+        i++;
+    while (i < len && text[i] != ']')
+        i++;
+    return i < len ? i : -1;
+}
+
+//the characters between the brackets: single characters & ranges (a-z)
+void compile_class(struct glob_token *t, char *text, int len) {
+    int negate = len > 0 && (text[0] == '!' || text[0] == '^'), i = negate;
+    unsigned char from, to;
+
+    memset(t->set, 0, sizeof(t->set));
+    for (; i < len; i++) {
+        from = to = text[i];
+        if (i + 2 < len && text[i + 1] == '-') {
+            to = text[i + 2];
+            i += 2;
+        }
+        for (int c = from; c <= to; c++)
+            t->set[c >> 3] |= 1 << (c & 7);
+    }
+    for (int j = 0; negate && j < (int) sizeof(t->set); j++)
+        t->set[j] = ~t->set[j];
+}
+
+/*matches a name against a compiled component. a '*' takes as little as it can, and takes one more character only
+ when the rest doesn't match - only the last '*' is ever retried, so a name is matched in one pass (almost).
+ a name that is too short, or doesn't end with the component's last plain characters, is rejected first*/
+int glob_match(struct glob_pattern *p, const char *name, int len) {
+    struct glob_token *t, *last = &p->tokens[p->count - 1];
+    int i = 0, k = 0, star = -1, star_at = 0, c;
+
+    if (len < p->min_len || (last->type == GLOB_TEXT && memcmp(name + len - last->len, last->text, last->len) != 0))
+        return 0;
+    while (1) {
+        if (k < p->count) {
+            t = &p->tokens[k];
+            if (t->type == GLOB_STAR) {
+                star = k++;
+                star_at = i;
+                continue;
+            }
+            c = (unsigned char) name[i];
+            if (t->type == GLOB_TEXT ? i + t->len <= len && memcmp(name + i, t->text, t->len) == 0 :
+                i < len && (t->type == GLOB_ANY || (t->set[c >> 3] & (1 << (c & 7))))) {
+                i += t->type == GLOB_TEXT ? t->len : 1;
+                k++;
+                continue;
+            }
+        } else if (i == len)
+            return 1;
+        if (star == -1 || star_at >= len)
+            return 0;
+        i = ++star_at;
+        k = star + 1;
+    }
+}
+
+/*adds the paths that match components[0..count) under path[0..len) (the directory that was matched so far, with
+ a '/' at its end, or "" for the current directory). a component without wildcards is only appended*/
+int glob_path(char *path, int len, struct glob_pattern *components, int count, struct arg_list *list) {
+    struct glob_pattern *p = components;
+    struct listing *l;
+    struct stat st;
+    char *entry, *name;
+    int name_len, ret;
+
+    if (p->literal) {
+        if (len + p->len + 1 >= PATH_MAX)
+            return SUCCESS;
+        memcpy(path + len, p->text, p->len);
+        len += p->len;
+        path[len] = 0;
+        if (count == 1) //the last component is a file that must exist
+            return lstat(path, &st) == 0 ? add_path(list, path, len) : SUCCESS;
+        path[len++] = '/';
+        return glob_path(path, len, components + 1, count - 1, list);
+    }
+    path[len] = 0;
+    if ((ret = read_listing(len > 0 ? path : ".", &l)) != SUCCESS || l == NULL) //not a directory: no matches
+        return ret;
+    for (entry = l->entries; entry < l->entries + l->size; entry += name_len + 2) {
+        name = entry + 1;
+        name_len = strlen(name);
+        if ((name[0] == '.' && !p->dot) || !glob_match(p, name, name_len) || len + name_len + 1 >= PATH_MAX)
+            continue;
+        memcpy(path + len, name, name_len + 1);
+        if (count == 1)
+            ret = add_path(list, path, len + name_len);
+        else if (entry[0] == DT_DIR || ((entry[0] == DT_LNK || entry[0] == DT_UNKNOWN) &&
+                                         stat(path, &st) == 0 && S_ISDIR(st.st_mode))) {
+            path[len + name_len] = '/';
+            ret = glob_path(path, len + name_len + 1, components + 1, count - 1, list);
+        }
+        if (ret != SUCCESS)
+            return ret;
+    }
+    return SUCCESS;
+}
+
+int add_path(struct arg_list *list, char *path, int len) {
+    char *copy = arena_strndup(&line_arena, path, len);
+    if (copy == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    return add_arg(list, copy);
+}
+
+/*the entries of a directory, from the listings of the line or read now. a listing is used again only while the
+ directory's mtime & ctime didn't change, so a command of the line that created a file is seen by the next pattern.
+ a listing that changed stays in the list (a pattern may still walk it), the new one goes before it.
+ l is NULL if dir isn't a directory that can be read*/
+int read_listing(char *dir, struct listing **l) {
+    struct stat st;
+    struct dirent64_record *d;
+    long long traced;
+    size_t name_len;
+    long n;
+    int fd;
+
+    (*l) = NULL;
+    if (stat(dir, &st) == -1 || !S_ISDIR(st.st_mode))
+        return SUCCESS;
+    for (struct listing *old = listings; old != NULL; old = old->next) {
+        if (old->dev == st.st_dev && old->ino == st.st_ino) { //the newest listing of the directory
+            if (old->mtime.tv_sec == st.st_mtim.tv_sec && old->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+                old->ctime.tv_sec == st.st_ctim.tv_sec && old->ctime.tv_nsec == st.st_ctim.tv_nsec)
+                (*l) = old;
+            break;
+        }
+    }
+    if ((*l) != NULL)
+        return SUCCESS;
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        return SUCCESS;
+    traced = tracing ? trace_clock() : 0;
+    if ((glob_buffer == NULL && (glob_buffer = malloc(GLOB_BUFFER_SIZE)) == NULL) ||
+        ((*l) = calloc(1, sizeof(struct listing))) == NULL) {
+        close(fd);
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    (*l)->dev = st.st_dev;
+    (*l)->ino = st.st_ino;
+    (*l)->mtime = st.st_mtim;
+    (*l)->ctime = st.st_ctim;
+    (*l)->next = listings;
+    listings = (*l);
+    while ((n = syscall(SYS_getdents64, fd, glob_buffer, GLOB_BUFFER_SIZE)) > 0) {
+        for (long offset = 0; offset < n; offset += d->d_reclen) {
+            d = (struct dirent64_record *) (glob_buffer + offset);
+            if (d->d_name[0] == '.' && (d->d_name[1] == 0 || (d->d_name[1] == '.' && d->d_name[2] == 0)))
+                continue; //. & .. are never matched
+            name_len = strlen(d->d_name);
+            if ((*l)->size + name_len + 2 > (*l)->capacity) {
+                size_t capacity = (*l)->capacity == 0 ? GLOB_BUFFER_SIZE : (*l)->capacity * 2;
+                char *grown = realloc((*l)->entries, capacity);
+                if (grown == NULL) {
+                    close(fd);
+                    printf("malloc failed\n");
+                    return SYSTEM_FAILURES;
+                }
+                (*l)->entries = grown;
+                (*l)->capacity = capacity;
+            }
+            (*l)->entries[(*l)->size] = d->d_type;
+            memcpy((*l)->entries + (*l)->size + 1, d->d_name, name_len + 1);
+            (*l)->size += name_len + 2;
+        }
+    }
+    close(fd);
+    if (traced)
+        trace_add("scan", traced, dir);
+    return SUCCESS;
+}
+
+//the line ended: the directories may change before the next one
+void forget_listings() {
+    struct listing *next;
+    for (; listings != NULL; listings = next) {
+        next = listings->next;
+        free(listings->entries);
+        free(listings);
+    }
+}
+
+int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/********************************************* BUILTINS ****************************************************************/
+//commands that run inside the shell, without a new process (in a pipeline they run in a forked child, without exec).
+//every builtin gets argv[] & its length, sets last_status & returns SUCCESS, or EXIT/SYSTEM_FAILURES like the parser.
+//their output is collected as pieces of memory (mostly the arguments themselves) and written by one writev()
+
+struct builtin builtins[] = {
+        {"[",      test_builtin},
+        {"alias",  alias_builtin},
+        {"bg",     bg_builtin},
+        {"break",  break_builtin},
+        {"cd",     cd_builtin},
+        {"continue", continue_builtin},
+        {"echo",   echo_builtin},
+        {"exit",   exit_builtin},
+        {"false",  false_builtin},
+        {"fg",     fg_builtin},
+        {"hash",   hash_builtin},
+        {"history", history_builtin},
+        {"jobs",   jobs_builtin},
+        {"parallel", parallel_builtin},
+        {"printf", printf_builtin},
+        {"pwd",    pwd_builtin},
+        {"return", return_builtin},
+        {"shift",  shift_builtin},
+        {"stats",  stats_builtin},
+        {"test",   test_builtin},
+        {"trace",  trace_builtin},
+        {"true",   true_builtin},
+        {"ulimit", ulimit_builtin},
+        {"unalias", unalias_builtin},
+        {"unset",  unset_builtin},
+        {"wait",   wait_builtin},
+        {NULL, NULL}
+};
+
+//the index in builtins[] of the first builtin that starts with each character, -1 if there is none.
+//the table is sorted, so a lookup compares only the builtins with the same first character
+int first_builtin[256];
+
+void init_builtins() {
+    for (int c = 0; c < 256; c++)
+        first_builtin[c] = -1;
+    int i = 0;
+    for (; builtins[i].name != NULL; i++);
+    for (i--; i >= 0; i--) //from the end, so the first one of each character is kept
+        first_builtin[(unsigned char) builtins[i].name[0]] = i;
+}
+
+struct builtin *find_builtin(char *name) {
+    int i = first_builtin[(unsigned char) name[0]];
+    if (i == -1)
+        return NULL;
+    for (; builtins[i].name != NULL && builtins[i].name[0] == name[0]; i++) {
+        if (strcmp(builtins[i].name, name) == 0)
+            return &builtins[i];
+    }
+    return NULL;
+}
+
+//runs the builtin in the shell. its redirections are honoured by swapping the shell's own stdin/stdout/stderr
+//for them until the builtin is done
+int run_builtin(struct builtin *b, char **args, struct redirect *redirects) {
+    int argc = 0, saved[3], ret;
+    for (; args[argc] != NULL; argc++);
+
+    if (redirect_shell(redirects, saved) != SUCCESS)
+        return INVALID_INPUT;
+    long long traced = tracing ? trace_clock() : 0;
+    if (b->run != alias_builtin && b->run != unalias_builtin && b->run != unset_builtin)
+        effect_count++;
+    ret = b->run(args, argc);
+    if (out_flush() != SUCCESS)
+        last_status = 1;
+    restore_shell(saved);
+    count_command(args[0], last_status << 8);
+    if (traced)
+        trace_add("builtin", traced, args[0]);
+    return ret;
+}
+
+//puts the redirections in place of the shell's stdin/stdout/stderr. saved gets the originals (-1 - not redirected)
+int redirect_shell(struct redirect *redirects, int saved[3]) {
+    int fds[3];
+
+    saved[0] = saved[1] = saved[2] = -1;
+    if (open_redirections(redirects, -1, fds) != SUCCESS)
+        return INVALID_INPUT;
+    fflush(stdout);
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] == -1)
+            continue;
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    return SUCCESS;
+}
+
+void restore_shell(int saved[3]) {
+    fflush(stdout); //some builtins print with stdio
+    for (int i = 0; i < 3; i++) {
+        if (saved[i] == -1)
+            continue;
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+    if (saved[0] != -1) //a builtin that read its stdin to the end (parallel) mustn't leave the shell's stdin at EOF
+        clearerr(stdin);
+}
+
+//runs the builtin as a pipeline stage: in a forked child, so it runs alongside the other stages
+int launch_builtin(struct builtin *b, char **args, int in_fd, int out_fd, int err_fd, pid_t *p) {
+    int argc = 0;
+    for (; args[argc] != NULL; argc++);
+
+    fflush(stdout);
+    make_fork(p);
+    if ((*p) < 0) {//forking failed
+        perror("forking failed");
+        return SYSTEM_FAILURES;
+    }
+    if ((*p) == 0) {//child's process
+        signal(SIGCHLD, SIG_DFL);//return deal with signals to default
+        signal(SIGTSTP, SIG_DFL);
+        set_sigchld_blocked(0);
+        if (in_fd != -1)
+            dup2(in_fd, STDIN_FILENO);
+        if (out_fd != -1)
+            dup2(out_fd, STDOUT_FILENO);
+        if (err_fd != -1)
+            dup2(err_fd, STDERR_FILENO);
+        if (launch_options != NULL)
+            apply_launch_options(launch_options);
+        b->run(args, argc);
+        if (out_flush() != SUCCESS)
+            last_status = 1;
+        fflush(stdout);
+        _exit(last_status);
+    }
+    return SUCCESS;
+}
+
+void out_add(const char *str, size_t len) {
+    if (len == 0)
+        return;
+    if (out_count == OUT_PIECES)
+        out_flush();
+    out_pieces[out_count].iov_base = (void *) str;
+    out_pieces[out_count].iov_len = len;
+    out_count++;
+}
+
+//writes the collected pieces to stdout. the pieces must stay valid until then
+int out_flush() {
+    struct iovec *iov = out_pieces;
+    int count = out_count;
+    ssize_t n;
+
+    out_count = 0;
+    while (count > 0) {
+        n = writev(STDOUT_FILENO, iov, count);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return INVALID_INPUT;
+        while (count > 0 && (size_t) n >= iov->iov_len) { //skip what was written
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return SUCCESS;
+}
+
+//returns a copy of str (in line_arena) with its backslash escapes replaced, and its length in len.
+//stop is set if the string has \c - nothing should be printed after it.
+//echo writes octal numbers as \0nnn, printf as \nnn
+char *unescape(char *str, size_t *len, int *stop, int is_echo) {
+    char *copy = arena_alloc(&line_arena, strlen(str) + 1), *end = copy;
+    (*stop) = 0;
+    if (copy == NULL)
+        return NULL;
+    for (; *str != 0; str++) {
+        if (*str != '\\' || str[1] == 0) {
+            *end++ = *str;
+            continue;
+        }
+        str++;
+        switch (*str) {
+            case 'a':
+                *end++ = '\a';
+                break;
+            case 'b':
+                *end++ = '\b';
+                break;
+            case 'f':
+                *end++ = '\f';
+                break;
+            case 'n':
+                *end++ = '\n';
+                break;
+            case 'r':
+                *end++ = '\r';
+                break;
+            case 't':
+                *end++ = '\t';
+                break;
+            case 'v':
+                *end++ = '\v';
+                break;
+            case '\\':
+                *end++ = '\\';
+                break;
+            case 'c':
+                (*stop) = 1;
+                (*len) = end - copy;
+                *end = 0;
+                return copy;
+            default:
+                if (*str >= '0' && *str <= '7') {
+                    int value = 0, digits = 0;
+                    if (is_echo && *str == '0')
+                        str++;
+                    for (; digits < 3 && *str >= '0' && *str <= '7'; digits++, str++)
+                        value = value * 8 + (*str - '0');
+                    str--;
+                    *end++ = (char) value;
+                } else { //not an escape - keep it
+                    *end++ = '\\';
+                    *end++ = *str;
+                }
+        }
+    }
+    (*len) = end - copy;
+    *end = 0; //printf looks for the next % with strcspn()
+    return copy;
+}
+
+//echo [-neE] [arguments]: prints the arguments separated by spaces.
+//-n - without the newline, -e - replaces backslash escapes, -E - doesn't (the default)
+int echo_builtin(char **args, int argc) {
+    int newline = 1, escapes = 0, stop = 0, i = 1;
+    size_t len;
+    char *str;
+
+    for (; i < argc && args[i][0] == '-' && args[i][1] != 0 && strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++) {
+        for (char *flag = args[i] + 1; *flag != 0; flag++) {
+            if (*flag == 'n')
+                newline = 0;
+            else
+                escapes = *flag == 'e';
+        }
+    }
+    for (; i < argc && !stop; i++) {
+        if (escapes) {
+            str = unescape(args[i], &len, &stop, 1);
+            if (str == NULL)
+                return SYSTEM_FAILURES;
+            out_add(str, len);
+        } else
+            out_add(args[i], strlen(args[i]));
+        if (i < argc - 1 && !stop)
+            out_add(SPACE, 1);
+    }
+    if (newline && !stop)
+        out_add("\n", 1);
+    last_status = 0;
+    return SUCCESS;
+}
+
+//printf <format> [arguments]: like printf(3), with %s %b %c %d %i %u %o %x %X %e %f %g & %%.
+//the format is used again while there are arguments left
+int printf_builtin(char **args, int argc) {
+    char spec[32], *format, *piece, *arg, *end;
+    int next = 2, stop = 0, used, n;
+    size_t len, arg_len, spec_len; //len - of the format
+
+    if (argc < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        last_status = 2;
+        return SUCCESS;
+    }
+    if ((format = unescape(args[1], &len, &stop, 0)) == NULL)
+        return SYSTEM_FAILURES;
+    last_status = 0;
+    do {
+        used = next;
+        for (char *f = format; *f != 0 && f < format + len;) {
+            if (*f != '%') { //a run of plain text is written from the format itself
+                size_t run = strcspn(f, "%");
+                out_add(f, run);
+                f += run;
+                continue;
+            }
+            if (f[1] == '%') {
+                out_add("%", 1);
+                f += 2;
+                continue;
+            }
+            spec_len = 1 + strspn(f + 1, "-+ #0123456789.");
+            if (spec_len > sizeof(spec) - 4 || f[spec_len] == 0) {
+                fprintf(stderr, "printf: %s: invalid format\n", f);
+                last_status = 1;
+                return SUCCESS;
+            }
+            memcpy(spec, f, spec_len);
+            char conversion = f[spec_len];
+            f += spec_len + 1;
+            arg = next < argc ? args[next++] : NULL;
+
+            switch (conversion) {
+                case 'b':
+                    if (arg != NULL && (arg = unescape(arg, &arg_len, &stop, 1)) == NULL)
+                        return SYSTEM_FAILURES;
+                    //fall through
+                case 's':
+                    strcpy(spec + spec_len, "s");
+                    n = snprintf(NULL, 0, spec, arg == NULL ? "" : arg);
+                    piece = arena_alloc(&line_arena, n + 1);
+                    if (piece == NULL)
+                        return SYSTEM_FAILURES;
+                    snprintf(piece, n + 1, spec, arg == NULL ? "" : arg);
+                    break;
+                case 'c':
+                    strcpy(spec + spec_len, "c");
+                    n = snprintf(NULL, 0, spec, arg == NULL ? 0 : arg[0]);
+                    piece = arena_alloc(&line_arena, n + 1);
+                    if (piece == NULL)
+                        return SYSTEM_FAILURES;
+                    snprintf(piece, n + 1, spec, arg == NULL ? 0 : arg[0]);
+                    break;
+                case 'd':
+                case 'i':
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X': {
+                    long long value = arg == NULL ? 0 : strtoll(arg, &end, 0);
+                    if (arg != NULL && (*end != 0 || end == arg)) {
+                        fprintf(stderr, "printf: %s: invalid number\n", arg);
+                        last_status = 1;
+                    }
+                    spec[spec_len] = 'l';
+                    spec[spec_len + 1] = 'l';
+                    spec[spec_len + 2] = conversion;
+                    spec[spec_len + 3] = 0;
+                    n = snprintf(NULL, 0, spec, value);
+                    piece = arena_alloc(&line_arena, n + 1);
+                    if (piece == NULL)
+                        return SYSTEM_FAILURES;
+                    snprintf(piece, n + 1, spec, value);
+                    break;
+                }
+                case 'e':
+                case 'f':
+                case 'g': {
+                    double value = arg == NULL ? 0 : strtod(arg, &end);
+                    if (arg != NULL && (*end != 0 || end == arg)) {
+                        fprintf(stderr, "printf: %s: invalid number\n", arg);
+                        last_status = 1;
+                    }
+                    spec[spec_len] = conversion;
+                    spec[spec_len + 1] = 0;
+                    n = snprintf(NULL, 0, spec, value);
+                    piece = arena_alloc(&line_arena, n + 1);
+                    if (piece == NULL)
+                        return SYSTEM_FAILURES;
+                    snprintf(piece, n + 1, spec, value);
+                    break;
+                }
+                default:
+                    fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+                    last_status = 1;
+                    return SUCCESS;
+            }
+            out_add(piece, n);
+            if (stop) //\c in a %b argument
+                return SUCCESS;
+        }
+    } while (next < argc && next > used && !stop);
+    return SUCCESS;
+}
+
+//test <expression> or [ <expression> ]: last_status is 0 if the expression is true, 1 if it's false, 2 on error
+int test_builtin(char **args, int argc) {
+    if (strcmp(args[0], "[") == 0) {
+        if (strcmp(args[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ]\n");
+            last_status = 2;
+            return SUCCESS;
+        }
+        argc--;
+    }
+    last_status = evaluate_test(args + 1, argc - 1);
+    return SUCCESS;
+}
+
+//evaluates: [!] <string> | [!] <unary operator> <operand> | [!] <operand> <binary operator> <operand>
+int evaluate_test(char **args, int n) {
+    struct stat st;
+    long long left, right;
+    char *end_left, *end_right;
+
+    if (n == 0)
+        return 1;
+    if (strcmp(args[0], "!") == 0 && n > 1) {
+        int result = evaluate_test(args + 1, n - 1);
+        return result == 2 ? 2 : !result;
+    }
+    if (n == 1)
+        return args[0][0] == 0;
+    if (n == 2) {
+        char *op = args[0], *operand = args[1];
+        if (strcmp(op, "-n") == 0)
+            return operand[0] == 0;
+        if (strcmp(op, "-z") == 0)
+            return operand[0] != 0;
+        if (strcmp(op, "-e") == 0)
+            return stat(operand, &st) != 0;
+        if (strcmp(op, "-f") == 0)
+            return stat(operand, &st) != 0 || !S_ISREG(st.st_mode);
+        if (strcmp(op, "-d") == 0)
+            return stat(operand, &st) != 0 || !S_ISDIR(st.st_mode);
+        if (strcmp(op, "-s") == 0)
+            return stat(operand, &st) != 0 || st.st_size == 0;
+        if (strcmp(op, "-L") == 0 || strcmp(op, "-h") == 0)
+            return lstat(operand, &st) != 0 || !S_ISLNK(st.st_mode);
+        if (strcmp(op, "-r") == 0)
+            return access(operand, R_OK) != 0;
+        if (strcmp(op, "-w") == 0)
+            return access(operand, W_OK) != 0;
+        if (strcmp(op, "-x") == 0)
+            return access(operand, X_OK) != 0;
+        fprintf(stderr, "test: %s: unary operator expected\n", op);
+        return 2;
+    }
+    if (n == 3) {
+        char *op = args[1];
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+            return strcmp(args[0], args[2]) != 0;
+        if (strcmp(op, "!=") == 0)
+            return strcmp(args[0], args[2]) == 0;
+        left = strtoll(args[0], &end_left, 10);
+        right = strtoll(args[2], &end_right, 10);
+        if (op[0] == '-' && (*end_left != 0 || end_left == args[0] || *end_right != 0 || end_right == args[2])) {
+            fprintf(stderr, "test: integer expression expected\n");
+            return 2;
+        }
+        if (strcmp(op, "-eq") == 0)
+            return !(left == right);
+        if (strcmp(op, "-ne") == 0)
+            return !(left != right);
+        if (strcmp(op, "-lt") == 0)
+            return !(left < right);
+        if (strcmp(op, "-le") == 0)
+            return !(left <= right);
+        if (strcmp(op, "-gt") == 0)
+            return !(left > right);
+        if (strcmp(op, "-ge") == 0)
+            return !(left >= right);
+        fprintf(stderr, "test: %s: binary operator expected\n", op);
+        return 2;
+    }
+    fprintf(stderr, "test: too many arguments\n");
+    return 2;
+}
+
+int pwd_builtin(char **args, int argc) {
+    (void) args;
+    (void) argc;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("pwd");
+        last_status = 1;
+        return SUCCESS;
+    }
+    char *copy = arena_strdup(&line_arena, cwd); //it must live until the output is flushed
+    if (copy == NULL)
+        return SYSTEM_FAILURES;
+    out_add(copy, strlen(copy));
+    out_add("\n", 1);
+    last_status = 0;
+    return SUCCESS;
+}
+
+int true_builtin(char **args, int argc) {
+    (void) args;
+    (void) argc;
+    last_status = 0;
+    return SUCCESS;
+}
+
+int false_builtin(char **args, int argc) {
+    (void) args;
+    (void) argc;
+    last_status = 1;
+    return SUCCESS;
+}
+
+//exit [status]
+int exit_builtin(char **args, int argc) {
+    if (argc > 1)
+        last_status = atoi(args[1]) & 0xff;
+    return EXIT;
+}
+
+int cd_builtin(char **args, int argc) {
+    (void) args;
+    (void) argc;
+    fprintf(stderr, "cd not supported\n");
+    last_status = 1;
+    return SUCCESS;
+}
+
+/*break [n] leaves the n innermost loops (1 by default), continue [n] goes on with the next iteration of the n-th.
+ they only mark it, and the loops stop after the command. in a pipeline stage they don't leave the shell's loops*/
+int break_builtin(char **args, int argc) {
+    int n = argc > 1 ? atoi(args[1]) : 1;
+
+    if (loop_depth == 0 || n < 1) {
+        fprintf(stderr, "%s: only meaningful in a loop, with a positive count\n", args[0]);
+        last_status = 1;
+        return SUCCESS;
+    }
+    if (n > loop_depth)
+        n = loop_depth;
+    if (strcmp(args[0], "break") == 0)
+        break_count = n;
+    else
+        continue_count = n;
+    last_status = 0;
+    return SUCCESS;
+}
+
+int continue_builtin(char **args, int argc) {
+    return break_builtin(args, argc);
+}
+
+//unset <name>...: removes the shell variables, unset -f <name>... removes functions
+int unset_builtin(char **args, int argc) {
+    int functions = argc > 1 && strcmp(args[1], "-f") == 0;
+
+    for (int i = 1 + functions; i < argc; i++) {
+        if (functions)
+            unset_env_entry(args[i], ENTRY_FUNCTION);
+        else
+            my_unsetenv(args[i]);
+    }
+    last_status = 0;
+    return SUCCESS;
+}
+
+//return [n]: leaves the function with status n (the last command's by default)
+int return_builtin(char **args, int argc) {
+    if (function_depth == 0) {
+        fprintf(stderr, "return: can only be used in a function\n");
+        last_status = 1;
+        return SUCCESS;
+    }
+    if (argc > 1)
+        last_status = atoi(args[1]) & 0xff;
+    returning = 1;
+    return SUCCESS;
+}
+
+//shift [n]: $n+1 becomes $1, and so on
+int shift_builtin(char **args, int argc) {
+    int n = argc > 1 ? atoi(args[1]) : 1;
+
+    if (n < 0 || n > positional_count) {
+        fprintf(stderr, "shift: %d: shift count out of range\n", n);
+        last_status = 1;
+        return SUCCESS;
+    }
+    positional[n] = positional[0];
+    positional += n;
+    positional_count -= n;
+    last_status = 0;
+    return SUCCESS;
+}
+
+/*the alias builtin:
+ alias              - lists the aliases
+ alias name         - prints the alias
+ alias name=value   - defines it. the value is parsed now, and must be a simple command
+ last_status is 1 if an alias wasn't found or its value isn't a simple command*/
+int alias_builtin(char **args, int argc) {
+    char *equal;
+    int ret;
+
+    last_status = 0;
+    for (int i = 0; argc == 1 && i < env_var_capacity; i++) {
+        if (env_vars[i].name != NULL && env_vars[i].kind == ENTRY_ALIAS)
+            printf("alias %s='%s'\n", env_vars[i].name, env_vars[i].value);
+    }
+    for (int i = 1; i < argc; i++) {
+        if ((equal = strchr(args[i], '=')) == NULL) {
+            int slot = env_var_count > 0 ? find_env_slot(args[i], hash_string(args[i]), ENTRY_ALIAS) : -1;
+            if (slot != -1 && env_vars[slot].name != NULL)
+                printf("alias %s='%s'\n", args[i], env_vars[slot].value);
+            else {
+                fprintf(stderr, "alias: %s: not found\n", args[i]);
+                last_status = 1;
+            }
+            continue;
+        }
+        (*equal) = 0;
+        ret = define_alias(args[i], equal + 1);
+        (*equal) = '=';
+        if (ret != SUCCESS)
+            return ret;
+    }
+    return SUCCESS;
+}
+
+//parses the value of an alias & keeps its tree
+int define_alias(char *name, char *value) {
+    struct parser p;
+    struct definition *d;
+    char *line = strdup(value);
+    int ret;
+
+    memset(&p, 0, sizeof(p));
+    if (line == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    ret = parse_line(&p, line);
+    if (ret == PARSE_NO_MEMORY) {
+        free(line);
+        free_parser(&p);
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    if (ret != PARSE_OK || p.root == -1 || p.nodes[p.root].type != NODE_PIPELINE || p.nodes[p.root].next != -1 ||
+        p.pipeline_count != 1 || p.command_count != 1 || p.pipelines[0].background || p.pipelines[0].timed ||
+        p.commands[0].word_count == 0 || p.commands[0].redirection_count > 0 || p.commands[0].is_assignment ||
+        p.commands[0].error != NULL || !is_name_char(name[0], 1)) {
+        fprintf(stderr, "alias: %s: the value must be a simple command\n", name);
+        free(line);
+        free_parser(&p);
+        last_status = 1;
+        return SUCCESS;
+    }
+    d = calloc(1, sizeof(struct definition));
+    ret = d != NULL && copy_tree(&d->tree, &p, p.root) == PARSE_OK ? SUCCESS : SYSTEM_FAILURES;
+    free(line);
+    free_parser(&p);
+    if (ret != SUCCESS) {
+        if (d != NULL)
+            free_parser(&d->tree);
+        free(d);
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    return define(name, ENTRY_ALIAS, value, d);
+}
+
+//unalias name...: removes the aliases
+int unalias_builtin(char **args, int argc) {
+    last_status = 0;
+    for (int i = 1; i < argc; i++)
+        unset_env_entry(args[i], ENTRY_ALIAS);
+    return SUCCESS;
+}
+
+/********************************************* JOBS ****************************************************************/
+//every command that runs as processes is a job: a single command or all the stages of a pipeline.
+//SIGCHLD is blocked in the shell for good, and the children are reaped only by waitpid() loops in the shell's
+//own flow (no handler), so all the processes that changed together are reaped, and a foreground status can't be stolen.
+//'wait' sleeps on a signalfd of the pending SIGCHLD. the processes that didn't finish are found by their pid
+//in an open addressing table, so reaping costs the same with one job or with thousands
+
+void init_jobs() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+    child_fd = signalfd(-1, &set, SFD_CLOEXEC);
+    if (child_fd == -1)
+        perror("signalfd"); //wait_for_children() falls back to sigwaitinfo()
+}
+
+//registers the launched processes (pids[], -1 for a stage that couldn't be executed) as a job.
+//a foreground job is waited for, a background one only gets its id
+int start_job(char ***args, pid_t *pids, int num_procs, int run_in_background) {
+    struct job *job = add_job(args, pids, num_procs, run_in_background);
+    if (job == NULL)
+        return SYSTEM_FAILURES;
+    if (!run_in_background) {
+        wait_for_job(job);
+        return SUCCESS;
+    }
+    current_job = last_background_job = job->id;
+    last_background_pid = pids[num_procs - 1];
+    last_status = 0;
+    if (interactive && pids[num_procs - 1] != -1)
+        printf("[%d] %d\n", job->id, pids[num_procs - 1]);
+    return SUCCESS;
+}
+
+//the job of the launched processes, without waiting for it. NULL if there's no memory
+struct job *add_job(char ***args, pid_t *pids, int num_procs, int run_in_background) {
+    struct job *job = create_job(args, num_procs, run_in_background);
+    if (job == NULL)
+        return NULL;
+    for (int i = 0; i < num_procs; i++) {
+        if (add_process(job, i, pids[i]) != SUCCESS)
+            return NULL;
+    }
+    return job;
+}
+
+//allocates a job with the next free id. the texts of the stages are kept for 'jobs' (args are freed with the line)
+struct job *create_job(char ***args, int num_procs, int run_in_background) {
+    size_t size = 0;
+    effect_count++;
+    for (int i = 0; i < num_procs; i++) {
+        for (int j = 0; args[i] != NULL && args[i][j] != NULL; j++)
+            size += strlen(args[i][j]) + 1;
+        size++;
+    }
+    struct job *job = malloc(sizeof(struct job) + num_procs * sizeof(struct process));
+    char *text = malloc(size);
+    if (job == NULL || text == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for a job\n");
+        free(job);
+        free(text);
+        return NULL;
+    }
+    if (last_job_id == job_capacity) {
+        int capacity = job_capacity == 0 ? 64 : job_capacity * 2;
+        struct job **grown = realloc(jobs, capacity * sizeof(struct job *));
+        if (grown == NULL) {
+            fprintf(stderr, "Error: failed to allocate memory for the job table\n");
+            free(job);
+            free(text);
+            return NULL;
+        }
+        memset(grown + job_capacity, 0, (capacity - job_capacity) * sizeof(struct job *));
+        jobs = grown;
+        job_capacity = capacity;
+    }
+
+    job->id = ++last_job_id;
+    job->num_procs = num_procs;
+    job->live = job->stopped = 0;
+    job->background = run_in_background;
+    job->command = text;
+    job->saved_args = NULL;
+    job->saved_redirects = NULL;
+    for (int i = 0; i < num_procs; i++) {
+        job->procs[i].text = text;
+        text[0] = '\0';
+        for (int j = 0; args[i] != NULL && args[i][j] != NULL; j++) {
+            if (j > 0)
+                *text++ = SPACE_CHAR;
+            strcpy(text, args[i][j]);
+            text += strlen(text);
+        }
+        text++;
+    }
+    jobs[job->id - 1] = job;
+    job_count++;
+    return job;
+}
+
+//the i-th process of the job. a process that wasn't launched (pid -1) is done, with exit status 127
+//(1 for a SKIPPED_STAGE)
+int add_process(struct job *job, int i, pid_t pid) {
+    struct process *proc = &job->procs[i];
+    proc->pid = pid < 0 ? -1 : pid;
+    proc->job = job;
+    memset(&proc->usage, 0, sizeof(proc->usage));
+    if (pid < 0) {
+        proc->state = JOB_DONE;
+        proc->status = (pid == SKIPPED_STAGE ? 1 : 127) << 8; //as if it exited with it
+        count_process(proc);
+        if (job->live == 0 && i == job->num_procs - 1)
+            finished_jobs++;
+        return SUCCESS;
+    }
+    proc->started = now_seconds();
+    proc->state = JOB_RUNNING;
+    proc->status = 0;
+    job->live++;
+    if (2 * (pid_count + 1) > pid_capacity && grow_pid_table() != SUCCESS)
+        return SYSTEM_FAILURES;
+    int mask = pid_capacity - 1, j = (int) (hash_pid(pid) & mask);
+    while (pid_table[j] != NULL)
+        j = (j + 1) & mask;
+    pid_table[j] = proc;
+    pid_count++;
+    return SUCCESS;
+}
+
+//records a status from wait4(). a finished process leaves pid_table
+void update_process(struct process *proc, int status, struct rusage *usage) {
+    struct job *job = proc->job;
+    if (WIFSTOPPED(status)) {
+        if (proc->state == JOB_RUNNING)
+            job->stopped++;
+        proc->state = JOB_STOPPED;
+        proc->status = status;
+        return;
+    }
+    if (proc->state == JOB_STOPPED)
+        job->stopped--;
+    if (WIFCONTINUED(status)) {
+        proc->state = JOB_RUNNING;
+        return;
+    }
+    proc->state = JOB_DONE;
+    proc->status = status;
+    proc->usage = *usage;
+    count_process(proc);
+    unhash_pid(proc->pid);
+    if (--job->live == 0)
+        finished_jobs++;
+}
+
+//pids are mostly consecutive, the multiplication (Knuth's) spreads them over the table
+unsigned int hash_pid(pid_t pid) {
+    return (unsigned int) pid * 2654435761u;
+}
+
+struct process *find_process(pid_t pid) {
+    if (pid_count == 0)
+        return NULL;
+    int mask = pid_capacity - 1;
+    for (int i = (int) (hash_pid(pid) & mask); pid_table[i] != NULL; i = (i + 1) & mask) {
+        if (pid_table[i]->pid == pid)
+            return pid_table[i];
+    }
+    return NULL;
+}
+
+int grow_pid_table() {
+    int old_capacity = pid_capacity;
+    struct process **old = pid_table;
+
+    pid_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    pid_table = calloc(pid_capacity, sizeof(struct process *));
+    if (pid_table == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for the process table\n");
+        pid_table = old;
+        pid_capacity = old_capacity;
+        return SYSTEM_FAILURES;
+    }
+    int mask = pid_capacity - 1;
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i] == NULL)
+            continue;
+        int j = (int) (hash_pid(old[i]->pid) & mask);
+        while (pid_table[j] != NULL)
+            j = (j + 1) & mask;
+        pid_table[j] = old[i];
+    }
+    free(old);
+    return SUCCESS;
+}
+
+//removes the pid, and moves back the entries after it that can fill the hole (no tombstones)
+void unhash_pid(pid_t pid) {
+    if (pid_count == 0)
+        return;
+    int mask = pid_capacity - 1, i = (int) (hash_pid(pid) & mask);
+    while (pid_table[i] != NULL && pid_table[i]->pid != pid)
+        i = (i + 1) & mask;
+    if (pid_table[i] == NULL)
+        return;
+    pid_table[i] = NULL;
+    pid_count--;
+    for (int j = (i + 1) & mask; pid_table[j] != NULL; j = (j + 1) & mask) {
+        int home = (int) (hash_pid(pid_table[j]->pid) & mask);
+        if (can_fill_slot(i, j, home)) {
+            pid_table[i] = pid_table[j];
+            pid_table[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+//reaps every child that finished, stopped or continued since the last time. never blocks
+void reap_children() {
+    int status;
+    pid_t pid;
+    struct process *proc;
+    struct rusage usage;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        if ((proc = find_process(pid)) != NULL)
+            update_process(proc, status, &usage);
+    }
+}
+
+//sleeps until a child changes. a SIGCHLD that came after the last reap_children() is still pending
+//(it's blocked), so it can't be missed
+void wait_for_children() {
+    struct signalfd_siginfo info;
+    sigset_t set;
+    if (child_fd == -1) {
+        sigemptyset(&set);
+        sigaddset(&set, SIGCHLD);
+        while (sigwaitinfo(&set, NULL) == -1 && errno == EINTR);
+        return;
+    }
+    while (read(child_fd, &info, sizeof(info)) == -1 && errno == EINTR);
+}
+
+//waits for all the processes of a foreground job. a stopped job stays in the table,
+//a finished one is removed: last_status is the status of the last stage, and PIPESTATUS has all of them
+void wait_for_job(struct job *job) {
+    int status;
+    struct rusage usage;
+    long long traced = tracing ? trace_clock() : 0;
+    job->background = 0;
+    for (int i = 0; i < job->num_procs; i++) {
+        struct process *proc = &job->procs[i];
+        while (proc->state == JOB_RUNNING) {
+            if (wait4(proc->pid, &status, WUNTRACED, &usage) == -1) {
+                if (errno == EINTR)
+                    continue;
+                perror("waitpid() failed");
+                status = 0;
+                memset(&usage, 0, sizeof(usage));
+            }
+            update_process(proc, status, &usage);
+        }
+        if (proc->state == JOB_STOPPED) { //^Z - the job goes to the table, 'fg' or 'bg' continues it
+            current_job = job->id;
+            last_status = 128 + WSTOPSIG(proc->status);
+            printf("\n[%d]+  Stopped\t\t", job->id);
+            print_job(job, -1);
+            if (traced)
+                trace_add("wait", traced, job->procs[0].text);
+            return;
+        }
+    }
+
+    char *statuses = arena_alloc(&line_arena, job->num_procs * 12);
+    if (statuses != NULL) {
+        int len = 0;
+        for (int i = 0; i < job->num_procs; i++)
+            len += sprintf(statuses + len, i == 0 ? "%d" : " %d", exit_code(job->procs[i].status));
+        my_setenv("PIPESTATUS", statuses);
+    }
+    if (time_report != NULL) {
+        time_report->procs = arena_alloc(&line_arena, job->num_procs * sizeof(struct process));
+        if (time_report->procs != NULL) {
+            memcpy(time_report->procs, job->procs, job->num_procs * sizeof(struct process));
+            time_report->num_procs = job->num_procs;
+        }
+    }
+    last_status = exit_code(job->procs[job->num_procs - 1].status);
+    if (traced)
+        trace_add("wait", traced, job->procs[0].text);
+    remove_job(job);
+}
+
+//sends SIGCONT to the processes of the job that didn't finish
+void continue_job(struct job *job) {
+    for (int i = 0; i < job->num_procs; i++) {
+        struct process *proc = &job->procs[i];
+        if (proc->state == JOB_DONE)
+            continue;
+        kill(proc->pid, SIGCONT);
+        if (proc->state == JOB_STOPPED)
+            job->stopped--;
+        proc->state = JOB_RUNNING;
+    }
+}
+
+void remove_job(struct job *job) {
+    for (int i = 0; i < job->num_procs; i++) {
+        if (job->procs[i].state != JOB_DONE) //the process wasn't reaped, but nobody asks about it anymore
+            unhash_pid(job->procs[i].pid);
+    }
+    if (job->saved_args != NULL)
+        free_saved_args(job);
+    else if (job->live == 0)
+        finished_jobs--;
+    if (current_job == job->id)
+        current_job = 0;
+    jobs[job->id - 1] = NULL;
+    job_count--;
+    while (last_job_id > 0 && jobs[last_job_id - 1] == NULL)
+        last_job_id--;
+    free(job->command);
+    free(job);
+}
+
+//before every prompt: reaps the background jobs, reports the finished ones & removes them.
+//costs nothing when there are no jobs, and scans the table only when a job finished
+void notify_jobs() {
+    if (job_count == 0)
+        return;
+    reap_children();
+    start_queued_jobs();
+    for (int id = 1; id <= last_job_id && finished_jobs > 0; id++) {
+        struct job *job = jobs[id - 1];
+        if (job == NULL || job->live > 0 || job->saved_args != NULL)
+            continue;
+        if (interactive)
+            print_job(job, 0);
+        remove_job(job);
+    }
+    fflush(stdout);
+}
+
+//the job of %n, %% or %+ (the current job, also for spec NULL), or the job of a pid.
+//prints an error & returns NULL if there isn't such job
+struct job *find_job(char *spec, char *caller) {
+    struct job *job = NULL;
+    char *end;
+    long n;
+
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        if (current_job != 0)
+            job = jobs[current_job - 1];
+        for (int id = last_job_id; job == NULL && id > 0; id--) //the newest stopped job, or the newest at all
+            if (jobs[id - 1] != NULL && jobs[id - 1]->stopped > 0)
+                job = jobs[id - 1];
+        if (job == NULL && last_job_id > 0)
+            job = jobs[last_job_id - 1];
+    } else if (spec[0] == '%') {
+        n = strtol(spec + 1, &end, 10);
+        if (spec[1] != '\0' && *end == '\0' && n > 0 && n <= last_job_id)
+            job = jobs[n - 1];
+    } else {
+        n = strtol(spec, &end, 10);
+        struct process *proc = *end == '\0' && n > 0 ? find_process((pid_t) n) : NULL;
+        if (proc != NULL)
+            job = proc->job;
+        for (int id = 1; job == NULL && *end == '\0' && id <= last_job_id; id++) { //a pid that already finished
+            for (int i = 0; jobs[id - 1] != NULL && i < jobs[id - 1]->num_procs; i++)
+                if (jobs[id - 1]->procs[i].pid == n)
+                    job = jobs[id - 1];
+        }
+    }
+    if (job == NULL)
+        fprintf(stderr, "%s: %s: no such job\n", caller, spec == NULL ? "current" : spec);
+    return job;
+}
+
+//a job as 'jobs' prints it: [id]+ state command. long_format has a line with the pid & the state of each process,
+//-1 prints only the command
+void print_job(struct job *job, int long_format) {
+    char state[32];
+    struct job *current = current_job != 0 ? jobs[current_job - 1] : jobs[last_job_id - 1];
+    char mark = job == current ? '+' : ' ';
+
+    if (long_format == 0) {
+        describe_state(job, &job->procs[job->num_procs - 1], state, sizeof(state));
+        printf("[%d]%c  %-24s", job->id, mark, state);
+    }
+    for (int i = 0; i < job->num_procs; i++) {
+        if (long_format == 1) {
+            describe_state(NULL, &job->procs[i], state, sizeof(state));
+            if (i == 0)
+                printf("[%d]%c %6d %-22s", job->id, mark, job->procs[i].pid, state);
+            else
+                printf("\n     %6d %-22s| ", job->procs[i].pid, state);
+        } else if (i > 0)
+            printf(" | ");
+        printf("%s", job->procs[i].text);
+    }
+    printf(job->background ? " &\n" : "\n");
+}
+
+//the state of a job (job != NULL, by the status of proc, its last process) or of a single process:
+//Running, Stopped, Done, Exit <status> or Killed (<signal>)
+void describe_state(struct job *job, struct process *proc, char *state, size_t size) {
+    if (proc->job->saved_args != NULL)
+        snprintf(state, size, "Queued");
+    else if (job != NULL ? job->live > job->stopped : proc->state == JOB_RUNNING)
+        snprintf(state, size, "Running");
+    else if (job != NULL ? job->stopped > 0 : proc->state == JOB_STOPPED)
+        snprintf(state, size, "Stopped");
+    else if (WIFSIGNALED(proc->status))
+        snprintf(state, size, "Killed (%s)", strsignal(WTERMSIG(proc->status)));
+    else if (exit_code(proc->status) == 0)
+        snprintf(state, size, "Done");
+    else
+        snprintf(state, size, "Exit %d", exit_code(proc->status));
+}
+
+//BG_LIMIT=<n> allows at most n background jobs to run at once. returns 1 if a new one has to wait in the queue:
+//the limit is reached, or older jobs wait already (they start first)
+int background_full() {
+    char *value = get_option("BG_LIMIT");
+    int limit = value != NULL ? atoi(value) : 0, running = 0;
+    if (limit <= 0)
+        return 0;
+    reap_children();
+    start_queued_jobs();
+    if (queued_jobs > 0)
+        return 1;
+    for (int id = 1; id <= last_job_id && running < limit; id++)
+        running += jobs[id - 1] != NULL && jobs[id - 1]->background && jobs[id - 1]->live > 0;
+    return running >= limit;
+}
+
+//keeps a background job that can't start yet: copies of its argv[] (they are freed with the line) & its '>' files
+int queue_job(char ***args, struct redirect **redirects, int num_commands) {
+    struct job *job = create_job(args, num_commands, 1);
+    if (job == NULL)
+        return SYSTEM_FAILURES;
+    job->saved_args = calloc(num_commands, sizeof(char **));
+    job->saved_redirects = calloc(num_commands, sizeof(struct redirect *));
+    if (job->saved_args == NULL || job->saved_redirects == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for a job\n");
+        return SYSTEM_FAILURES;
+    }
+    queued_jobs++;
+    for (int i = 0; i < num_commands; i++) {
+        struct process *proc = &job->procs[i];
+        proc->pid = -1;
+        proc->state = JOB_RUNNING;
+        proc->status = 0;
+        proc->job = job;
+        memset(&proc->usage, 0, sizeof(proc->usage));
+        job->saved_args[i] = copy_argv(args[i]);
+        if (redirects[i] != NULL)
+            job->saved_redirects[i] = copy_redirects(redirects[i]);
+        if (job->saved_args[i] == NULL || (redirects[i] != NULL && job->saved_redirects[i] == NULL)) {
+            fprintf(stderr, "Error: failed to allocate memory for a job\n");
+            return SYSTEM_FAILURES;
+        }
+    }
+    current_job = last_background_job = job->id;
+    last_background_pid = 0;
+    last_status = 0;
+    if (interactive)
+        printf("[%d] queued\n", job->id);
+    return SUCCESS;
+}
+
+//starts the queued jobs, the oldest first, as long as BG_LIMIT allows
+void start_queued_jobs() {
+    char *value;
+    int limit, running = 0;
+    if (queued_jobs == 0)
+        return;
+    value = get_option("BG_LIMIT");
+    limit = value != NULL ? atoi(value) : 0;
+    for (int id = 1; id <= last_job_id; id++)
+        running += jobs[id - 1] != NULL && jobs[id - 1]->background && jobs[id - 1]->live > 0;
+    for (int id = 1; id <= last_job_id && queued_jobs > 0 && (limit <= 0 || running < limit); id++) {
+        struct job *job = jobs[id - 1];
+        if (job == NULL || job->saved_args == NULL)
+            continue;
+        if (launch_queued_job(job) != SUCCESS)
+            free_and_exit(1);
+        running++;
+    }
+}
+
+//the shell is about to exit: the jobs that still wait for BG_LIMIT start as the running ones finish, so the last
+//'&' commands of a script aren't dropped. the shell doesn't wait for the last ones it started
+void start_remaining_jobs() {
+    int status = last_status;
+    reap_children();
+    start_queued_jobs();
+    while (queued_jobs > 0) {
+        wait_for_children();
+        reap_children();
+        start_queued_jobs();
+    }
+    last_status = status; //the shell exits with the status of its own last command
+}
+
+int launch_queued_job(struct job *job) {
+    pid_t *pids = arena_alloc(&line_arena, job->num_procs * sizeof(pid_t));
+    if (pids == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for a job\n");
+        return SYSTEM_FAILURES;
+    }
+    launch_stages(job->saved_args, job->saved_redirects, job->num_procs, NULL, pids);
+    free_saved_args(job);
+    if (job->id == last_background_job)
+        last_background_pid = pids[job->num_procs - 1];
+    for (int i = 0; i < job->num_procs; i++) {
+        if (add_process(job, i, pids[i]) != SUCCESS)
+            return SYSTEM_FAILURES;
+    }
+    return SUCCESS;
+}
+
+//argv[] in one malloc()ed block: the pointers, and then the strings
+char **copy_argv(char **args) {
+    int argc = 0;
+    size_t size = sizeof(char *);
+    for (; args[argc] != NULL; argc++)
+        size += sizeof(char *) + strlen(args[argc]) + 1;
+    char **copy = malloc(size);
+    if (copy == NULL)
+        return NULL;
+    char *strings = (char *) (copy + argc + 1);
+    for (int i = 0; i < argc; i++) {
+        copy[i] = strings;
+        strings = stpcpy(strings, args[i]) + 1;
+    }
+    copy[argc] = NULL;
+    return copy;
+}
+
+//a copy of a command's redirections in one allocation, like copy_argv(). a here-doc's memory file is dup()ed,
+//as the line's here-docs are closed when the line is done
+struct redirect *copy_redirects(struct redirect *r) {
+    int count = 0;
+    size_t size = sizeof(struct redirect);
+    for (; r[count].type != REDIRECT_NONE; count++)
+        size += sizeof(struct redirect) + (r[count].target != NULL ? strlen(r[count].target) + 1 : 0);
+    struct redirect *copy = malloc(size);
+    if (copy == NULL)
+        return NULL;
+    char *strings = (char *) (copy + count + 1);
+    for (int i = 0; i <= count; i++) {
+        copy[i] = r[i];
+        if (r[i].fd != -1)
+            copy[i].fd = fcntl(r[i].fd, F_DUPFD_CLOEXEC, 0);
+        if (i < count && r[i].target != NULL) {
+            copy[i].target = strings;
+            strings = stpcpy(strings, r[i].target) + 1;
+        }
+    }
+    return copy;
+}
+
+void free_saved_args(struct job *job) {
+    if (job->saved_args == NULL)
+        return;
+    for (int i = 0; i < job->num_procs; i++) {
+        free(job->saved_args[i]);
+        for (struct redirect *r = job->saved_redirects[i]; r != NULL && r->type != REDIRECT_NONE; r++)
+            if (r->fd != -1)
+                close(r->fd);
+        free(job->saved_redirects[i]);
+    }
+    free(job->saved_args);
+    free(job->saved_redirects);
+    job->saved_args = NULL;
+    job->saved_redirects = NULL;
+    queued_jobs--;
+}
+
+//the exit status of a shell command from a waitpid() status: 128 + the signal for a killed or stopped process
+int exit_code(int status) {
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return WEXITSTATUS(status);
+}
+
+void free_jobs() {
+    for (int id = 1; id <= last_job_id; id++)
+        if (jobs[id - 1] != NULL) {
+            free_saved_args(jobs[id - 1]);
+            free(jobs[id - 1]->command);
+            free(jobs[id - 1]);
+        }
+    free(jobs);
+    free(pid_table);
+    jobs = NULL;
+    pid_table = NULL;
+    job_capacity = job_count = last_job_id = pid_capacity = pid_count = 0;
+    current_job = finished_jobs = queued_jobs = 0;
+    if (child_fd != -1)
+        close(child_fd);
+    child_fd = -1;
+}
+
+//jobs [-l]: lists the jobs, -l with the pid & state of every process. the finished ones are removed after that
+int jobs_builtin(char **args, int argc) {
+    int long_format = argc > 1 && strcmp(args[1], "-l") == 0;
+    reap_children();
+    start_queued_jobs();
+    for (int id = 1; id <= last_job_id; id++) {
+        struct job *job = jobs[id - 1];
+        if (job == NULL)
+            continue;
+        print_job(job, long_format);
+        if (job->live == 0 && job->saved_args == NULL)
+            remove_job(job);
+    }
+    last_status = 0;
+    return SUCCESS;
+}
+
+//fg [%n]: continues the job (the current one by default) in the foreground, and waits for it
+int fg_builtin(char **args, int argc) {
+    struct job *job = find_job(argc > 1 ? args[1] : NULL, "fg");
+    if (job == NULL) {
+        last_status = 1;
+        return SUCCESS;
+    }
+    job->background = 0;
+    print_job(job, -1);
+    fflush(stdout);
+    if (job->saved_args != NULL && launch_queued_job(job) != SUCCESS) //it doesn't wait for its turn anymore
+        return SYSTEM_FAILURES;
+    continue_job(job);
+    wait_for_job(job);
+    return SUCCESS;
+}
+
+//bg [%n...]: continues stopped jobs (the current one by default) in the background
+int bg_builtin(char **args, int argc) {
+    last_status = 0;
+    for (int i = 1; i < argc || i == 1; i++) {
+        struct job *job = find_job(argc > 1 ? args[i] : NULL, "bg");
+        if (job == NULL) {
+            last_status = 1;
+            continue;
+        }
+        job->background = 1;
+        if (job->saved_args != NULL) {
+            fprintf(stderr, "bg: job %d is queued\n", job->id);
+            continue;
+        }
+        if (job->stopped == 0) {
+            fprintf(stderr, "bg: job %d already in background\n", job->id);
+            continue;
+        }
+        current_job = job->id;
+        continue_job(job);
+        printf("[%d]+ ", job->id);
+        print_job(job, -1);
+    }
+    return SUCCESS;
+}
+
+//wait [%n | pid...]: waits until the jobs finish (all the running jobs by default).
+//last_status is the status of the last one
+int wait_builtin(char **args, int argc) {
+    last_status = 0;
+    if (argc == 1) {
+        while (1) {
+            reap_children();
+            start_queued_jobs();
+            int running = 0;
+            for (int id = 1; id <= last_job_id && !running; id++)
+                running = jobs[id - 1] != NULL && jobs[id - 1]->live > jobs[id - 1]->stopped;
+            if (!running)
+                break;
+            wait_for_children();
+        }
+        for (int id = 1; id <= last_job_id; id++) //they were waited for, there is nothing to report
+            if (jobs[id - 1] != NULL && jobs[id - 1]->live == 0 && jobs[id - 1]->saved_args == NULL)
+                remove_job(jobs[id - 1]);
+        return SUCCESS;
+    }
+    for (int i = 1; i < argc; i++) {
+        struct job *job = find_job(args[i], "wait");
+        if (job == NULL) {
+            last_status = 127;
+            continue;
+        }
+        reap_children();
+        start_queued_jobs();
+        while (job->live > job->stopped || job->saved_args != NULL) {
+            wait_for_children();
+            reap_children();
+            start_queued_jobs();
+        }
+        if (job->live > 0) { //stopped - it can't finish by itself
+            last_status = 128 + SIGTSTP;
+            continue;
+        }
+        last_status = exit_code(job->procs[job->num_procs - 1].status);
+        remove_job(job);
+    }
+    return SUCCESS;
+}
+
+/********************************************* HISTORY ****************************************************************/
+
+/*the history is shared by all the shells of the user: a log of the command lines ($HISTFILE or ~/.ex1_history,
+ one entry per line, plain text) & an index of fixed records, one per entry (the log's name + ".idx"). both files are
+ only appended, under flock(), and are mmap()ed: a shell never reads them into memory, so starting doesn't get
+ slower as the history grows, and the pages a search doesn't reach are never read from the disk.
+ an entry's number is its line in the log, so it's the same in all the shells*/
+int open_history() {
+    char path[PATH_MAX], index_path[PATH_MAX + 8];
+    char *file = getenv("HISTFILE"), *home = getenv("HOME");
+
+    if (history.tried)
+        return history.log_fd != -1 ? SUCCESS : INVALID_INPUT;
+    history.tried = 1;
+    if (file != NULL && file[0] != 0)
+        snprintf(path, sizeof(path), "%s", file);
+    else if (home != NULL)
+        snprintf(path, sizeof(path), "%s/.ex1_history", home);
+    else
+        return INVALID_INPUT;
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    history.log_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    history.index_fd = open(index_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history.log_fd == -1 || history.index_fd == -1) {
+        perror(history.log_fd == -1 ? path : index_path);
+        close_history();
+        return INVALID_INPUT;
+    }
+    flock(history.log_fd, LOCK_EX); //the log's lock is the lock of both files
+    repair_history();
+    flock(history.log_fd, LOCK_UN);
+    return SUCCESS;
+}
+
+void close_history() {
+    if (history.index != NULL)
+        munmap(history.index, history.index_size);
+    if (history.log != NULL)
+        munmap(history.log, history.log_size);
+    if (history.log_fd != -1)
+        close(history.log_fd);
+    if (history.index_fd != -1)
+        close(history.index_fd);
+    history.index = NULL;
+    history.log = NULL;
+    history.index_size = history.log_size = 0;
+    history.count = 0;
+    history.log_fd = history.index_fd = -1;
+}
+
+/*maps the files again if their size changed (by this shell or another one). the index is looked at first:
+ a line is written to the log before its record, so the mapped log has all the entries of the mapped records*/
+int map_history() {
+    struct stat index_stat, log_stat;
+    void *map;
+
+    if (fstat(history.index_fd, &index_stat) == -1 || fstat(history.log_fd, &log_stat) == -1)
+        return INVALID_INPUT;
+    if ((size_t) index_stat.st_size != history.index_size) {
+        if (history.index != NULL)
+            munmap(history.index, history.index_size);
+        history.index = NULL;
+        history.count = 0;
+        history.index_size = index_stat.st_size;
+        if (history.index_size > 0) {
+            map = mmap(NULL, history.index_size, PROT_READ, MAP_SHARED, history.index_fd, 0);
+            if (map == MAP_FAILED) {
+                history.index_size = 0;
+                return INVALID_INPUT;
+            }
+            history.index = map;
+            history.count = history.index_size / sizeof(struct history_record); //without a record half written
+        }
+    }
+    if ((size_t) log_stat.st_size != history.log_size) {
+        if (history.log != NULL)
+            munmap(history.log, history.log_size);
+        history.log = NULL;
+        history.log_size = log_stat.st_size;
+        if (history.log_size > 0) {
+            map = mmap(NULL, history.log_size, PROT_READ, MAP_SHARED, history.log_fd, 0);
+            if (map == MAP_FAILED) {
+                history.log_size = 0;
+                return INVALID_INPUT;
+            }
+            history.log = map;
+        }
+    }
+    return SUCCESS;
+}
+
+//a shell that was killed inside add_history() may have left half a record, a line without a record,
+//or a line without its newline. the records of the complete lines are added, and the rest is cut. called under the lock
+void repair_history() {
+    struct history_record record;
+    size_t end = 0;
+    char *newline;
+
+    if (map_history() != SUCCESS)
+        return;
+    if (history.index_size % sizeof(struct history_record) != 0 &&
+        ftruncate(history.index_fd, history.count * sizeof(struct history_record)) == -1)
+        perror("history");
+    if (history.count > 0) { //where the last indexed entry ends
+        end = history.index[history.count - 1].offset;
+        newline = end < history.log_size ? memchr(history.log + end, '\n', history.log_size - end) : NULL;
+        if (newline == NULL) { //its line wasn't written, it's removed
+            if (ftruncate(history.index_fd, (history.count - 1) * sizeof(struct history_record)) == -1 ||
+                ftruncate(history.log_fd, end) == -1)
+                perror("history");
+            map_history();
+            return;
+        }
+        end = newline - history.log + 1;
+    }
+    while (end < history.log_size) {
+        newline = memchr(history.log + end, '\n', history.log_size - end);
+        if (newline == NULL) {
+            if (ftruncate(history.log_fd, end) == -1)
+                perror("history");
+            break;
+        }
+        make_history_record(&record, end, history.log + end, newline - (history.log + end));
+        if (write(history.index_fd, &record, sizeof(record)) != sizeof(record))
+            break;
+        end = newline - history.log + 1;
+    }
+    map_history();
+}
+
+void make_history_record(struct history_record *record, size_t offset, const char *line, size_t len) {
+    memset(record, 0, sizeof(struct history_record));
+    record->offset = offset;
+    memcpy(record->head, line, len < HISTORY_HEAD ? len : HISTORY_HEAD);
+}
+
+//appends the line to the history, unless it's blank or the same as the last entry.
+//the line & its record are written under the lock, so the entries of concurrent shells don't mix
+void add_history(char *line) {
+    struct history_record record;
+    struct iovec iov[2];
+    size_t len = strlen(line), last_len;
+    char *last;
+
+    if (strspn(line, " \t\n") == len || open_history() != SUCCESS)
+        return;
+    flock(history.log_fd, LOCK_EX);
+    if (map_history() == SUCCESS) { //now the log's size is where the line is appended
+        last = history_entry(history.count, &last_len);
+        if (last == NULL || last_len != len || memcmp(last, line, len) != 0) {
+            make_history_record(&record, history.log_size, line, len);
+            iov[0].iov_base = line;
+            iov[0].iov_len = len;
+            iov[1].iov_base = "\n";
+            iov[1].iov_len = 1;
+            if (writev(history.log_fd, iov, 2) == (ssize_t) len + 1 &&
+                write(history.index_fd, &record, sizeof(record)) != sizeof(record))
+                perror("history"); //the next open_history() adds the record
+        }
+    }
+    flock(history.log_fd, LOCK_UN);
+}
+
+//entry n (from 1) inside the mapped log, without its newline, and its length. NULL if there is no such entry
+char *history_entry(long n, size_t *len) {
+    size_t start, end;
+    char *newline;
+
+    if (n < 1 || n > history.count || history.index[n - 1].offset >= history.log_size)
+        return NULL;
+    start = history.index[n - 1].offset;
+    if (n < history.count && history.index[n].offset <= history.log_size)
+        end = history.index[n].offset - 1;
+    else if ((newline = memchr(history.log + start, '\n', history.log_size - start)) != NULL)
+        end = newline - history.log;
+    else
+        return NULL;
+    (*len) = end - start;
+    return history.log + start;
+}
+
+//the entry the byte at offset of the log is in: a binary search of the records
+long history_entry_at(size_t offset) {
+    long low = 1, high = history.count, middle;
+    while (low < high) {
+        middle = (low + high + 1) / 2;
+        if (history.index[middle - 1].offset <= offset)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+//where the last entry ends in the log. after it there may be a line that is being written by another shell
+size_t history_end() {
+    size_t len;
+    char *last = history_entry(history.count, &len);
+    return last != NULL ? (size_t) (last - history.log) + len : 0;
+}
+
+//the newest entry before entry 'before' that starts with prefix, 0 if there is none.
+//the heads in the index are compared first, so the log is read only for the entries that start like the prefix
+long history_find_prefix(const char *prefix, size_t len, long before) {
+    size_t head_len = len < HISTORY_HEAD ? len : HISTORY_HEAD, entry_len;
+    char *entry;
+
+    if (before > history.count + 1)
+        before = history.count + 1;
+    for (long n = before - 1; n >= 1; n--) {
+        if (memcmp(history.index[n - 1].head, prefix, head_len) != 0)
+            continue;
+        if (len <= HISTORY_HEAD)
+            return n;
+        entry = history_entry(n, &entry_len);
+        if (entry != NULL && entry_len >= len && memcmp(entry, prefix, len) == 0)
+            return n;
+    }
+    return 0;
+}
+
+/*the newest entry before entry 'before' that contains text, 0 if there is none. the log is searched backwards,
+ a window at a time, by memmem(): a recent entry is found without reading the whole log.
+ the windows overlap by the text's length, so a match on the border of two windows isn't missed*/
+long history_find_text(const char *text, size_t len, long before) {
+    size_t window = len * 2 > HISTORY_WINDOW ? len * 2 : HISTORY_WINDOW, limit, start, entry_len;
+    char *entry, *found, *match;
+
+    if (before > history.count + 1)
+        before = history.count + 1;
+    if ((entry = history_entry(before - 1, &entry_len)) == NULL || len == 0)
+        return len == 0 ? before - 1 : 0;
+    limit = (entry - history.log) + entry_len;
+    while (1) {
+        start = limit > window ? limit - window : 0;
+        match = NULL;
+        for (found = history.log + start;
+             (found = memmem(found, history.log + limit - found, text, len)) != NULL; found++)
+            match = found; //the last match in the window
+        if (match != NULL)
+            return history_entry_at(match - history.log);
+        if (start == 0)
+            return 0;
+        limit = start + len - 1;
+    }
+}
+
+/*replaces the events of the line: !! - the last entry, !n - entry n, !-n - the n-th entry from the end,
+ !?text[?] - the newest entry that contains text, !prefix - the newest entry that starts with prefix.
+ a '!' before a blank, '=', '"' or the end of the line stays as is.
+ returns the line itself if it has no events, the expanded line (in line_arena, printed like bash does it),
+ or NULL if an event wasn't found*/
+char *expand_history(char *line) {
+    char *bang = strchr(line, '!'), *expanded = NULL, *event, *entry, *end, *grown;
+    size_t len = 0, capacity = 0, entry_len, event_len;
+    long n;
+
+    if (bang == NULL || open_history() != SUCCESS || map_history() != SUCCESS)
+        return line;
+    while (bang != NULL) {
+        event = bang + 1;
+        if (*event == 0 || *event == ' ' || *event == '\t' || *event == '\n' || *event == '=' || *event == '"') {
+            bang = strchr(event, '!');
+            continue;
+        }
+        if (*event == '!') {
+            n = history.count;
+            end = event + 1;
+        } else if (*event >= '0' && *event <= '9') {
+            n = strtol(event, &end, 10);
+        } else if (*event == '-' && event[1] >= '0' && event[1] <= '9') {
+            n = history.count + 1 - strtol(event + 1, &end, 10);
+        } else if (*event == '?') {
+            event_len = strcspn(event + 1, "?\n");
+            n = history_find_text(event + 1, event_len, history.count + 1);
+            end = event + 1 + event_len + (event[1 + event_len] == '?');
+        } else {
+            event_len = strcspn(event, " \t\n;|&>\"");
+            n = history_find_prefix(event, event_len, history.count + 1);
+            end = event + event_len;
+        }
+        if ((entry = history_entry(n, &entry_len)) == NULL) {
+            fprintf(stderr, "%.*s: event not found\n", (int) (end - bang), bang);
+            free(expanded);
+            last_status = 1;
+            return NULL;
+        }
+        //the text before the event & the entry
+        if (len + (bang - line) + entry_len + 1 > capacity) {
+            capacity = (len + (bang - line) + entry_len + 1) * 2;
+            if ((grown = realloc(expanded, capacity)) == NULL) {
+                perror("malloc failed");
+                free(expanded);
+                return NULL;
+            }
+            expanded = grown;
+        }
+        memcpy(expanded + len, line, bang - line);
+        len += bang - line;
+        memcpy(expanded + len, entry, entry_len);
+        len += entry_len;
+        line = end;
+        bang = strchr(line, '!');
+    }
+    if (expanded == NULL) //only '!'s that aren't events
+        return line;
+    entry = arena_alloc(&line_arena, len + strlen(line) + 1);
+    if (entry != NULL) {
+        memcpy(entry, expanded, len);
+        strcpy(entry + len, line);
+        printf("%s\n", entry);
+    }
+    free(expanded);
+    return entry;
+}
+
+//history [n] - the last n entries (all of them by default), history -s <text> - the entries that contain the text
+int history_builtin(char **args, int argc) {
+    long first = 1, n;
+    size_t len, end, pos = 0;
+    char *entry, *found, *number_end;
+
+    if (open_history() != SUCCESS || map_history() != SUCCESS) {
+        fprintf(stderr, "history: the history file can't be opened\n");
+        last_status = 1;
+        return SUCCESS;
+    }
+    last_status = 0;
+    if (argc > 1 && strcmp(args[1], "-s") == 0) {
+        if (argc < 3 || (len = strlen(args[2])) == 0) {
+            fprintf(stderr, "history: -s needs a text\n");
+            last_status = 2;
+            return SUCCESS;
+        }
+        end = history_end();
+        //memmem() runs over the whole log, and every match is printed with its entry & skips to the next entry
+        while (pos < end && (found = memmem(history.log + pos, end - pos, args[2], len)) != NULL) {
+            n = history_entry_at(found - history.log);
+            entry = history_entry(n, &len);
+            printf("%5ld  %.*s\n", n, (int) len, entry);
+            pos = (entry - history.log) + len + 1;
+            len = strlen(args[2]);
+        }
+        return SUCCESS;
+    }
+    if (argc > 1) {
+        n = strtol(args[1], &number_end, 10);
+        if (*number_end != 0 || n < 0) {
+            fprintf(stderr, "history: %s: numeric argument required\n", args[1]);
+            last_status = 2;
+            return SUCCESS;
+        }
+        first = history.count - n + 1 > 1 ? history.count - n + 1 : 1;
+    }
+    for (n = first; n <= history.count; n++)
+        if ((entry = history_entry(n, &len)) != NULL)
+            printf("%5ld  %.*s\n", n, (int) len, entry);
+    return SUCCESS;
+}
+
+/********************************************* LINE EDITOR ****************************************************************/
+//a terminal is read by a small line editor instead of getline(). the terminal is in raw mode only while a line is
+//read, so the commands get it as it was. after a change the line is written again from its start (the prompt isn't,
+//so the editor doesn't have to know it), and a UTF-8 character is a column.
+//<tab> completes the word before the cursor: a command (a builtin, a function, an alias or an executable of $PATH,
+//which are kept in a trie), a $NAME of the variables, or a path
+
+//the editor is used for a terminal, unless EX1_EDIT=0 or TERM=dumb
+void init_editor() {
+    char *value = getenv("EX1_EDIT"), *term = getenv("TERM");
+    editing = interactive && isatty(STDOUT_FILENO) && tcgetattr(STDIN_FILENO, &cooked) == 0 &&
+              (value == NULL || strcmp(value, "0") != 0) && (term == NULL || strcmp(term, "dumb") != 0);
+}
+
+/*reads a line like read_command() does: the line without its newline, "\n" for an empty line, NULL for ^D.
+ ^C & ^Z are keys of the editor and not signals, so the shell never stops with the terminal in raw mode*/
+char *edit_line() {
+    struct termios raw = cooked;
+    struct editor e = {0, 0, 0, 0, NULL};
+    int key;
+
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    fflush(stdout);
+    if (edit_reserve(1) != SUCCESS || tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1) {
+        editing = 0; //getline() from now on
+        return read_command();
+    }
+    if (open_history() == SUCCESS)
+        map_history();
+    e.history_at = history.count + 1;
+    while (1) {
+        key = read_key();
+        if (key == KEY_NONE || key == '\r' || key == '\n' || (key == CTRL('D') && e.len == 0))
+            break;
+        edit_key(&e, key);
+    }
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+    printf("\n");
+    if (e.len == 0 && key != '\r' && key != '\n') //end of input (ctrl+D)
+        return NULL;
+    if (e.len == 0)
+        input.buffer[e.len++] = '\n'; //an empty line is only its newline, like getline() gives it
+    input.buffer[e.len] = '\0';
+    return input.buffer;
+}
+
+//a key: a byte, or KEY_* for an escape sequence of the terminal. KEY_NONE at the end of the input
+int read_key() {
+    unsigned char c, seq[3];
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, &c, 1)) == -1 && errno == EINTR);
+    if (n != 1)
+        return KEY_NONE;
+    if (c != 27) //escape
+        return c;
+    if (read(STDIN_FILENO, seq, 2) != 2 || (seq[0] != '[' && seq[0] != 'O'))
+        return 27;
+    if (seq[1] >= '0' && seq[1] <= '9') { // \e[3~ ...
+        if (read(STDIN_FILENO, seq + 2, 1) != 1 || seq[2] != '~')
+            return 27;
+        return seq[1] == '3' ? KEY_DELETE : seq[1] == '1' || seq[1] == '7' ? KEY_HOME :
+                                            seq[1] == '4' || seq[1] == '8' ? KEY_END : 27;
+    }
+    switch (seq[1]) {
+        case 'A':
+            return KEY_UP;
+        case 'B':
+            return KEY_DOWN;
+        case 'C':
+            return KEY_RIGHT;
+        case 'D':
+            return KEY_LEFT;
+        case 'H':
+            return KEY_HOME;
+        case 'F':
+            return KEY_END;
+    }
+    return 27;
+}
+
+void edit_key(struct editor *e, int key) {
+    size_t at;
+
+    switch (key) {
+        case '\t':
+            complete_word(e);
+            break;
+        case 127: //backspace
+        case CTRL('H'):
+            for (at = e->pos; at > 0 && (input.buffer[--at] & 0xc0) == 0x80;);
+            edit_delete(e, at, e->pos);
+            break;
+        case KEY_DELETE:
+        case CTRL('D'):
+            for (at = e->pos + (e->pos < e->len); at < e->len && (input.buffer[at] & 0xc0) == 0x80; at++);
+            edit_delete(e, e->pos, at);
+            break;
+        case KEY_LEFT:
+        case CTRL('B'):
+            while (e->pos > 0 && (input.buffer[--e->pos] & 0xc0) == 0x80);
+            edit_refresh(e);
+            break;
+        case KEY_RIGHT:
+        case CTRL('F'):
+            for (e->pos += e->pos < e->len; e->pos < e->len && (input.buffer[e->pos] & 0xc0) == 0x80; e->pos++);
+            edit_refresh(e);
+            break;
+        case KEY_HOME:
+        case CTRL('A'):
+            e->pos = 0;
+            edit_refresh(e);
+            break;
+        case KEY_END:
+        case CTRL('E'):
+            e->pos = e->len;
+            edit_refresh(e);
+            break;
+        case CTRL('U'): //the line before the cursor
+            edit_delete(e, 0, e->pos);
+            break;
+        case CTRL('K'): //the line after the cursor
+            edit_delete(e, e->pos, e->len);
+            break;
+        case CTRL('W'): //the word before the cursor
+            for (at = e->pos; at > 0 && input.buffer[at - 1] == SPACE_CHAR; at--);
+            for (; at > 0 && input.buffer[at - 1] != SPACE_CHAR; at--);
+            edit_delete(e, at, e->pos);
+            break;
+        case CTRL('L'):
+            printf("\x1b[H\x1b[2J");
+            edit_redisplay(e);
+            break;
+        case CTRL('C'): //the line is dropped, and a new one starts
+            printf("^C\n");
+            e->len = e->pos = 0;
+            e->history_at = history.count + 1;
+            last_status = 130;
+            edit_redisplay(e);
+            break;
+        case KEY_UP:
+        case CTRL('P'):
+            edit_history(e, e->history_at - 1);
+            break;
+        case KEY_DOWN:
+        case CTRL('N'):
+            edit_history(e, e->history_at + 1);
+            break;
+        default:
+            if (key >= ' ' && key < 256) {
+                char c = key;
+                edit_insert(e, &c, 1);
+            }
+    }
+}
+
+//makes room for a line of len bytes & its null terminator in the input buffer
+int edit_reserve(size_t len) {
+    size_t size = input.size == 0 ? 256 : input.size;
+    char *grown;
+
+    while (size < len + 2)
+        size *= 2;
+    if (size == input.size)
+        return SUCCESS;
+    if ((grown = realloc(input.buffer, size)) == NULL)
+        return SYSTEM_FAILURES;
+    input.buffer = grown;
+    input.size = size;
+    return SUCCESS;
+}
+
+//inserts text at the cursor, and moves the cursor after it. typing at the end of the line only writes the text
+void edit_insert(struct editor *e, const char *text, size_t len) {
+    if (edit_reserve(e->len + len) != SUCCESS) {
+        edit_bell();
+        return;
+    }
+    memmove(input.buffer + e->pos + len, input.buffer + e->pos, e->len - e->pos);
+    memcpy(input.buffer + e->pos, text, len);
+    e->len += len;
+    e->pos += len;
+    if (e->pos < e->len) {
+        edit_refresh(e);
+        return;
+    }
+    fflush(stdout);
+    if (write(STDOUT_FILENO, text, len) == (ssize_t) len)
+        e->column += columns(text, len);
+}
+
+//removes input.buffer[from..to), and puts the cursor at from
+void edit_delete(struct editor *e, size_t from, size_t to) {
+    if (from >= to)
+        return;
+    memmove(input.buffer + from, input.buffer + to, e->len - to);
+    e->len -= to - from;
+    e->pos = from;
+    edit_refresh(e);
+}
+
+//replaces the line by entry n of the history, or by the line that was written before the history was shown
+void edit_history(struct editor *e, long n) {
+    char *entry = NULL;
+    size_t len = 0;
+
+    if (n > history.count + 1 || (n <= history.count && (entry = history_entry(n, &len)) == NULL)) {
+        edit_bell();
+        return;
+    }
+    if (e->history_at == history.count + 1) //it's kept until the history is left by ^N / down
+        e->draft = arena_strndup(&line_arena, input.buffer, e->len);
+    if (n == history.count + 1 && e->draft != NULL) { //no draft - the line was empty
+        entry = e->draft;
+        len = strlen(e->draft);
+    }
+    if (edit_reserve(len) != SUCCESS) {
+        edit_bell();
+        return;
+    }
+    if (entry != NULL)
+        memcpy(input.buffer, entry, len);
+    e->len = e->pos = len;
+    e->history_at = n;
+    edit_refresh(e);
+}
+
+//writes the line from its start (where the cursor's column says it is), clears what's left after it,
+//and puts the cursor back at pos. the line must fit in the terminal's width
+void edit_refresh(struct editor *e) {
+    char back[32] = "", forth[32] = "";
+    int after = columns(input.buffer + e->pos, e->len - e->pos);
+    struct iovec pieces[4];
+
+    if (e->column > 0)
+        snprintf(back, sizeof(back), "\x1b[%dD", e->column);
+    if (after > 0)
+        snprintf(forth, sizeof(forth), "\x1b[%dD", after);
+    pieces[0].iov_base = back;
+    pieces[0].iov_len = strlen(back);
+    pieces[1].iov_base = input.buffer;
+    pieces[1].iov_len = e->len;
+    pieces[2].iov_base = "\x1b[K";
+    pieces[2].iov_len = 3;
+    pieces[3].iov_base = forth;
+    pieces[3].iov_len = strlen(forth);
+    fflush(stdout);
+    if (writev(STDOUT_FILENO, pieces, 4) != -1)
+        e->column = columns(input.buffer, e->pos);
+}
+
+//the prompt & the line again, after the screen was cleared or something was printed below the line
+void edit_redisplay(struct editor *e) {
+    printf("%s", edit_prompt);
+    e->column = 0;
+    edit_refresh(e);
+}
+
+void edit_bell() {
+    if (write(STDOUT_FILENO, "\a", 1) == -1)
+        return;
+}
+
+//how many characters of the terminal text[0..len) takes: every byte that doesn't continue a UTF-8 character
+int columns(const char *text, size_t len) {
+    int count = 0;
+    for (size_t i = 0; i < len; i++)
+        count += (text[i] & 0xc0) != 0x80;
+    return count;
+}
+
+/*completes the word before the cursor as far as all its candidates agree. a single candidate is completed with
+ a space after it (or the '/' of a directory). when the candidates can't go further they're listed*/
+void complete_word(struct editor *e) {
+    struct arg_list list = {NULL, 0, 16};
+    size_t start = e->pos, word_len, common;
+    char *word, *slash;
+    int ret, skip = 0;
+
+    while (start > 0 && strchr(" \t;|&(`<>", input.buffer[start - 1]) == NULL)
+        start--;
+    word_len = e->pos - start;
+    word = arena_strndup(&line_arena, input.buffer + start, word_len);
+    list.args = arena_alloc(&line_arena, list.capacity * sizeof(char *));
+    if (word == NULL || list.args == NULL) {
+        edit_bell();
+        return;
+    }
+    list.args[0] = NULL;
+    if (word[0] == '$')
+        ret = complete_variables(word + 1, &list);
+    else if (strchr(word, '/') == NULL && is_command_position(start))
+        ret = complete_commands(word, &list);
+    else {
+        ret = complete_paths(word, &list);
+        skip = (slash = strrchr(word, '/')) != NULL ? slash + 1 - word : 0; //the directory isn't listed
+    }
+    if (ret != SUCCESS || list.count == 0) {
+        edit_bell();
+        return;
+    }
+    qsort(list.args, list.count, sizeof(char *), compare_strings);
+    //the candidates are sorted, so what the first & the last have in common all of them have
+    for (common = 0; list.args[0][common] != 0 && list.args[0][common] == list.args[list.count - 1][common]; common++);
+    if (common == strlen(list.args[0]) && common == strlen(list.args[list.count - 1])) { //one (maybe several times)
+        edit_insert(e, list.args[0] + word_len, common - word_len);
+        if (common == 0 || list.args[0][common - 1] != '/')
+            edit_insert(e, SPACE, 1);
+    } else if (common > word_len)
+        edit_insert(e, list.args[0] + word_len, common - word_len);
+    else
+        list_candidates(e, &list, skip);
+}
+
+//the word at start is a command: the first of the line, after ; | & ( ` or after a keyword
+int is_command_position(size_t start) {
+    const char *keywords[] = {"if", "then", "else", "elif", "do", "while", "until", "time", "{", "!", NULL};
+    size_t end = start, begin;
+
+    while (end > 0 && (input.buffer[end - 1] == SPACE_CHAR || input.buffer[end - 1] == '\t'))
+        end--;
+    if (end == 0 || strchr(";|&(`", input.buffer[end - 1]) != NULL)
+        return 1;
+    for (begin = end; begin > 0 && input.buffer[begin - 1] != SPACE_CHAR && input.buffer[begin - 1] != '\t'; begin--);
+    for (int i = 0; keywords[i] != NULL; i++) {
+        if (strlen(keywords[i]) == end - begin && memcmp(input.buffer + begin, keywords[i], end - begin) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+//the variables that start with prefix, as $NAME
+int complete_variables(char *prefix, struct arg_list *list) {
+    size_t len = strlen(prefix);
+    char *candidate;
+
+    for (int i = 0; i < env_var_capacity; i++) {
+        if (env_vars[i].name == NULL || env_vars[i].kind != ENTRY_VARIABLE || strncmp(env_vars[i].name, prefix, len) != 0)
+            continue;
+        if ((candidate = arena_alloc(&line_arena, strlen(env_vars[i].name) + 2)) == NULL)
+            return SYSTEM_FAILURES;
+        candidate[0] = '$';
+        strcpy(candidate + 1, env_vars[i].name);
+        if (add_arg(list, candidate) != SUCCESS)
+            return SYSTEM_FAILURES;
+    }
+    return SUCCESS;
+}
+
+//the builtins, functions, aliases & executables of $PATH that start with prefix
+int complete_commands(char *prefix, struct arg_list *list) {
+    size_t len = strlen(prefix);
+    char name[NAME_MAX + 1];
+    int node = 0;
+
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        if (strncmp(builtins[i].name, prefix, len) == 0 && add_arg(list, builtins[i].name) != SUCCESS)
+            return SYSTEM_FAILURES;
+    }
+    for (int i = 0; i < env_var_capacity; i++) {
+        if (env_vars[i].name != NULL && env_vars[i].kind != ENTRY_VARIABLE &&
+            strncmp(env_vars[i].name, prefix, len) == 0 && add_arg(list, env_vars[i].name) != SUCCESS)
+            return SYSTEM_FAILURES;
+    }
+    if (len > NAME_MAX || refresh_path_trie() != SUCCESS)
+        return SUCCESS;
+    for (size_t i = 0; i < len && node != -1; i++) {
+        for (node = trie.nodes[node].child; node != -1 && trie.nodes[node].c != prefix[i]; node = trie.nodes[node].sibling);
+    }
+    if (node == -1)
+        return SUCCESS;
+    memcpy(name, prefix, len);
+    return collect_trie(node, name, len, list);
+}
+
+//the names of the trie under node, which is the end of name[0..len)
+int collect_trie(int node, char *name, size_t len, struct arg_list *list) {
+    if (trie.nodes[node].dirs != 0 && add_path(list, name, len) != SUCCESS)
+        return SYSTEM_FAILURES;
+    for (int child = trie.nodes[node].child; child != -1 && len < NAME_MAX; child = trie.nodes[child].sibling) {
+        name[len] = trie.nodes[child].c;
+        if (collect_trie(child, name, len + 1, list) != SUCCESS)
+            return SYSTEM_FAILURES;
+    }
+    return SUCCESS;
+}
+
+//the paths that start with word: the entries of its directory (the listing of the globs) that start with its last part
+int complete_paths(char *word, struct arg_list *list) {
+    char *slash = strrchr(word, '/'), *prefix = slash != NULL ? slash + 1 : word, *dir, *entry, *name, *candidate;
+    size_t dir_len = prefix - word, prefix_len = strlen(prefix), name_len;
+    struct listing *l;
+    struct stat st;
+    int is_dir;
+
+    if ((dir = arena_strndup(&line_arena, word, dir_len)) == NULL || read_listing(dir_len > 0 ? dir : ".", &l) != SUCCESS)
+        return SYSTEM_FAILURES;
+    for (entry = l != NULL ? l->entries : NULL; entry != NULL && entry < l->entries + l->size; entry += name_len + 2) {
+        name = entry + 1;
+        name_len = strlen(name);
+        if ((name[0] == '.' && prefix[0] != '.') || strncmp(name, prefix, prefix_len) != 0)
+            continue;
+        if ((candidate = arena_alloc(&line_arena, dir_len + name_len + 2)) == NULL)
+            return SYSTEM_FAILURES;
+        memcpy(candidate, word, dir_len);
+        memcpy(candidate + dir_len, name, name_len + 1);
+        is_dir = entry[0] == DT_DIR || ((entry[0] == DT_LNK || entry[0] == DT_UNKNOWN) &&
+                                        stat(candidate, &st) == 0 && S_ISDIR(st.st_mode));
+        if (is_dir)
+            strcpy(candidate + dir_len + name_len, "/");
+        if (add_arg(list, candidate) != SUCCESS)
+            return SYSTEM_FAILURES;
+    }
+    return SUCCESS;
+}
+
+//prints the candidates in columns below the line (without their first skip characters), and the line again
+void list_candidates(struct editor *e, struct arg_list *list, int skip) {
+    struct winsize size;
+    int width = 0, per_row, rows, count = 0;
+
+    //sorted, so a name that is a builtin & an executable too is next to itself
+    for (int i = 0; i < list->count; i++) {
+        if (i > 0 && strcmp(list->args[i], list->args[i - 1]) == 0)
+            continue;
+        list->args[count++] = list->args[i];
+        if ((int) strlen(list->args[i]) - skip > width)
+            width = strlen(list->args[i]) - skip;
+    }
+    printf("\n");
+    if (count > COMPLETION_LIST_MAX) {
+        printf("%d possibilities\n", count);
+        edit_redisplay(e);
+        return;
+    }
+    width += 2;
+    per_row = ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > width ? size.ws_col / width : 1;
+    rows = (count + per_row - 1) / per_row;
+    for (int row = 0; row < rows; row++) { //down the columns, like ls
+        for (int i = row; i < count; i += rows)
+            printf("%-*s", i + rows < count ? width : 0, list->args[i] + skip);
+        printf("\n");
+    }
+    edit_redisplay(e);
+}
+
+/*brings the trie up to date with $PATH: a directory is read again only if its mtime changed since it was read
+ (a file was added, removed or renamed in it), so a completion costs a stat() for every directory of $PATH.
+ a new $PATH builds the trie again. the trie is built by the first completion of a command*/
+int refresh_path_trie() {
+    char *path = getenv("PATH"), *dir;
+    struct stat st;
+
+    if (path == NULL)
+        path = "";
+    if (trie.path == NULL || strcmp(trie.path, path) != 0) {
+        free_path_trie();
+        if ((trie.path = strdup(path)) == NULL || (trie.dir_text = strdup(path)) == NULL ||
+            add_trie_node(0) == -1)
+            return SYSTEM_FAILURES;
+        for (dir = strtok(trie.dir_text, ":"); dir != NULL && trie.dir_count < PATH_TRIE_DIRS; dir = strtok(NULL, ":"))
+            trie.dirs[trie.dir_count++].path = dir;
+    }
+    for (int i = 0; i < trie.dir_count; i++) {
+        struct trie_dir *d = &trie.dirs[i];
+        if (stat(d->path, &st) == 0 && d->read && d->mtime.tv_sec == st.st_mtim.tv_sec &&
+            d->mtime.tv_nsec == st.st_mtim.tv_nsec)
+            continue;
+        if (d->read) { //its names are taken out of the trie, and the ones that are still there are added again
+            for (int j = 0; j < trie.count; j++)
+                trie.nodes[j].dirs &= ~(1ULL << i);
+        }
+        d->read = 0;
+        if (stat(d->path, &st) == 0 && read_path_dir(d->path, 1ULL << i) == SUCCESS) {
+            d->read = 1;
+            d->mtime = st.st_mtim;
+        }
+    }
+    return SUCCESS;
+}
+
+//adds the executables of a directory of $PATH to the trie, with the directory's bit
+int read_path_dir(char *path, unsigned long long bit) {
+    struct dirent64_record *d;
+    struct stat st;
+    long n;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC), node;
+
+    if (fd == -1)
+        return INVALID_INPUT;
+    if (glob_buffer == NULL && (glob_buffer = malloc(GLOB_BUFFER_SIZE)) == NULL) {
+        close(fd);
+        return SYSTEM_FAILURES;
+    }
+    while ((n = syscall(SYS_getdents64, fd, glob_buffer, GLOB_BUFFER_SIZE)) > 0) {
+        for (long offset = 0; offset < n; offset += d->d_reclen) {
+            d = (struct dirent64_record *) (glob_buffer + offset);
+            if (d->d_type == DT_DIR || d->d_name[0] == '.' ||
+                fstatat(fd, d->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode) || (st.st_mode & 0111) == 0)
+                continue;
+            node = 0;
+            for (char *c = d->d_name; *c != 0 && node != -1; c++) {
+                int child = trie.nodes[node].child;
+                while (child != -1 && trie.nodes[child].c != *c)
+                    child = trie.nodes[child].sibling;
+                node = child != -1 ? child : add_trie_node(node);
+                if (node != -1)
+                    trie.nodes[node].c = *c;
+            }
+            if (node == -1) {
+                close(fd);
+                return SYSTEM_FAILURES;
+            }
+            trie.nodes[node].dirs |= bit;
+        }
+    }
+    close(fd);
+    return SUCCESS;
+}
+
+//a new child of parent (the root if the trie is empty), first among its children. -1 if there's no memory
+int add_trie_node(int parent) {
+    if (trie.count == trie.capacity) {
+        int capacity = trie.capacity == 0 ? 1024 : trie.capacity * 2;
+        struct trie_node *grown = realloc(trie.nodes, capacity * sizeof(struct trie_node));
+        if (grown == NULL)
+            return -1;
+        trie.nodes = grown;
+        trie.capacity = capacity;
+    }
+    trie.nodes[trie.count] = (struct trie_node) {-1, -1, 0, 0};
+    if (trie.count > 0) {
+        trie.nodes[trie.count].sibling = trie.nodes[parent].child;
+        trie.nodes[parent].child = trie.count;
+    }
+    return trie.count++;
+}
+
+void free_path_trie() {
+    free(trie.nodes);
+    free(trie.path);
+    free(trie.dir_text);
+    memset(&trie, 0, sizeof(trie));
+}
+
+/********************************************* PARALLEL ****************************************************************/
+//parallel [-j N] [command...]: runs the commands (each one a quoted command line) at the same time, in N slots -
+//the number of cores the shell may run on by default. a slot is a child of the shell that runs one command line
+//like the shell does. without commands, they are read from stdin, one per line.
+//the output of each command goes to memory files, and is written at once when the command finishes,
+//so the lines of different commands don't interleave. last_status is the number of commands that failed
+
+int parallel_builtin(char **args, int argc) {
+    int slots = count_cores(), first = 1, count, next = 0, running = 0, failed = 0, status;
+    char **commands = args, *line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    pid_t pid;
+    struct rusage usage;
+    struct process *proc;
+
+    if (first < argc && strncmp(args[first], "-j", 2) == 0) {
+        char *number = args[first][2] != '\0' ? args[first] + 2 : (first + 1 < argc ? args[++first] : "");
+        slots = atoi(number);
+        first++;
+        if (slots < 1) {
+            fprintf(stderr, "parallel: -j needs a number of slots\n");
+            last_status = 2;
+            return SUCCESS;
+        }
+    }
+    commands += first;
+    count = argc - first;
+    if (count == 0) { //the commands come from stdin
+        int capacity = 0;
+        commands = NULL;
+        while ((len = getline(&line, &line_size, stdin)) > 0) {
+            if (line[len - 1] == '\n')
+                line[--len] = '\0';
+            if (count == capacity) {
+                capacity = capacity == 0 ? 64 : capacity * 2;
+                char **grown = arena_alloc(&line_arena, capacity * sizeof(char *));
+                if (grown == NULL) {
+                    free(line);
+                    return SYSTEM_FAILURES;
+                }
+                if (count > 0)
+                    memcpy(grown, commands, count * sizeof(char *));
+                commands = grown;
+            }
+            if ((commands[count++] = arena_strdup(&line_arena, line)) == NULL) {
+                free(line);
+                return SYSTEM_FAILURES;
+            }
+        }
+        free(line);
+    }
+
+    if (slots > count)
+        slots = count;
+    struct parallel_slot *slot = arena_alloc(&line_arena, (slots + 1) * sizeof(struct parallel_slot));
+    if (slot == NULL)
+        return SYSTEM_FAILURES;
+    memset(slot, 0, (slots + 1) * sizeof(struct parallel_slot));
+
+    while (next < count || running > 0) {
+        for (int i = 0; i < slots && next < count; i++) {
+            if (slot[i].pid != 0)
+                continue;
+            if (start_parallel_command(&slot[i], commands[next++]) != SUCCESS) {
+                failed++;
+                continue;
+            }
+            running++;
+        }
+        if (running == 0)
+            continue;
+        pid = wait4(-1, &status, 0, &usage); //the shell's background jobs may finish here too
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("waitpid() failed");
+            break;
+        }
+        int i = 0;
+        for (; i < slots && slot[i].pid != pid; i++);
+        if (i == slots) { //not a slot
+            if ((proc = find_process(pid)) != NULL)
+                update_process(proc, status, &usage);
+            continue;
+        }
+        fflush(stdout);
+        write_job_output(slot[i].out_fd, STDOUT_FILENO);
+        write_job_output(slot[i].err_fd, STDERR_FILENO);
+        close(slot[i].out_fd);
+        close(slot[i].err_fd);
+        slot[i].pid = 0;
+        running--;
+        failed += exit_code(status) != 0;
+    }
+    last_status = failed > 255 ? 255 : failed;
+    return SUCCESS;
+}
+
+//forks a child shell that runs the command line with its output going to two new memory files
+int start_parallel_command(struct parallel_slot *slot, char *command) {
+    slot->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+    slot->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+    if (slot->out_fd == -1 || slot->err_fd == -1) {
+        perror("memfd_create");
+        if (slot->out_fd != -1)
+            close(slot->out_fd);
+        if (slot->err_fd != -1)
+            close(slot->err_fd);
+        return INVALID_INPUT;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    make_fork(&slot->pid);
+    if (slot->pid < 0) {
+        perror("forking failed");
+        close(slot->out_fd);
+        close(slot->err_fd);
+        slot->pid = 0;
+        return INVALID_INPUT;
+    }
+    if (slot->pid == 0) { //child's process: a shell of its own, without the jobs of its father
+        dup2(slot->out_fd, STDOUT_FILENO);
+        dup2(slot->err_fd, STDERR_FILENO);
+        stop_zygote(); //its commands would be children of the father, which this shell can't wait for
+        free_jobs();
+        init_jobs();
+        interactive = 0;
+        int ret = split_multiple_commands(command, 0);
+        fflush(stdout);
+        _exit(ret == SYSTEM_FAILURES ? 1 : last_status);
+    }
+    return SUCCESS;
+}
+
+//copies the whole memory file to the fd. sendfile() copies inside the kernel, write() is used if it can't
+void write_job_output(int from, int to) {
+    off_t offset = 0, size = lseek(from, 0, SEEK_END);
+    ssize_t n;
+    char buffer[8192];
+
+    while (offset < size) {
+        n = sendfile(to, from, &offset, size - offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n > 0)
+            continue;
+        if (n == -1 && (errno == EINVAL || errno == ENOSYS)) { //this kind of fd isn't supported
+            while (offset < size && (n = pread(from, buffer, sizeof(buffer), offset)) > 0) {
+                if (write(to, buffer, n) != n)
+                    return;
+                offset += n;
+            }
+        }
+        return;
+    }
+}
+
+//the cores the shell may run on (its affinity), which may be less than all the machine's cores
+int count_cores() {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+        return CPU_COUNT(&set);
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+/********************************************* FORK SERVER ****************************************************************/
+
+/*EX1_LAUNCH=zygote: the fork server is forked when the shell starts, while its memory is still small, and launches
+ every command for it. the shell sends argv[], the environment & the fds of stdin, stdout & stderr (SCM_RIGHTS)
+ over a socket, so the cost of a launch doesn't grow with the shell's heap. the server creates the command by
+ clone(CLONE_PARENT): the command is the shell's child & not the server's, so waitpid(), rusage & the jobs
+ work as they do for the other engines*/
+int start_zygote() {
+    int sv[2];
+    struct sigaction ignore, saved[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("socketpair");
+        return INVALID_INPUT;
+    }
+    int size = ZYGOTE_MESSAGE_SIZE; //a request is one message, so it must fit in the socket's buffer
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    fflush(stdout);
+    fflush(stderr);
+    make_fork(&pid);
+    if (pid < 0) {
+        perror("forking failed");
+        close(sv[0]);
+        close(sv[1]);
+        return INVALID_INPUT;
+    }
+    if (pid == 0) { //the server: ^C & ^Z reach it too, as it's in the shell's process group
+        close(sv[0]);
+        if (child_fd != -1)
+            close(child_fd);
+        memset(&ignore, 0, sizeof(ignore));
+        ignore.sa_handler = SIG_IGN;
+        sigaction(SIGINT, &ignore, &saved[0]); //the commands get back what the shell had
+        sigaction(SIGQUIT, &ignore, &saved[1]);
+        signal(SIGTSTP, SIG_IGN);
+        zygote_loop(sv[1], saved);
+    }
+    close(sv[1]);
+    zygote_fd = sv[0];
+    return SUCCESS;
+}
+
+//the shell doesn't use the server anymore (it failed, or this is a child shell): commands are spawned from now on.
+//the server exits when its socket is closed
+void stop_zygote() {
+    if (zygote_fd != -1)
+        close(zygote_fd);
+    zygote_fd = -1;
+    if (launch_mode == LAUNCH_ZYGOTE)
+        launch_mode = LAUNCH_SPAWN;
+}
+
+/*sends the launch request & waits for the answer. the request is built in the line's arena.
+ returns like spawn_command(): the exec errors are reported here, and the launch is spawned if the server can't do it*/
+int zygote_command(char *path, char **args, int in_fd, int out_fd, int err_fd, pid_t *p) {
+    struct zygote_request request = {0};
+    struct zygote_reply reply;
+    int fds[3] = {in_fd != -1 ? in_fd : STDIN_FILENO, out_fd != -1 ? out_fd : STDOUT_FILENO,
+                  err_fd != -1 ? err_fd : STDERR_FILENO};
+    union { //aligned for the cmsghdr
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr header;
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    size_t size = sizeof(request) + (path != NULL ? strlen(path) + 1 : 0);
+    ssize_t n;
+    char *message, *end;
+
+    for (; args[request.argc] != NULL; request.argc++)
+        size += strlen(args[request.argc]) + 1;
+    for (; environ[request.envc] != NULL; request.envc++)
+        size += strlen(environ[request.envc]) + 1;
+    if (size > ZYGOTE_MESSAGE_SIZE || (message = arena_alloc(&line_arena, size)) == NULL)
+        return spawn_command(path, args, in_fd, out_fd, err_fd, p);
+    request.has_path = path != NULL;
+    request.has_options = launch_options != NULL;
+    if (launch_options != NULL)
+        request.options = (*launch_options);
+    memcpy(message, &request, sizeof(request));
+    end = message + sizeof(request);
+    if (path != NULL)
+        end = stpcpy(end, path) + 1;
+    for (int i = 0; i < request.argc; i++)
+        end = stpcpy(end, args[i]) + 1;
+    for (int i = 0; i < request.envc; i++)
+        end = stpcpy(end, environ[i]) + 1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = message;
+    iov.iov_len = size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    while ((n = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+    if (n == -1 && errno == EMSGSIZE) //bigger than the socket's buffer, only this launch is spawned
+        return spawn_command(path, args, in_fd, out_fd, err_fd, p);
+    if (n == (ssize_t) size)
+        while ((n = recv(zygote_fd, &reply, sizeof(reply), 0)) == -1 && errno == EINTR);
+    if (n != sizeof(reply)) { //the server is gone
+        fprintf(stderr, "the fork server failed, commands are spawned\n");
+        stop_zygote();
+        return spawn_command(path, args, in_fd, out_fd, err_fd, p);
+    }
+
+    if (reply.pid == -1) //clone() failed in the server
+        return spawn_command(path, args, in_fd, out_fd, err_fd, p);
+    if (reply.err != 0) { //the child couldn't exec & exited. it's the shell's child, so it's collected here
+        waitpid(reply.pid, NULL, 0);
+        exec_error(err_fd, args[0], path != NULL ? "execv" : "execvp", reply.err); //illegal command
+        last_status = 127;
+        return INVALID_INPUT;
+    }
+    (*p) = reply.pid;
+    return SUCCESS;
+}
+
+//the server's loop: a request at a time, until the shell closes the socket. saved is what SIGINT & SIGQUIT were
+void zygote_loop(int sock, struct sigaction *saved) {
+    char *buffer = malloc(ZYGOTE_MESSAGE_SIZE), *strings, *path;
+    union {
+        char buffer[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr header;
+    } control;
+    struct zygote_request request;
+    struct zygote_reply reply;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char **vector;
+    int fds[3];
+    ssize_t n;
+
+    if (buffer == NULL)
+        _exit(1);
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buffer;
+        iov.iov_len = ZYGOTE_MESSAGE_SIZE;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+        if (n <= 0) //the shell exited
+            _exit(0);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+            reply.pid = -1;
+            reply.err = EINVAL;
+            send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+            continue;
+        }
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        memcpy(&request, buffer, sizeof(request));
+        strings = buffer + sizeof(request);
+        path = NULL;
+        if (request.has_path) {
+            path = strings;
+            strings += strlen(strings) + 1;
+        }
+        //argv[] & envp[] point into the message, one array holds both
+        vector = malloc((request.argc + request.envc + 2) * sizeof(char *));
+        if (vector == NULL) {
+            reply.pid = -1;
+            reply.err = ENOMEM;
+        } else {
+            for (int i = 0; i < request.argc + request.envc + 2; i++) {
+                if (i == request.argc || i == request.argc + request.envc + 1) {
+                    vector[i] = NULL;
+                    continue;
+                }
+                vector[i] = strings;
+                strings += strlen(strings) + 1;
+            }
+            reply.pid = zygote_launch(path, vector, vector + request.argc + 1, fds, saved,
+                                      request.has_options ? &request.options : NULL, &reply.err);
+            free(vector);
+        }
+        for (int i = 0; i < 3; i++)
+            close(fds[i]);
+        send(sock, &reply, sizeof(reply), MSG_NOSIGNAL);
+    }
+}
+
+/*creates the command as a sibling of the server (a child of the shell) & executes it. doesn't return before
+ the exec happened or failed: the child writes its errno to a close-on-exec pipe, which is closed empty by a good exec.
+ returns the pid, or -1 with the errno in err*/
+pid_t zygote_launch(char *path, char **argv, char **envp, int *fds, struct sigaction *saved,
+                    struct launch_options *options, int *err) {
+    int errpipe[2];
+    pid_t pid;
+    ssize_t n;
+
+    (*err) = 0;
+    if (pipe2(errpipe, O_CLOEXEC) == -1) {
+        (*err) = errno;
+        return -1;
+    }
+    pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0); //a fork() whose parent is the shell
+    if (pid == 0) { //the command: the signals are returned to what a spawned command gets
+        sigaction(SIGINT, &saved[0], NULL);
+        sigaction(SIGQUIT, &saved[1], NULL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        set_sigchld_blocked(0);
+        for (int i = 0; i < 3; i++) //the received fds are above 2 & close-on-exec, only the copies are left
+            dup2(fds[i], i);
+        if (options != NULL)
+            apply_launch_options(options);
+        environ = envp; //execvp() searches the PATH of the environment
+        if (path != NULL)
+            execv(path, argv);
+        else
+            execvp(argv[0], argv);
+        n = write(errpipe[1], &errno, sizeof(int));
+        _exit(127);
+    }
+    if (pid == -1)
+        (*err) = errno;
+    close(errpipe[1]);
+    while (pid != -1 && (n = read(errpipe[0], err, sizeof(int))) == -1 && errno == EINTR);
+    close(errpipe[0]);
+    return pid;
+}
+
+/********************************************* LAUNCH OPTIONS ****************************************************************/
+//nice, ionice, taskset & prlimit before a command (in their util-linux syntax) don't run programs of their own:
+//the shell reads their options, and the command's process applies them between fork & exec, with the limits of ulimit.
+//posix_spawn() can't do that, so such a command is forked (or launched by the fork server, which applies them too)
+
+int is_launch_prefix(char *name) {
+    switch (name[0]) { //most commands are rejected by their first character
+        case 'n':
+            return strcmp(name, "nice") == 0;
+        case 'i':
+            return strcmp(name, "ionice") == 0;
+        case 't':
+            return strcmp(name, "taskset") == 0;
+        case 'p':
+            return strcmp(name, "prlimit") == 0;
+        default:
+            return 0;
+    }
+}
+
+/*the options of a command that is launched now: the limits of ulimit, changed by the prefixes before the command.
+ cpu >= 0 pins a stage of PIPE_SPREAD to that core, unless taskset chose the cores. sets launch_options & returns
+ the command after the prefixes, or NULL if a prefix is wrong (the message was printed)*/
+char **set_launch_options(char **args, struct launch_options *o, int cpu) {
+    char *prefix = args[0];
+    int n;
+
+    (*o) = shell_options;
+    while (args[0] != NULL && is_launch_prefix(args[0])) {
+        prefix = args[0];
+        if (prefix[0] == 'n')
+            n = parse_nice(args, o);
+        else if (prefix[0] == 'i')
+            n = parse_ionice(args, o);
+        else if (prefix[0] == 't')
+            n = parse_taskset(args, o);
+        else
+            n = parse_prlimit(args, o);
+        if (n == -1)
+            return NULL;
+        args += n;
+    }
+    if (args[0] == NULL) {
+        fprintf(stderr, "%s: a command is missing\n", prefix);
+        return NULL;
+    }
+    if (cpu >= 0 && !o->cpus_set) {
+        CPU_ZERO(&o->cpus);
+        CPU_SET(cpu, &o->cpus);
+        o->cpus_set = 1;
+    }
+    if (o->cpus_set || o->nice != 0 || o->io_class != 0 || o->limits_set != 0)
+        launch_options = o;
+    return args;
+}
+
+//nice [-n N | -N] - adds N (10 by default) to the niceness. returns how many words the prefix is, -1 if it's wrong
+int parse_nice(char **args, struct launch_options *o) {
+    char *value = "10", *end;
+    int n = 1;
+    long adjustment;
+
+    if (args[1] != NULL && strcmp(args[1], "-n") == 0) {
+        value = args[2];
+        n = 3;
+    } else if (args[1] != NULL && args[1][0] == '-' && args[1][1] != 0) { //nice -5, nice --5
+        value = args[1] + 1;
+        n = 2;
+    }
+    if (value == NULL || (adjustment = strtol(value, &end, 10), end == value || *end != 0)) {
+        fprintf(stderr, "nice: usage: nice [-n N] command...\n");
+        return -1;
+    }
+    o->nice += (int) adjustment;
+    return n;
+}
+
+//ionice [-c class] [-n level] [-t] - the class is 1/realtime, 2/best-effort (the default) or 3/idle, the level 0-7
+int parse_ionice(char **args, struct launch_options *o) {
+    static char *classes[] = {"none", "realtime", "best-effort", "idle"};
+    int n = 1, class = 2, level = 4;
+    char *end;
+
+    while (args[n] != NULL && args[n][0] == '-') {
+        if (strcmp(args[n], "-t") == 0) { //a failure is only printed anyway
+            n++;
+            continue;
+        }
+        if (args[n + 1] == NULL || (strcmp(args[n], "-c") != 0 && strcmp(args[n], "-n") != 0))
+            break;
+        if (args[n][1] == 'n') {
+            level = (int) strtol(args[n + 1], &end, 10);
+            if (end == args[n + 1] || *end != 0 || level < 0 || level > 7)
+                break;
+        } else {
+            class = (int) strtol(args[n + 1], &end, 10);
+            if (end == args[n + 1] || *end != 0)
+                for (class = 0; class < 4 && strcmp(args[n + 1], classes[class]) != 0; class++);
+            if (class < 0 || class > 3)
+                break;
+        }
+        n += 2;
+    }
+    if (args[n] != NULL && args[n][0] == '-') {
+        fprintf(stderr, "ionice: usage: ionice [-c 1|2|3] [-n 0-7] command...\n");
+        return -1;
+    }
+    o->io_class = class; //class 0 (none) isn't applied
+    o->io_level = class == 3 ? 0 : level;
+    return n;
+}
+
+//taskset -c list | taskset mask - a list is like 0,2-4 & a mask is hex (0x5 - cores 0 & 2)
+int parse_taskset(char **args, struct launch_options *o) {
+    char *mask = args[1];
+    int n = 2, digit;
+
+    if (mask != NULL && strcmp(mask, "-c") == 0) {
+        if (args[2] != NULL && parse_cpu_list(args[2], &o->cpus) == SUCCESS) {
+            o->cpus_set = 1;
+            return 3;
+        }
+        mask = NULL;
+    }
+    if (mask != NULL && strncmp(mask, "0x", 2) == 0)
+        mask += 2;
+    if (mask != NULL && *mask != 0 && strspn(mask, "0123456789abcdefABCDEF") == strlen(mask)) {
+        CPU_ZERO(&o->cpus);
+        for (size_t i = strlen(mask), cpu = 0; i > 0 && cpu < CPU_SETSIZE; i--, cpu += 4) { //from the lowest digit
+            digit = mask[i - 1] <= '9' ? mask[i - 1] - '0' : (mask[i - 1] | 0x20) - 'a' + 10;
+            for (int bit = 0; bit < 4; bit++)
+                if (digit & (1 << bit))
+                    CPU_SET(cpu + bit, &o->cpus);
+        }
+        o->cpus_set = CPU_COUNT(&o->cpus) > 0;
+        if (o->cpus_set)
+            return n;
+    }
+    fprintf(stderr, "taskset: usage: taskset -c <list> | <mask> command...\n");
+    return -1;
+}
+
+//a list of cores: numbers & ranges, separated by commas (0,2-4)
+int parse_cpu_list(char *list, cpu_set_t *set) {
+    char *end;
+    long first, last;
+
+    CPU_ZERO(set);
+    while (*list != 0) {
+        first = last = strtol(list, &end, 10);
+        if (end == list)
+            return INVALID_INPUT;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list)
+                return INVALID_INPUT;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE || (*end != ',' && *end != 0))
+            return INVALID_INPUT;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        list = *end == ',' ? end + 1 : end;
+    }
+    return CPU_COUNT(set) > 0 ? SUCCESS : INVALID_INPUT;
+}
+
+//prlimit --<name>=<soft>[:<hard>]... - the names are those of limit_names (nofile, cpu, as...), in bytes or seconds.
+//a single value sets both
+int parse_prlimit(char **args, struct launch_options *o) {
+    struct limit_name *l;
+    struct rlimit limit;
+    char *value, *colon;
+    int n = 1, ok;
+
+    for (; args[n] != NULL && strncmp(args[n], "--", 2) == 0; n++) {
+        value = strchr(args[n], '=');
+        l = value != NULL ? find_limit(0, args[n] + 2, value - args[n] - 2) : NULL;
+        if (l == NULL)
+            break;
+        value++;
+        get_limit(o, l->resource, &limit);
+        if ((colon = strchr(value, ':')) != NULL) { //an empty side keeps that limit
+            (*colon) = 0;
+            ok = (*value == 0 || parse_limit_value(value, 1, &limit.rlim_cur) == SUCCESS) &&
+                 (colon[1] == 0 || parse_limit_value(colon + 1, 1, &limit.rlim_max) == SUCCESS);
+            (*colon) = ':';
+        } else {
+            ok = parse_limit_value(value, 1, &limit.rlim_cur) == SUCCESS;
+            limit.rlim_max = limit.rlim_cur;
+        }
+        if (!ok || limit.rlim_cur > limit.rlim_max)
+            break;
+        o->limits[l->resource] = limit;
+        o->limits_set |= 1 << l->resource;
+    }
+    if (args[n] != NULL && strncmp(args[n], "--", 2) == 0) {
+        fprintf(stderr, "prlimit: %s: expected --<resource>=<soft>[:<hard>], with soft <= hard\n", args[n]);
+        return -1;
+    }
+    return n;
+}
+
+//the resource of ulimit -<option> (when option isn't 0), or of prlimit --<name>=. NULL if there is none
+struct limit_name *find_limit(char option, char *name, size_t len) {
+    for (struct limit_name *l = limit_names; l->name != NULL; l++) {
+        if (option != 0 ? l->option == option : strlen(l->name) == len && strncmp(l->name, name, len) == 0)
+            return l;
+    }
+    return NULL;
+}
+
+//a number of units, or 'unlimited'
+int parse_limit_value(char *value, int unit, rlim_t *limit) {
+    char *end;
+    unsigned long long n;
+
+    if (strcmp(value, "unlimited") == 0) {
+        (*limit) = RLIM_INFINITY;
+        return SUCCESS;
+    }
+    if (*value < '0' || *value > '9' || (n = strtoull(value, &end, 10), *end != 0) || n > RLIM_INFINITY / unit)
+        return INVALID_INPUT;
+    (*limit) = (rlim_t) n * unit;
+    return SUCCESS;
+}
+
+//the limit the options give a command: their own, or the one the shell has
+void get_limit(struct launch_options *o, int resource, struct rlimit *limit) {
+    if (o->limits_set & (1 << resource))
+        (*limit) = o->limits[resource];
+    else
+        getrlimit(resource, limit);
+}
+
+//after a launch: only the limits of ulimit apply to the next one
+void reset_launch_options() {
+    launch_options = shell_options.limits_set != 0 ? &shell_options : NULL;
+}
+
+//runs in the new process, before exec. a failure (like a realtime I/O class without privileges) is only printed
+void apply_launch_options(struct launch_options *o) {
+    if (o->cpus_set && sched_setaffinity(0, sizeof(o->cpus), &o->cpus) == -1)
+        perror("taskset");
+    errno = 0;
+    if (o->nice != 0 && nice(o->nice) == -1 && errno != 0)
+        perror("nice");
+    if (o->io_class != 0 &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, o->io_class << IOPRIO_CLASS_SHIFT | o->io_level) == -1)
+        perror("ionice");
+    for (int r = 0; r < RLIM_NLIMITS; r++) {
+        if ((o->limits_set & (1 << r)) && setrlimit(r, &o->limits[r]) == -1)
+            perror("setrlimit");
+    }
+}
+
+//the n-th core in the set (n < CPU_COUNT(set))
+int nth_cpu(cpu_set_t *set, int n) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set) && n-- == 0)
+            return cpu;
+    }
+    return 0;
+}
+
+/*the ulimit builtin - the limits of the commands the shell launches from now on (the shell itself isn't limited):
+ ulimit [-S|-H] -a                   - prints all the limits (the soft ones, or the hard ones with -H)
+ ulimit [-S|-H] -<option> [limit]... - prints or sets a limit: -c -d -f -l -n -s -t -u -v, like bash's (-Sn 64).
+                                      the limit is a number or 'unlimited'. without -S/-H both are set
+ ulimit [limit]                      - the same for -f
+ a hard limit can't be raised above the shell's own. last_status is 1 if an option or a limit is wrong*/
+int ulimit_builtin(char **args, int argc) {
+    struct limit_name *l;
+    struct rlimit limit, shell;
+    int which = 0; //1 - only the soft limit, 2 - only the hard one
+    char *value, *option;
+
+    last_status = 0;
+    if (argc == 1)
+        print_limit(find_limit('f', NULL, 0), 0, 0);
+    for (int i = 1; i < argc; i++) {
+        l = NULL;
+        value = NULL;
+        if (args[i][0] != '-') { //ulimit <limit>
+            l = find_limit('f', NULL, 0);
+            value = args[i];
+        }
+        for (option = args[i] + 1; args[i][0] == '-' && *option != 0 && l == NULL; option++) {
+            if (*option == 'S' || *option == 'H') //-S, -H & -a may come with the resource (-Sn)
+                which = *option == 'S' ? 1 : 2;
+            else if (*option == 'a')
+                for (struct limit_name *all = limit_names; all->name != NULL; all++)
+                    print_limit(all, which == 2, 1);
+            else if (option[1] != 0 || (l = find_limit(*option, NULL, 0)) == NULL)
+                break;
+        }
+        if (args[i][0] == '-' && (args[i][1] == 0 || (l == NULL && *option != 0))) {
+            fprintf(stderr, "ulimit: %s: invalid option\n", args[i]);
+            last_status = 1;
+            return SUCCESS;
+        }
+        if (l == NULL) //only -S/-H/-a
+            continue;
+        if (value == NULL && i + 1 < argc && args[i + 1][0] != '-')
+            value = args[++i];
+        if (value == NULL) {
+            print_limit(l, which == 2, 0);
+            continue;
+        }
+        get_limit(&shell_options, l->resource, &limit);
+        getrlimit(l->resource, &shell);
+        if (parse_limit_value(value, l->unit, which == 2 ? &limit.rlim_max : &limit.rlim_cur) != SUCCESS) {
+            fprintf(stderr, "ulimit: %s: invalid limit\n", value);
+            last_status = 1;
+            return SUCCESS;
+        }
+        if (which == 0)
+            limit.rlim_max = limit.rlim_cur;
+        //checked here, so every command doesn't fail to set it
+        if (limit.rlim_cur > limit.rlim_max || limit.rlim_max > shell.rlim_max) {
+            fprintf(stderr, "ulimit: %s: the limit is above the hard limit\n", l->description);
+            last_status = 1;
+            return SUCCESS;
+        }
+        shell_options.limits[l->resource] = limit;
+        shell_options.limits_set |= 1 << l->resource;
+        reset_launch_options();
+    }
+    return SUCCESS;
+}
+
+//prints the limit the commands get, with its description & option for ulimit -a
+void print_limit(struct limit_name *l, int hard, int described) {
+    struct rlimit limit;
+    rlim_t value;
+
+    get_limit(&shell_options, l->resource, &limit);
+    value = hard ? limit.rlim_max : limit.rlim_cur;
+    if (described)
+        printf("%-26s(-%c) ", l->description, l->option);
+    if (value == RLIM_INFINITY)
+        printf("unlimited\n");
+    else
+        printf("%llu\n", (unsigned long long) value / l->unit);
+}
+
+/********************************************* PIPELINE METER ****************************************************************/
+//PIPE_METER=1 puts the shell between the stages of a foreground pipeline. every stage writes to its own pipe,
+//and the shell moves the data into the next stage's pipe by splice(), which only moves page references
+//between the pipes (no copy). on the way it measures each stage's output: bytes, the time the data waited
+//for the next stage (its pipe was full - the next stage is slower), and how full the next stage's pipe was.
+//PIPE_SIZE=<bytes> sets the capacity of the pipes (F_SETPIPE_SZ), metered or not
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void set_pipe_size(int fd, int size) {
+    if (fcntl(fd, F_SETPIPE_SZ, size) == -1)
+        fprintf(stderr, "PIPE_SIZE=%d: %s\n", size, strerror(errno));
+}
+
+//the stage writes to pipefd[1]. a second pipe is made for the next stage, which gets its read end in pipefd[0].
+//the shell's ends are non-blocking (nobody else has them), so one poll() loop serves all the links
+int open_pipe_link(struct pipe_link *link, int pipefd[2], int pipe_size) {
+    int next[2];
+    if (pipe2(next, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return SYSTEM_FAILURES;
+    }
+    if (pipe_size > 0)
+        set_pipe_size(next[1], pipe_size);
+    link->from = pipefd[0];
+    link->to = next[1];
+    fcntl(link->from, F_SETFL, O_NONBLOCK);
+    fcntl(link->to, F_SETFL, O_NONBLOCK);
+    pipefd[0] = next[0];
+    return SUCCESS;
+}
+
+//moves the data of all the links until every stage closed its output (or the next stage exited).
+//a link waits for its stage's output, or - while the next stage's pipe is full - for room in it.
+//the job's processes are reaped on the way (the last pollfd is child_fd): when a stage stops (^Z) the rest
+//of the forwarding goes to a process of its own, and the job is left to wait_for_job() like any stopped job
+void forward_pipeline(struct pipe_link *links, int count, struct job *job) {
+    struct pollfd *fds = arena_alloc(&line_arena, (count + 1) * sizeof(struct pollfd));
+    struct sigaction ignore, saved;
+    struct signalfd_siginfo info;
+    int open = 0, queued, ready;
+    double now;
+    ssize_t n;
+
+    for (int i = 0; i < count; i++)
+        open += links[i].from != -1;
+    if (fds == NULL)
+        return;
+    //a stage that exited is seen as EPIPE. the stages were launched with the default, the shell's own is put back
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+    while (open > 0) {
+        for (int i = 0; i < count; i++) {
+            fds[i].fd = links[i].from == -1 ? -1 : (links[i].waiting ? links[i].to : links[i].from);
+            fds[i].events = links[i].waiting ? POLLOUT : POLLIN;
+            fds[i].revents = 0;
+        }
+        fds[count].fd = job != NULL ? child_fd : -1;
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        //without a signalfd the job is checked every 100ms
+        ready = poll(fds, count + 1, job != NULL && child_fd == -1 ? 100 : -1);
+        if (ready == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (job != NULL && (ready <= 0 || fds[count].revents != 0)) { //a timeout, a signal or a SIGCHLD
+            if (fds[count].revents != 0)
+                read(child_fd, &info, sizeof(info));
+            reap_children();
+            if (job->stopped > 0) {
+                hand_off_forwarding(links, count);
+                break;
+            }
+        }
+        if (ready <= 0)
+            continue;
+        now = now_seconds();
+        for (int i = 0; i < count; i++) {
+            struct pipe_link *link = &links[i];
+            if (fds[i].fd == -1 || fds[i].revents == 0)
+                continue;
+            if (link->waiting) { //the next stage read (or exited)
+                link->stall += now - link->stall_start;
+                link->waiting = 0;
+            }
+            n = splice(link->from, NULL, link->to, NULL, METER_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                link->bytes += n;
+                if (ioctl(link->to, FIONREAD, &queued) == 0) {
+                    link->queued_sum += queued;
+                    link->samples++;
+                    if (queued > link->queued_max)
+                        link->queued_max = queued;
+                }
+                continue;
+            }
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1 && errno == EAGAIN) {
+                if (fds[i].events == POLLIN) { //there is data, so the next stage's pipe is full
+                    link->waiting = 1;
+                    link->stall_start = now;
+                }
+                continue;
+            }
+            //end of the stage's output, or the next stage exited (EPIPE)
+            link->end = now;
+            close(link->from);
+            close(link->to);
+            link->from = link->to = -1;
+            open--;
+        }
+    }
+    for (int i = 0; i < count; i++) { //poll() failed, or the links were handed off
+        if (links[i].from != -1) {
+            close(links[i].from);
+            close(links[i].to);
+            links[i].end = now_seconds();
+        }
+    }
+    sigaction(SIGPIPE, &saved, NULL);
+}
+
+//a stage of the metered pipeline stopped: a child of the shell goes on moving the data of the open links,
+//so the job can run again later (fg, bg) without the shell. the meter only reports the data until the stop.
+//the child isn't part of the job, reap_children() just collects it
+void hand_off_forwarding(struct pipe_link *links, int count) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        forward_pipeline(links, count, NULL);
+        _exit(0);
+    }
+}
+
+//a line for every stage: the bytes it wrote, at what rate, how long its output waited for the next stage,
+//and how full the next stage's pipe was on average & at most
+void print_meter_report(struct pipe_link *links, char ***args, int num_commands, double start) {
+    fflush(stdout);
+    fprintf(stderr, "stage  %-16s %12s %10s %10s %12s %12s\n",
+            "command", "bytes", "MB/s", "stalled", "queued avg", "queued max");
+    for (int i = 0; i < num_commands; i++) {
+        struct pipe_link *link = &links[i];
+        if (i == num_commands - 1 || link->end == 0) { //the last stage, or its output went to a file
+            fprintf(stderr, "%5d  %-16s %12s %10s %10s %12s %12s\n", i + 1, args[i][0], "-", "-", "-", "-", "-");
+            continue;
+        }
+        double seconds = link->end - start;
+        fprintf(stderr, "%5d  %-16s %12lld %10.1f %9.3fs %12lld %12d\n", i + 1, args[i][0], link->bytes,
+                seconds > 0 ? link->bytes / seconds / 1e6 : 0.0, link->stall,
+                link->samples > 0 ? link->queued_sum / link->samples : 0, link->queued_max);
+    }
+}
+
+/********************************************* TIME ****************************************************************/
+//time [-j] <command>: runs the command (or pipeline) & reports to stderr how long it took (real), the CPU time
+//(user, sys), the max resident set, page faults & context switches. the processes' numbers come from wait4(),
+//which the jobs always use, so a command that isn't timed pays nothing. a pipeline's numbers are the sum
+//of its stages (max RSS is the largest stage). -j prints the report as one JSON line, with every stage
+
+//starts measuring a pipeline with the 'time' prefix (the parser already took it out of the words)
+void start_timing(struct time_report *report, struct pipeline *pipeline) {
+    report->json = pipeline->timed == TIME_JSON;
+    report->num_procs = 0;
+    report->procs = NULL;
+    getrusage(RUSAGE_SELF, &report->self);
+    report->start = now_seconds();
+    time_report = report;
+}
+
+double tv_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void print_time_report(struct time_report *report) {
+    struct rusage self;
+    double real = now_seconds() - report->start;
+    time_report = NULL;
+    getrusage(RUSAGE_SELF, &self);
+
+    //the shell's part: builtins, and the forwarding of a metered pipeline
+    double user = tv_seconds(self.ru_utime) - tv_seconds(report->self.ru_utime);
+    double sys = tv_seconds(self.ru_stime) - tv_seconds(report->self.ru_stime);
+    long minor = self.ru_minflt - report->self.ru_minflt, major = self.ru_majflt - report->self.ru_majflt;
+    long voluntary = self.ru_nvcsw - report->self.ru_nvcsw, involuntary = self.ru_nivcsw - report->self.ru_nivcsw;
+    long max_rss = report->num_procs == 0 ? self.ru_maxrss : 0;
+    for (int i = 0; i < report->num_procs; i++) {
+        struct rusage *usage = &report->procs[i].usage;
+        user += tv_seconds(usage->ru_utime);
+        sys += tv_seconds(usage->ru_stime);
+        minor += usage->ru_minflt;
+        major += usage->ru_majflt;
+        voluntary += usage->ru_nvcsw;
+        involuntary += usage->ru_nivcsw;
+        if (usage->ru_maxrss > max_rss)
+            max_rss = usage->ru_maxrss;
+    }
+
+    fflush(stdout);
+    if (!report->json) {
+        fprintf(stderr, "\nreal\t%dm%.3fs\nuser\t%dm%.3fs\nsys\t%dm%.3fs\n", (int) (real / 60), real - 60 * (int) (real / 60),
+                (int) (user / 60), user - 60 * (int) (user / 60), (int) (sys / 60), sys - 60 * (int) (sys / 60));
+        fprintf(stderr, "maxrss\t%ld KB\nfaults\t%ld minor, %ld major\nctxsw\t%ld voluntary, %ld involuntary\n",
+                max_rss, minor, major, voluntary, involuntary);
+        return;
+    }
+    fprintf(stderr, "{\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,\"minor_faults\":%ld,"
+                    "\"major_faults\":%ld,\"voluntary_switches\":%ld,\"involuntary_switches\":%ld,\"status\":%d,\"stages\":[",
+            real, user, sys, max_rss, minor, major, voluntary, involuntary, last_status);
+    for (int i = 0; i < report->num_procs; i++) {
+        struct process *proc = &report->procs[i];
+        fprintf(stderr, "%s{\"pid\":%d,\"status\":%d,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld}", i > 0 ? "," : "",
+                proc->pid, exit_code(proc->status), tv_seconds(proc->usage.ru_utime), tv_seconds(proc->usage.ru_stime),
+                proc->usage.ru_maxrss);
+    }
+    fprintf(stderr, "]}\n");
+}
+
+/********************************************* METRICS ****************************************************************/
+//every command that finishes is counted by its name & exit status, and the launches & runs of the processes are
+//timed into histograms. 'stats' prints them, and with METRICS_FILE=<path> they're written there in the Prometheus
+//text format every METRICS_INTERVAL seconds (10 by default), for node_exporter's textfile collector
+
+//a finished command: its name & its status, in waitpid()'s format
+void count_command(char *name, int status) {
+    unsigned long hash = hash_string(name);
+    struct command_metric *c;
+
+    if (WIFSIGNALED(status))
+        metrics.signals[WTERMSIG(status) < NSIG ? WTERMSIG(status) : 0]++;
+    else
+        metrics.exit_codes[WEXITSTATUS(status)]++;
+    if (2 * (metrics.count + 1) > metrics.capacity && grow_command_metrics() != SUCCESS)
+        return; //the metrics are only lost
+    c = find_command_metric(name, hash);
+    if (c->name == NULL) {
+        if ((c->name = strdup(name)) == NULL)
+            return;
+        c->hash = hash;
+        metrics.count++;
+    }
+    c->runs++;
+    c->failures += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+//a process of a job finished (or couldn't be launched): it's counted by its first word
+void count_process(struct process *proc) {
+    size_t len = strcspn(proc->text, SPACE);
+    char saved = proc->text[len];
+
+    proc->text[len] = 0;
+    count_command(proc->text, proc->status);
+    proc->text[len] = saved;
+    if (proc->pid != -1)
+        observe(&metrics.run, now_seconds() - proc->started);
+}
+
+void observe(struct histogram *h, double seconds) {
+    int i = 0;
+    while (i < METRICS_BUCKETS && seconds > metric_bounds[i])
+        i++;
+    h->counts[i]++;
+    h->count++;
+    h->sum += seconds;
+}
+
+struct command_metric *find_command_metric(char *name, unsigned long hash) {
+    int mask = metrics.capacity - 1, i = (int) (hash & mask);
+    while (metrics.commands[i].name != NULL &&
+           (metrics.commands[i].hash != hash || strcmp(metrics.commands[i].name, name) != 0))
+        i = (i + 1) & mask;
+    return &metrics.commands[i];
+}
+
+int grow_command_metrics() {
+    struct command_metric *old = metrics.commands;
+    int old_capacity = metrics.capacity;
+
+    metrics.capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    metrics.commands = calloc(metrics.capacity, sizeof(struct command_metric));
+    if (metrics.commands == NULL) {
+        metrics.commands = old;
+        metrics.capacity = old_capacity;
+        return SYSTEM_FAILURES;
+    }
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].name != NULL)
+            (*find_command_metric(old[i].name, old[i].hash)) = old[i];
+    }
+    free(old);
+    return SUCCESS;
+}
+
+//the Prometheus text format
+void write_metrics(FILE *f) {
+    fprintf(f, "# HELP ex1_commands_total Commands that finished, by name.\n# TYPE ex1_commands_total counter\n");
+    for (int i = 0; i < metrics.capacity; i++) {
+        if (metrics.commands[i].name == NULL)
+            continue;
+        fprintf(f, "ex1_commands_total{command=\"");
+        write_label(f, metrics.commands[i].name);
+        fprintf(f, "\"} %ld\n", metrics.commands[i].runs);
+    }
+    fprintf(f, "# HELP ex1_command_failures_total Commands that exited with a status other than 0 or were killed, "
+               "by name.\n# TYPE ex1_command_failures_total counter\n");
+    for (int i = 0; i < metrics.capacity; i++) {
+        if (metrics.commands[i].name == NULL)
+            continue;
+        fprintf(f, "ex1_command_failures_total{command=\"");
+        write_label(f, metrics.commands[i].name);
+        fprintf(f, "\"} %ld\n", metrics.commands[i].failures);
+    }
+    fprintf(f, "# HELP ex1_exit_status_total Commands that exited, by exit status.\n"
+               "# TYPE ex1_exit_status_total counter\n");
+    for (int i = 0; i < 256; i++) {
+        if (metrics.exit_codes[i] > 0)
+            fprintf(f, "ex1_exit_status_total{status=\"%d\"} %ld\n", i, metrics.exit_codes[i]);
+    }
+    fprintf(f, "# HELP ex1_killed_total Commands that were killed, by signal.\n# TYPE ex1_killed_total counter\n");
+    for (int i = 0; i < NSIG; i++) {
+        if (metrics.signals[i] > 0)
+            fprintf(f, "ex1_killed_total{signal=\"%d\"} %ld\n", i, metrics.signals[i]);
+    }
+    write_histogram(f, "ex1_launch_seconds", "From the start of a launch (fork/spawn) until the exec.", &metrics.launch);
+    write_histogram(f, "ex1_run_seconds", "From the exec until the process was reaped.", &metrics.run);
+}
+
+void write_histogram(FILE *f, char *name, char *help, struct histogram *h) {
+    long cumulative = 0;
+
+    fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        cumulative += h->counts[i];
+        fprintf(f, "%s_bucket{le=\"%g\"} %ld\n", name, metric_bounds[i], cumulative);
+    }
+    fprintf(f, "%s_bucket{le=\"+Inf\"} %ld\n%s_sum %.6f\n%s_count %ld\n", name, h->count, name, h->sum, name, h->count);
+}
+
+//a label value, with \, " & newlines escaped
+void write_label(FILE *f, char *value) {
+    for (; *value != 0; value++) {
+        if (*value == '\\' || *value == '"')
+            fputc('\\', f);
+        if (*value == '\n')
+            fputs("\\n", f);
+        else
+            fputc(*value, f);
+    }
+}
+
+/*writes METRICS_FILE when METRICS_INTERVAL passed since the last time (checked after every pipeline), or now if
+ force is set. the file is replaced by rename(), so a scraper never reads half of it. child shells don't write it*/
+void dump_metrics(int force) {
+    char *path = get_option("METRICS_FILE"), *value, temp[PATH_MAX];
+    double now, interval;
+    FILE *f;
+
+    if (path == NULL || *path == 0 || getpid() != shell_pid)
+        return;
+    now = now_seconds();
+    if (!force && now < metrics.next_dump)
+        return;
+    value = get_option("METRICS_INTERVAL");
+    interval = value != NULL && atof(value) > 0 ? atof(value) : METRICS_INTERVAL;
+    metrics.next_dump = now + interval;
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    if ((f = fopen(temp, "w")) == NULL) {
+        perror(temp);
+        return;
+    }
+    write_metrics(f);
+    if (fclose(f) != 0 || rename(temp, path) == -1) {
+        perror(path);
+        unlink(temp);
+    }
+}
+
+//the bound of the bucket the q-th quantile falls in (an upper bound of the quantile), -1 above the last bound
+double histogram_quantile(struct histogram *h, double q) {
+    long rank = (long) (q * h->count + 0.5), cumulative = 0;
+
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        if ((cumulative += h->counts[i]) >= rank)
+            return metric_bounds[i];
+    }
+    return -1;
+}
+
+void print_histogram(char *title, struct histogram *h) {
+    double p50 = histogram_quantile(h, 0.5), p99 = histogram_quantile(h, 0.99);
+
+    printf("%-22s %ld", title, h->count);
+    if (h->count == 0) {
+        printf("\n");
+        return;
+    }
+    printf(", avg %.3f ms", h->sum * 1000 / h->count);
+    if (p50 < 0)
+        printf(", p50 > %g ms", metric_bounds[METRICS_BUCKETS - 1] * 1000);
+    else
+        printf(", p50 <= %g ms", p50 * 1000);
+    if (p99 < 0)
+        printf(", p99 > %g ms\n", metric_bounds[METRICS_BUCKETS - 1] * 1000);
+    else
+        printf(", p99 <= %g ms\n", p99 * 1000);
+}
+
+int compare_command_metrics(const void *a, const void *b) {
+    long first = (*(struct command_metric **) a)->runs, second = (*(struct command_metric **) b)->runs;
+    return first < second ? 1 : first > second ? -1 : 0;
+}
+
+/*the stats builtin:
+ stats     - prints how many times each command ran & failed (the most used first), the exit statuses,
+             and the latencies of launching (fork -> exec) & running (exec -> exit) the processes
+ stats -p  - prints them in the Prometheus text format, like METRICS_FILE
+ stats -r  - resets them*/
+int stats_builtin(char **args, int argc) {
+    struct command_metric **sorted;
+    long runs = 0, failures = 0;
+    int n = 0;
+
+    last_status = 0;
+    if (argc > 1 && strcmp(args[1], "-p") == 0) {
+        write_metrics(stdout);
+        return SUCCESS;
+    }
+    if (argc > 1 && strcmp(args[1], "-r") == 0) {
+        free_metrics();
+        return SUCCESS;
+    }
+    if (argc > 1) {
+        fprintf(stderr, "stats: usage: stats [-p | -r]\n");
+        last_status = 1;
+        return SUCCESS;
+    }
+    sorted = arena_alloc(&line_arena, (metrics.count + 1) * sizeof(struct command_metric *));
+    if (sorted == NULL) {
+        printf("malloc failed\n");
+        return SYSTEM_FAILURES;
+    }
+    for (int i = 0; i < metrics.capacity; i++) {
+        if (metrics.commands[i].name == NULL)
+            continue;
+        sorted[n++] = &metrics.commands[i];
+        runs += metrics.commands[i].runs;
+        failures += metrics.commands[i].failures;
+    }
+    qsort(sorted, n, sizeof(struct command_metric *), compare_command_metrics);
+    printf("commands: %ld, failed: %ld\n", runs, failures);
+    if (n > 0)
+        printf("%10s %10s  command\n", "runs", "failed");
+    for (int i = 0; i < n; i++)
+        printf("%10ld %10ld  %s\n", sorted[i]->runs, sorted[i]->failures, sorted[i]->name);
+    printf("exit statuses:");
+    for (int i = 0; i < 256; i++) {
+        if (metrics.exit_codes[i] > 0)
+            printf(" %d:%ld", i, metrics.exit_codes[i]);
+    }
+    for (int i = 0; i < NSIG; i++) {
+        if (metrics.signals[i] > 0)
+            printf(" SIG%d:%ld", i, metrics.signals[i]);
+    }
+    printf("\n");
+    print_histogram("launch (fork -> exec):", &metrics.launch);
+    print_histogram("run (exec -> exit):", &metrics.run);
+    return SUCCESS;
+}
+
+//frees the counts of the commands & zeroes everything (the next dump time is kept)
+void free_metrics() {
+    double next_dump = metrics.next_dump;
+
+    for (int i = 0; i < metrics.capacity; i++)
+        free(metrics.commands[i].name);
+    free(metrics.commands);
+    memset(&metrics, 0, sizeof(metrics));
+    metrics.next_dump = next_dump;
+}
+
+/********************************************* TRACING ****************************************************************/
+//with EX1_TRACE=<file> (or 'trace <file>') the shell times its own phases - reading a line, parsing it, expanding
+//a command, fork, the launch until exec, every stage of a pipeline & waiting for a job - into a ring of events,
+//which is written to the file as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) only when it's full,
+//when tracing stops & when the shell exits
+
+//EX1_TRACE in the shell's environment starts a trace before the first line is read
+void init_trace() {
+    char *path = getenv("EX1_TRACE");
+    if (path != NULL && *path != 0)
+        start_trace(path);
+}
+
+/*starts a new trace in path, instead of the one that runs. the file is the array format of the trace events,
+ which the viewers read even before the closing ']' was written, so a trace of a shell that was killed still loads*/
+int start_trace(char *path) {
+    stop_trace();
+    trace.ring = malloc(TRACE_EVENTS * sizeof(struct trace_event));
+    trace.path = strdup(path);
+    if (trace.ring == NULL || trace.path == NULL) {
+        printf("malloc failed\n");
+        stop_trace();
+        return SYSTEM_FAILURES;
+    }
+    if ((trace.file = fopen(path, "we")) == NULL) {
+        perror(path);
+        stop_trace();
+        return INVALID_INPUT;
+    }
+    trace.head = trace.written = 0;
+    //the events are written flushed, so a child shell never has them in its stdio buffer to write again
+    fprintf(trace.file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"ex1\"}}",
+            shell_pid, shell_pid);
+    fflush(trace.file);
+    tracing = 1;
+    return SUCCESS;
+}
+
+//writes the events that are left, closes the array & the file. does nothing if no trace runs (or in a child shell)
+void stop_trace() {
+    if (tracing) {
+        flush_trace();
+        fprintf(trace.file, "\n]\n");
+    }
+    if (trace.file != NULL && fclose(trace.file) != 0)
+        perror(trace.path);
+    free(trace.ring);
+    free(trace.path);
+    memset(&trace, 0, sizeof(trace));
+    tracing = 0;
+}
 
-//this is a data structure to maintain environment variables:
-//an array of structs, where each struct represents an environment variable
-struct env_var env_vars[MAX_ENV_VARS];
-int env_var_count = 0;
+//nanoseconds of CLOCK_MONOTONIC: the phases of the shell are too short for the microseconds of the format
+long long trace_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-//here the program actually runs
-int main() {
-    char prompt[512], cwd[512]; //current working directory
-    char *command;
-    int enter_count = 0;
+//records a phase that started at start & ends now. detail is copied, so it may be freed right after
+void trace_add(const char *name, long long start, const char *detail) {
+    struct trace_event *e;
 
-    signal(SIGCHLD, catch_child);
-    signal(SIGTSTP, catch_stop);
+    if (!tracing) //'trace off' ran during the phase
+        return;
+    if (trace.head - trace.written == TRACE_EVENTS)
+        flush_trace();
+    e = &trace.ring[trace.head & (TRACE_EVENTS - 1)];
+    e->name = name;
+    e->start = start;
+    e->duration = trace_clock() - start;
+    e->detail[0] = 0;
+    if (detail != NULL)
+        snprintf(e->detail, sizeof(e->detail), "%s", detail);
+    trace.head++;
+}
 
-    while (1) {
-        print_prompt(prompt, cwd, sizeof(prompt), sizeof(cwd));
-        command = read_command();
-        if (command == NULL)
-            continue;
+//writes the events of the ring that weren't written yet, as 'complete' events with microsecond times
+void flush_trace() {
+    struct trace_event *e;
 
-        if ((command[0]) != '\n') {
-            split_multiple_commands(&command);
-            enter_count = 0;
-        } else { //the user pressed 'enter' only, increase enter_count
-            enter_count++;
-        }
-        free(command);//dynamically allocated by getline()
-        if (enter_count == 3) { //The user pressed enter 3 times consecutively - exit
-            free_env_vars();
-            exit(0);
+    for (; trace.written != trace.head; trace.written++) {
+        e = &trace.ring[trace.written & (TRACE_EVENTS - 1)];
+        fprintf(trace.file, ",\n{\"name\":\"%s\",\"cat\":\"shell\",\"ph\":\"X\",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,"
+                            "\"pid\":%d,\"tid\":%d", e->name, e->start / 1000, e->start % 1000,
+                e->duration / 1000, e->duration % 1000, shell_pid, shell_pid);
+        if (e->detail[0] != 0) {
+            fprintf(trace.file, ",\"args\":{\"command\":");
+            write_json_string(trace.file, e->detail);
+            fputc('}', trace.file);
         }
+        fputc('}', trace.file);
     }
-    return 0;
+    if (fflush(trace.file) != 0)
+        perror(trace.path);
 }
 
-void print_prompt(char *prompt, char *cwd, int p_size, int c_size) {
-    if (getcwd(cwd, c_size) == NULL) { // Get current working directory
-        perror("getcwd() error");
-        exit(1);
+//a JSON string: quotes, backslashes & control characters are escaped
+void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s != 0; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char) *s);
+        else
+            fputc(*s, f);
     }
-    // Generate the prompt string
-    snprintf(prompt, p_size, "#cmd:%d|#args:%d @%s ", cmd_count, arg_count, cwd);
-    printf("%s", prompt);
-    fflush(stdout);
+    fputc('"', f);
 }
 
-char *read_command() { //get the command from the user
-    char *command;
-    size_t size = 0;
-    ssize_t command_len;//might be negative
-    command_len = getline(&command, &size, stdin);
+/*the trace builtin:
+ trace <file>  - starts recording the shell's phases into file (instead of the trace that runs)
+ trace flush   - writes the events that were recorded, the trace goes on
+ trace off     - writes them & closes the file
+ trace         - prints where the trace goes & how many events were recorded*/
+int trace_builtin(char **args, int argc) {
+    int ret;
 
-    if (command_len == -1) {
-        perror("getline error");
-        exit(1);
+    last_status = 0;
+    if (argc == 1) {
+        if (tracing)
+            printf("tracing to %s: %lu events, %lu not written yet\n", trace.path, trace.head,
+                   trace.head - trace.written);
+        else
+            printf("tracing is off\n");
+        return SUCCESS;
     }
-    if (command_len > MAX_INPUT_LENGTH + 1) {//+1 for \n that getLine adds
-        printf("input is too long\n");
-        free(command);
-        return NULL;
+    if (argc > 2) {
+        fprintf(stderr, "trace: usage: trace [<file> | flush | off]\n");
+        last_status = 1;
+        return SUCCESS;
     }
-    if (command_len > 1 && command[command_len - 1] == '\n') {
-        command[command_len - 1] = '\0';  // remove newline character if there are any other chars in the input
+    if (strcmp(args[1], "off") == 0) {
+        stop_trace();
+        return SUCCESS;
     }
-    command[command_len] = 0;
-    return command;
-}
-
-//get a single command, initialise argv[] with its arguments & return it to execute_multiple_commands.
-//It deals with regular commands as well as with setting environment variables
-//It returns 'SUCCESS' if the input is a legal command, and there were no memory allocation errors
-int split_single_command(char **args, char *command, int *run_in_background) {
-    if (command == NULL) { //it isn't a command
-        return INVALID_INPUT;
+    if (strcmp(args[1], "flush") == 0) {
+        if (tracing)
+            flush_trace();
+        return SUCCESS;
     }
-    int args_index = 0, is_echo = 0;
-    char *token;
-    char *var_name, *var_value;
-    char command_copy[strlen(command) + 1];
-    strcpy(command_copy, command);
+    ret = start_trace(args[1]);
+    if (ret == SYSTEM_FAILURES)
+        return SYSTEM_FAILURES;
+    last_status = ret == SUCCESS ? 0 : 1;
+    return SUCCESS;
+}
 
-    if (strchr(command, '=') != NULL &&
-        (strstr(command, "echo\0") !=
-         &command[0])) { //contains assignment & it isn't an echo command - probably a shell variable
+/********************************************* RC FILE ****************************************************************/
+//an interactive shell runs ~/.ex1rc ($EX1RC, "" for none) before the first prompt. most rc files only set variables
+//and define functions & aliases, so when that's all the lines did, the entries are written to <rc file>.snapshot.
+//the next shell maps the snapshot & copies the entries & their packed trees out of it instead of parsing the rc file.
+//a snapshot is used only for the rc file (size, mtime & hash) and the shell binary it was made for. EX1_SNAPSHOT=0
+//always runs the rc file, without a snapshot
 
-        var_name = strtok(command_copy, "=");
-        var_value = strtok(NULL, "=");
+void load_rc() {
+    char *name = getenv("EX1RC"), *home = getenv("HOME"), *option = getenv("EX1_SNAPSHOT"), *text;
+    char path[PATH_MAX], snapshot[PATH_MAX + 16];
+    int use_snapshot = option == NULL || strcmp(option, "0") != 0, ret = INVALID_INPUT;
+    struct snapshot_key key;
+    size_t len;
+    long long traced = tracing ? trace_clock() : 0;
 
-        if (var_name != NULL && var_value != NULL) {
-            if (!is_assignment(var_name, var_value))//check if there isn't any space between name to value
-                return INVALID_INPUT;
-            if (strchr(var_value, '>') != NULL)
-                return INVALID_INPUT;
-            remove_spaces_and_quotes(var_name);
-            remove_spaces_and_quotes(var_value);
+    if (name != NULL ? name[0] == 0 : home == NULL)
+        return;
+    if (name != NULL)
+        snprintf(path, sizeof(path), "%s", name);
+    else
+        snprintf(path, sizeof(path), "%s/.ex1rc", home);
+    if ((text = read_rc(path, &len, &key)) == NULL) //there's no rc file
+        return;
+    snprintf(snapshot, sizeof(snapshot), "%s.snapshot", path);
+    if (use_snapshot && (ret = load_snapshot(snapshot, &key)) == SYSTEM_FAILURES) {
+        free(text);
+        free_and_exit(1);
+    }
+    //a snapshot that turned out to be broken halfway is fine too: the rc file defines everything again
+    if (ret != SUCCESS && run_rc(text, len) && use_snapshot)
+        write_snapshot(snapshot, &key); //if it can't be written, the rc file is run again next time
+    free(text);
+    if (traced)
+        trace_add("rc", traced, ret == SUCCESS ? "snapshot" : "parsed");
+}
 
-            if (my_setenv(var_name, var_value) == SYSTEM_FAILURES)
-                return SYSTEM_FAILURES;
+//reads the whole rc file, and fills the key a snapshot of it must have. NULL if it can't be read
+char *read_rc(char *path, size_t *len, struct snapshot_key *key) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    char *text;
+    ssize_t n = 1;
 
-        } else printf("assign in this pattern: <variable name>=<value>\n");
-        return INVALID_INPUT;//the input is actually valid, but not a command, so INVALID_INPUT is returned
-    }
-    token = strtok(command_copy, SPACE);
-    if (token == NULL) {//there are spaces only
-        return INVALID_INPUT;
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &st) == -1 || (text = malloc(st.st_size + 1)) == NULL) {
+        close(fd);
+        return NULL;
     }
-    if (strcmp(token, "exit\0") == 0) { //the command contains exit
-        return EXIT;
+    for ((*len) = 0; (*len) < (size_t) st.st_size && n > 0; (*len) += n > 0 ? n : 0) {
+        n = read(fd, text + (*len), st.st_size - (*len));
+        if (n == -1 && errno == EINTR)
+            n = 0;
+        else if (n == -1)
+            perror(path);
     }
-    if (strcmp(token, "echo") == 0) { //echo
-        is_echo = 1;
-        int ret = deal_with_echo(command, args, &args_index);
-        if (ret != SUCCESS)
-            return ret;
+    close(fd);
+    text[*len] = 0; //read_script_line() needs the spare byte
+    memset(key, 0, sizeof(struct snapshot_key)); //the padding is compared too
+    memcpy(key->magic, SNAPSHOT_MAGIC, sizeof(key->magic));
+    key->rc_size = (long long) (*len);
+    key->rc_mtime = st.st_mtim;
+    key->rc_hash = hash_string(text);
+    if (stat("/proc/self/exe", &st) == 0) { //a new shell may keep the entries or the trees in another layout
+        key->shell_size = st.st_size;
+        key->shell_mtime = st.st_mtim;
     }
-    if (strcmp(token, "bg") == 0) { //maybe need to put in front the last process was stopped
-        if (strtok(NULL, SPACE) == NULL && (waitpid(stopped_process, NULL, WNOHANG)) == 0) {
-            kill(stopped_process, SIGCONT);
-            cmd_count++;
-            arg_count++;
+    return text;
+}
+
+//runs the lines of the rc file like a script's. returns if they only defined things: every line succeeded,
+//and none of them ran a job or a builtin that does more than (un)defining
+int run_rc(char *text, size_t len) {
+    struct input outer = input;
+    int outer_interactive = interactive, outer_cmd_count = cmd_count, outer_arg_count = arg_count;
+    int effects = effect_count, defined_only = 1, ret;
+    char *line;
+
+    input = (struct input) {-1, text, 0, 0, len, 1}; //the text is already all in memory, like the string of -c
+    interactive = 0;
+    while ((line = read_command()) != NULL) {
+        ret = split_multiple_commands(line, 1);
+        defined_only &= last_status == 0;
+        arena_reset(&line_arena);
+        forget_listings();
+        if (ret == SYSTEM_FAILURES || ret == EXIT) {
+            input = outer;
+            free_and_exit(ret == EXIT ? last_status : 1);
         }
-        return INVALID_INPUT;//it isn't a command
     }
+    input = outer;
+    interactive = outer_interactive;
+    cmd_count = outer_cmd_count; //the prompt counts only what the user typed
+    arg_count = outer_arg_count;
+    return defined_only && effects == effect_count;
+}
 
-    while (token != NULL && !is_echo) { //there are more arguments
-        if (args_index == MAX_ARGS) { //too many arguments
-            fprintf(stderr, "too many arguments\n");
-            args[args_index] = NULL;
-            return INVALID_INPUT;
-        }
-        if (token[0] == '$') {//a shell variable
-            var_name = token + 1;
-            var_value = my_getenv(var_name);
+//maps the snapshot & defines its entries, if it was made for the key.
+//INVALID_INPUT if it wasn't (or it's broken), SYSTEM_FAILURES if there's no memory
+int load_snapshot(char *path, struct snapshot_key *key) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC), count, ret = INVALID_INPUT;
+    struct snapshot_key found;
+    struct stat st;
+    char *map;
 
-            if (var_value == NULL) {//this variable isn't exist is my data structure
-                printf("%s isn't assigned\n", var_name);
-                args[args_index] = NULL; //close argv[]
-                return INVALID_INPUT;
-            }
-            token = var_value; //very important it will be here, before the other conditions
-        }
-        if (strcmp(token, "cd") == 0) { //cd not supported
-            fprintf(stderr, "cd not supported\n");
-            return INVALID_INPUT;
-        }
-        if (strcmp(token, SPACE) != 0) {
-            //space isn't an argument
-            divide_string(token, &args[args_index], &args[args_index + 1], &args[args_index + 2], &args_index);
-        }
-        token = strtok(NULL, SPACE);
+    if (fd == -1)
+        return INVALID_INPUT;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(found) + sizeof(count)) {
+        close(fd);
+        return INVALID_INPUT;
     }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return INVALID_INPUT;
+    memcpy(&found, map, sizeof(found)); //the map is aligned, but its entries aren't, so everything is copied out
+    memcpy(&count, map + sizeof(found), sizeof(count));
+    if (memcmp(&found, key, sizeof(found)) == 0 && count >= 0)
+        ret = apply_snapshot(map, st.st_size, count);
+    munmap(map, st.st_size);
+    return ret;
+}
 
-    args[args_index] = NULL;//close args[]
-    for (int i = 0; i < args_index; i++) {
-        if (args[i] == NULL) {
-            printf("malloc failed\n");
-            return SYSTEM_FAILURES;//one of the strdups failed
-        }
-    }
-    if (args_index >= 1) {
-        if (strcmp("&", args[args_index - 1]) == 0) {//the process needs to run in background
-            arg_count++;
-            free(args[args_index - 1]);
-            args[args_index - 1] = NULL;
-            args_index--;
-            (*run_in_background) = 1;
-        } else if (args[args_index - 1][strlen(args[args_index - 1]) - 1] == '&') {
-            arg_count++;
-            args[args_index - 1][strlen(args[args_index - 1]) - 1] = 0;
-            (*run_in_background) = 1;
-        } else
-            (*run_in_background) = 0;
+//defines the count entries of the mapped snapshot, which are checked to be inside it first
+int apply_snapshot(char *map, size_t size, int count) {
+    size_t at = sizeof(struct snapshot_key) + sizeof(int);
+    struct snapshot_entry e;
+    struct definition *d;
+    char *name, *value;
+    int ret;
 
-        if ((args[0] != NULL && strcmp(args[0], ">") == 0) ||
-            (args[args_index - 1] != NULL && strcmp(args[args_index - 1], ">") == 0)) {
-            printf("enter source & dest\n");
+    for (int i = 0; i < count; i++) {
+        if (size - at < sizeof(e))
+            return INVALID_INPUT;
+        memcpy(&e, map + at, sizeof(e));
+        at += sizeof(e);
+        if (e.kind < ENTRY_VARIABLE || e.kind > ENTRY_ALIAS || (e.kind == ENTRY_VARIABLE) != (e.tree_size == 0) ||
+            e.name_len < 1 || e.value_len < 0 || size - at < (size_t) e.name_len + e.value_len + 2 ||
+            size - at - e.name_len - e.value_len - 2 < e.tree_size)
             return INVALID_INPUT;
+        name = map + at;
+        value = name + e.name_len + 1;
+        if (name[e.name_len] != 0 || value[e.value_len] != 0)
+            return INVALID_INPUT;
+        at += e.name_len + e.value_len + 2;
+        if (e.kind == ENTRY_VARIABLE) {
+            if (my_setenv(name, value) != SUCCESS)
+                return SYSTEM_FAILURES;
+            continue;
+        }
+        if ((d = calloc(1, sizeof(struct definition))) == NULL) {
+            printf("malloc failed\n");
+            return SYSTEM_FAILURES;
+        }
+        ret = unpack_tree(&d->tree, map + at, e.tree_size);
+        if (ret == PARSE_OK && e.kind == ENTRY_ALIAS && d->tree.command_count == 0) { //an alias is a simple command
+            free_parser(&d->tree);
+            ret = PARSE_ERROR;
+        }
+        if (ret != PARSE_OK) {
+            free(d);
+            if (ret == PARSE_NO_MEMORY)
+                printf("malloc failed\n");
+            return ret == PARSE_NO_MEMORY ? SYSTEM_FAILURES : INVALID_INPUT;
         }
+        at += e.tree_size;
+        if (define(name, e.kind, value, d) != SUCCESS)
+            return SYSTEM_FAILURES;
     }
-    cmd_count++;
-    arg_count += (args_index);
     return SUCCESS;
 }
 
-/*handle with commands seperated by ;
-gets the full message the user entered. It separates the different commands (if there are some).
-sends each command to split_single_command(), which initialises argv[] or set an environment variable
-if initialisation succeeded, the function sends argv[] to execute_single_command() that executes it.
- argv[] is freed here, no matter if the input is valid or not.
- It gets a pointer to command in order to free it if needed.
+//writes every entry of the variables' table (all of them were made by the rc file) to a temporary file, which
+//takes the snapshot's place at once, so another shell that starts now never maps half a snapshot
+int write_snapshot(char *path, struct snapshot_key *key) {
+    char temp[PATH_MAX + 32], *tree;
+    struct snapshot_entry e;
+    struct definition *d;
+    FILE *f;
+    int ok;
 
- CRUCIAL - uses strsep() instead of strtok() because split_single_command() uses strtok() simultaneously.
- The saved state between calls that allows strtok() to continue where it left off ruined the program.
- https://stackoverflow.com/questions/7218625/what-are-the-differences-between-strtok-and-strsep-in-c
- */
-void
-split_multiple_commands(char **command) {
-    if (command == NULL)
-        return;
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+    if ((f = fopen(temp, "we")) == NULL)
+        return INVALID_INPUT;
+    ok = fwrite(key, sizeof(struct snapshot_key), 1, f) == 1 && fwrite(&env_var_count, sizeof(int), 1, f) == 1;
+    for (int i = 0; i < env_var_capacity && ok; i++) {
+        if (env_vars[i].name == NULL)
+            continue;
+        d = env_vars[i].definition;
+        memset(&e, 0, sizeof(e));
+        e.kind = env_vars[i].kind;
+        e.name_len = (int) strlen(env_vars[i].name);
+        e.value_len = (int) strlen(env_vars[i].value);
+        e.tree_size = d != NULL ? packed_size(&d->tree) : 0;
+        tree = NULL;
+        if (e.tree_size > 0 && (ok = (tree = malloc(e.tree_size)) != NULL))
+            pack_tree(&d->tree, tree);
+        ok = ok && fwrite(&e, sizeof(e), 1, f) == 1 && fwrite(env_vars[i].name, e.name_len + 1, 1, f) == 1 &&
+             fwrite(env_vars[i].value, e.value_len + 1, 1, f) == 1 &&
+             (tree == NULL || fwrite(tree, e.tree_size, 1, f) == 1);
+        free(tree);
+    }
+    if (fclose(f) != 0 || !ok || rename(temp, path) == -1) {
+        unlink(temp);
+        return INVALID_INPUT;
+    }
+    return SUCCESS;
+}
 
-    char *sub_command;
-    //it isn't really a copy, but it's needed because otherwise command itself will be changed by strsep() to NULL, and we won't be able to free it
-    char *copy_command = (*command);
-    char *args[MAX_ARGS + 3];//for null and for check if there are too many arguments
-    int is_command = 0, index = 0, is_executed = 1, is_new_command = 0;
-    int run_in_background = 0, to_file = 0;
-
-    int len = strlen(copy_command);
-    int last_pos = 0;
-    int inside_quotes = 0;
-
-    for (int i = 0; i < len; i++) {
-        if (copy_command[i] == '"') {
-            inside_quotes = !inside_quotes;
-        }
-        if (copy_command[i] == ';' && !inside_quotes) {
-            copy_command[i] = '\0';
-            sub_command = copy_command + last_pos;
-            is_new_command = 1;
-            last_pos = i + 1;
-        }
-        if (last_pos < len && i == len - 1) {
-            sub_command = copy_command + last_pos;
-            is_new_command = 1;
-        }
-        if (sub_command[0] == 0)
-            is_new_command = 0;
-
-        if (is_new_command == 1) {
-            is_new_command = 0;
-            args[0] = NULL;
-            if (strchr(sub_command, '|') != NULL)//pipe command
-                is_executed = execute_pipe_commands(sub_command);
-            else {//not pipe command
-                is_command = split_single_command(args, sub_command, &run_in_background);
-
-                if (is_command == SUCCESS) { //the command is readable (not space or null)
-                    is_executed = execute_single_command(args, run_in_background,
-                                                         command);//here everything happens:)
-                }
-            }
-            index = 0;
-            while (args[index] != NULL) {
-                free(args[index]);
-                index++;
-            }
+/********************************************* COMMAND PATH CACHE ****************************************************************/
+//execvp() tries every $PATH directory with a failing execve() until it finds the command.
+//the resolved paths are kept in an open-addressing table (linear probing), keyed by the command name.
+//the table belongs to the value of $PATH it was built for, and is emptied when $PATH changes
 
-            if (is_command == SYSTEM_FAILURES || is_executed == SYSTEM_FAILURES || is_command == EXIT) {//exit
-                free(*command);
-                free_env_vars();
-                if (is_command == EXIT)
-                    exit(0);
-                exit(1);
-            }
-        }
+unsigned long hash_string(const char *str) { //FNV-1a
+    unsigned long hash = 14695981039346656037UL;
+    for (; *str != 0; str++) {
+        hash ^= (unsigned char) (*str);
+        hash *= 1099511628211UL;
     }
+    return hash;
 }
 
-void make_fork(pid_t *p) {
-    (*p) = fork();
+//checks that the cached table still belongs to the current $PATH, and empties it if not
+void check_hashed_path() {
+    char *path = getenv("PATH");
+    if (path == NULL)
+        path = "";
+    if (hashed_path != NULL && strcmp(hashed_path, path) == 0)
+        return;
+    clear_hashed_commands();
+    hashed_path = strdup(path);
 }
 
-int make_exec(char **args) {
-    int to_file = 0, fd;
-    for (int i = 0; args[i + 1] != NULL; ++i) { //check if need to write to file
-        if (strcmp(args[i], ">") == 0)
-            to_file = i;
-    }
-
-    if (to_file > 0 && args[to_file + 1] != NULL) {//need write to file
-        if(args[to_file+1][0]=='$'){
-            char* t= my_getenv(args[to_file+1]+1);
-            if(t==NULL) {
-                printf("don't use '$' in the name of the file\n");
-                return INVALID_INPUT;
-            }
-            else
-               args[to_file+1]=t;
-        }
-        fd = open(args[to_file + 1], O_WRONLY | O_CREAT|O_TRUNC, 0666);//open file to read & write
-        if (fd == -1) {
-            printf("cannot open file\n");
-            return SYSTEM_FAILURES;
-        }
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
-        free(args[to_file]); //free indexes of args
-        free(args[to_file + 1]);
-        args[to_file] = NULL;
-        args[to_file + 1] = NULL;
-        arg_count = arg_count - 2;
-    }
-    execvp(args[0], args);
-    perror("ececvp error"); //illegal command - execvp returned
-    return INVALID_INPUT;//normally shouldn't come here
+//returns the slot of name, or the empty slot where it should be inserted
+int find_hashed_slot(char *name) {
+    int mask = hashed_capacity - 1;
+    int i = (int) (hash_string(name) & mask);
+    while (hashed_commands[i].name != NULL && strcmp(hashed_commands[i].name, name) != 0)
+        i = (i + 1) & mask;
+    return i;
 }
 
-//executes the command in a new process by ececvp(). the father waits until his child is completed.
-//if the command was illegal, it updates the counters, and free the child's memory
-int execute_single_command(char **args, int run_in_background, char **command_to_free) {
-    if (args == NULL || args[0] == NULL) {
-        cmd_count--;
-        fprintf(stderr, "no arguments\n");
-        return INVALID_INPUT;
+//searches name in the $PATH directories. returns a malloc()ed full path, or NULL if there isn't an executable one
+char *search_path(char *name) {
+    char *path = getenv("PATH");
+    char candidate[PATH_MAX];
+    struct stat st;
+    if (path == NULL)
+        return NULL;
+    while (*path != 0) {
+        char *end = strchrnul(path, ':');
+        int dir_len = end - path;
+        if (dir_len == 0) //an empty entry means the current directory
+            snprintf(candidate, sizeof(candidate), "%s", name);
+        else
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", dir_len, path, name);
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0)
+            return strdup(candidate);
+        path = (*end == ':') ? end + 1 : end;
     }
-    pid_t p;
-    int status, exit_value;
+    return NULL;
+}
 
-    make_fork(&p);
-    run_now = p;
-    if (p < 0) {//forking failed
-        perror("forking failed");
-        return SYSTEM_FAILURES;
+//adds name to the table (or refreshes its path). returns the cached entry, or NULL if the command isn't found
+struct hashed_command *hash_command(char *name) {
+    char *path = search_path(name);
+    if (path == NULL)
+        return NULL;
+    if (hashed_count * 2 >= hashed_capacity && grow_hashed_commands() == SYSTEM_FAILURES) {
+        free(path);
+        return NULL;
     }
-    if (p == 0) {//child's process
-        signal(SIGCHLD, SIG_DFL);//return deal with signals to default
-        signal(SIGTSTP, SIG_DFL);
+    int i = find_hashed_slot(name);
+    if (hashed_commands[i].name == NULL) {
+        hashed_commands[i].name = strdup(name);
+        if (hashed_commands[i].name == NULL) {
+            free(path);
+            return NULL;
+        }
+        hashed_commands[i].hits = 0;
+        hashed_count++;
+    } else
+        free(hashed_commands[i].path);
+    hashed_commands[i].path = path;
+    return &hashed_commands[i];
+}
 
-        int ret = make_exec(args);
-        //illegal command - execvp returned
+int grow_hashed_commands() {
+    int old_capacity = hashed_capacity;
+    struct hashed_command *old = hashed_commands;
 
-        //free the memory allocated to argv[] & command
-        int i = 0;
-        for (; args[i] != NULL; ++i)
-            free(args[i]);
-        free(*command_to_free);
-        exit(i); //the father knows whether the command was legal by the exit value.
-        // The exit value also mentions how many arguments were in the illegal command - decrease counters
+    hashed_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    hashed_commands = calloc(hashed_capacity, sizeof(struct hashed_command));
+    if (hashed_commands == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for the command table\n");
+        hashed_commands = old;
+        hashed_capacity = old_capacity;
+        return SYSTEM_FAILURES;
     }
-
-    // Wait for child process to complete
-    if (!run_in_background) {
-        if (waitpid(p, &status, WUNTRACED) == -1) {
-            perror("waitpid() failed");
-            //return SYSTEM_FAILURES;
-        }
-//        exit_value = WEXITSTATUS(status);
-//        if (!WIFSTOPPED(status) && exit_value > 0) { //the command was illegal - decrease counters
-//            cmd_count--;
-//            arg_count -= exit_value;
-//        }
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].name != NULL)
+            hashed_commands[find_hashed_slot(old[i].name)] = old[i];
     }
+    free(old);
     return SUCCESS;
 }
 
-int execute_pipe_commands(char *command) {
-    int num_pipes = 1;
-    for (int i = 0; command[i] != 0; i++) {
-        if (command[i] == '|')
-            num_pipes++;
-    }
-    char *commands[num_pipes];
-    int num_commands = 0; //for running on the loop
-    int run_in_background = 0;
-
-    // Split command pipeline into individual commands based on the pipe character
-    char *token;
-    char *saveptr;
-    for (token = strtok_r(command, "|", &saveptr);
-         token != NULL; token = strtok_r(NULL, "|", &saveptr)) {
-        // Trim leading and trailing whitespace from token
-        while (*token != '\0' && (*token == ' ' || *token == '\t')) {
-            token++;
-        }
-        if (*token == '\0') {
-            // Ignore empty tokens
-            continue;
-        }
-        char *end = token + strlen(token) - 1;
-        while (end > token && (*end == ' ' || *end == '\t')) {
-            *end-- = '\0';
+//removes the entry in slot i, and moves back the entries of its probe chain so no lookup stops at the hole
+void unhash_slot(int i) {
+    int mask = hashed_capacity - 1;
+    free(hashed_commands[i].name);
+    free(hashed_commands[i].path);
+    hashed_commands[i].name = NULL;
+    hashed_count--;
+    for (int j = (i + 1) & mask; hashed_commands[j].name != NULL; j = (j + 1) & mask) {
+        if (can_fill_slot(i, j, (int) (hash_string(hashed_commands[j].name) & mask))) {
+            hashed_commands[i] = hashed_commands[j];
+            hashed_commands[j].name = NULL;
+            i = j;
         }
+    }
+}
 
-        if (token != NULL) {
-            commands[num_commands] = strdup(token);  // allocate and copy command
-            if (token == NULL) {
-                perror("malloc failed\n");
-                return SYSTEM_FAILURES;
+//returns the full path to execute for args[0], or NULL to let exec search $PATH itself.
+//a cached path is checked to still be executable, otherwise it's searched again
+char *find_command(char *name) {
+    if (strchr(name, '/') != NULL) //a path - nothing to search
+        return NULL;
+    check_hashed_path();
+    if (hashed_capacity > 0) {
+        int i = find_hashed_slot(name);
+        if (hashed_commands[i].name != NULL) {
+            if (access(hashed_commands[i].path, X_OK) == 0) {
+                hashed_commands[i].hits++;
+                return hashed_commands[i].path;
             }
-            num_commands++;
+            unhash_slot(i); //the binary was removed or moved
         }
     }
-    if (num_commands > 0 && commands[num_commands - 1][strlen(commands[num_commands - 1]) - 1] == '&') {
-        run_in_background = 1;
-        arg_count++;
-    }
-
-    int prev_pipefd[2] = {-1, -1};
-    int pipefd[2];
-    pid_t pid;
+    struct hashed_command *entry = hash_command(name);
+    if (entry == NULL)
+        return NULL;
+    entry->hits++;
+    return entry->path;
+}
 
-    for (int i = 0; i < num_commands; i++) {
-        if (pipe(pipefd) == -1) {
-            perror("pipe");
-            exit(EXIT_FAILURE);
+void clear_hashed_commands() {
+    for (int i = 0; i < hashed_capacity; i++) {
+        if (hashed_commands[i].name != NULL) {
+            free(hashed_commands[i].name);
+            free(hashed_commands[i].path);
         }
+    }
+    free(hashed_commands);
+    hashed_commands = NULL;
+    hashed_capacity = hashed_count = 0;
+    free(hashed_path);
+    hashed_path = NULL;
+}
 
-        make_fork(&pid);
-        if (pid == -1) {
-            perror("fork");
-            exit(EXIT_FAILURE);
+/*the hash builtin:
+ hash            - lists the cached commands & how many times each was used
+ hash name...    - searches the commands & adds them to the table
+ hash -r         - forgets all the cached paths
+ last_status is 1 if one of the commands wasn't found*/
+int hash_builtin(char **args, int argc) {
+    char **names = args + 1;
+    int count = argc - 1;
+    last_status = 0;
+    check_hashed_path();
+    if (count == 0) {
+        if (hashed_count == 0) {
+            printf("hash: hash table empty\n");
+            return SUCCESS;
         }
-
-        if (pid == 0) {  // Child process
-            if (i != 0) {
-                // If not the first command, redirect input to read end of previous pipe - the output of the previous command is there!
-                if (prev_pipefd[0] != -1) {
-                    // If there is a previous pipe, close your path to its write end
-                    close(prev_pipefd[1]);
-                }
-
-                dup2(prev_pipefd[0], STDIN_FILENO);  // Redirect input to read end of previous pipe
-            }
-            if (i != num_commands - 1) {
-                // If not the last command, redirect output to write end of pipe
-                close(pipefd[0]);  // Close unused read end
-                dup2(pipefd[1], STDOUT_FILENO);  // Redirect output to write end of pipe
-            }
-            close(pipefd[1]);  // Close unused write end
-
-            // Split command into individual tokens based on whitespace
-            char *args[MAX_ARGS + 3];
-            split_single_command(args, commands[i], &run_in_background);
-
-            // Execute command
-            make_exec(args);
-            int decrease = 0;// This code shouldn't normally be reached - exec failed <=> command was invalid
-            for (; args[decrease] !=
-                   NULL; decrease++); //the exit value will tell the father how many arguments to decrease
-            exit(decrease);
-
-        } else {  // Parent process
-            if (prev_pipefd[0] != -1) {
-                close(prev_pipefd[0]);
-                close(prev_pipefd[1]);
-            }
-            prev_pipefd[0] = pipefd[0]; // Save the read end of the current pipe for the next command
-            prev_pipefd[1] = pipefd[1]; // Save the write end of the current pipe for the next command
+        printf("hits\tcommand\n");
+        for (int i = 0; i < hashed_capacity; i++) {
+            if (hashed_commands[i].name != NULL)
+                printf("%4d\t%s\n", hashed_commands[i].hits, hashed_commands[i].path);
         }
+        return SUCCESS;
     }
-
-    cmd_count += num_commands;
-    arg_count += count_arguments(commands, num_commands);
-
-    for (int i = 0; i < num_commands && !run_in_background; i++) {
-        free(commands[i]);
-    }
-
-    int status, exit_value = 0;
-
-    //for (int i = 0; i < num_commands && !run_in_background; i++) {
-    if (!run_in_background) {
-        if (waitpid(pid, &status, WUNTRACED) == -1) {
-            perror("waitpid() failed here\n");
-            //return SYSTEM_FAILURES;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], "-r") == 0)
+            clear_hashed_commands();
+        else if (strchr(names[i], '/') != NULL || hash_command(names[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", names[i]);
+            last_status = 1;
         }
     }
-//        if (WIFEXITED(status)) {
-//            if ((exit_value = WEXITSTATUS(status)) > 0) {
-//                printf("invalid command\n");
-//                cmd_count--;
-//                arg_count -= exit_value;
-//            }
-//        }
-
-    return INVALID_INPUT;
+    return SUCCESS;
 }
 
+/********************************************* ARENA ALLOCATOR ****************************************************************/
+//an arena hands out memory from big chunks, and frees everything at once.
+//memory never moves after it was handed out, so pointers into the arena stay valid until it's reset or freed
 
-//remove redundant spaces and quotes between words in an input string
-void remove_spaces_and_quotes(char *str) {
-    if (str == NULL)
-        return;
-    char temp[strlen(str)];
-    char before = str[0];
-    int index = 0;
-    for (int i = 0; str[i] != 0; i++) {
-        if ((str[i] != SPACE_CHAR || before != SPACE_CHAR) && str[i] != '"')
-            temp[index++] = str[i];
-        before = str[i];
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1); //keep the next allocation aligned for pointers
+    if (a->head == NULL || a->head->used + size > a->head->size) {
+        size_t chunk_size = a->head == NULL ? ARENA_CHUNK_SIZE : a->head->size * 2;
+        while (chunk_size < size)
+            chunk_size *= 2;
+        struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + chunk_size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = a->head;
+        a->head = chunk;
     }
-    if (index > 0 && temp[index - 1] == SPACE_CHAR)
-        index--;
+    void *ptr = a->head->data + a->head->used;
+    a->head->used += size;
+    a->used += size;
+    return ptr;
+}
+
+char *arena_strndup(struct arena *a, const char *str, size_t len) {
+    char *copy = arena_alloc(a, len + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, str, len);
+    copy[len] = 0;
+    return copy;
+}
 
-    temp[index] = 0;  // Add a null terminator to the end of the new string
-    strcpy(str, temp);
+char *arena_strdup(struct arena *a, const char *str) {
+    return arena_strndup(a, str, strlen(str));
 }
 
-void remove_quotes(char *str) {
-    if (str == NULL)
+//frees everything that was allocated, but keeps the newest (biggest) chunk for the next allocations
+void arena_reset(struct arena *a) {
+    if (a->head == NULL)
         return;
-    char temp[strlen(str)];
-    int index = 0;
-    for (int i = 0; str[i] != 0; i++) {
-        if (str[i] != '"')
-            temp[index++] = str[i];
+    struct arena_chunk *chunk = a->head->next;
+    while (chunk != NULL) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
-    temp[index] = 0;  // Add a null terminator to the end of the new string
-    strcpy(str, temp);
+    a->head->next = NULL;
+    a->head->used = 0;
+    a->used = 0;
 }
 
-//check if there aren't any spaces between name to value (should use sscanf(), but it made too much problems)
-int is_assignment(char *name, char *value) {
-    if (name == NULL || value == NULL)
-        return 0;
+void arena_mark(struct arena *a, struct arena_mark *mark) {
+    mark->head = a->head;
+    mark->head_used = a->head != NULL ? a->head->used : 0;
+    mark->used = a->used;
+}
 
-    while (*(name) == SPACE_CHAR)
-        name++;
-    for (char *i = name + 1; i <= value; i++) {
-        if (*(i) == SPACE_CHAR) {
-            printf("%c\n", *i);
-            printf("there is no command %s\n", name);
-            return 0;
-        }
+//frees the chunks that were added after the mark. like arena_reset(), the first chunk is always kept
+void arena_release(struct arena *a, struct arena_mark *mark) {
+    while (a->head != mark->head && a->head->next != NULL) {
+        struct arena_chunk *next = a->head->next;
+        free(a->head);
+        a->head = next;
     }
-    return 1;
+    if (a->head != NULL)
+        a->head->used = a->head == mark->head ? mark->head_used : 0;
+    a->used = mark->used;
 }
 
-//initialise argv[] for echo command. its major value is to treat "input in" as one string, and 'input in' as some. also remove quotes
-int deal_with_echo(char *command, char *argv[12], int *args_index) {
-    int i = 0; // Index variable for argv
-    int in_quotes = 0; // Flag to indicate whether the program is currently inside quotes
-    char *start_word, *end_word; // Pointers to the start & the end of the current word
-    char *var_value;//if there is an environment variable,it holds its value
-
-    // Parse the input string
-    start_word = command;
-    end_word = command;
-    while (*end_word != '\0') {
-        // Skip leading spaces
-        while (*start_word == ' ') {
-            start_word++;
-            end_word++;
-        }
-        // Check for quotes
-        if (*start_word == '\"') {
-            in_quotes = 1;
-            start_word++;
-        }
-        // Find the end of the current word
-        end_word = start_word;
-        while (*end_word != '\0' && (*end_word != ' ' || in_quotes)) {
-            if (*end_word == '\"') {
-                in_quotes = !in_quotes;
-            }
-            end_word++;
-        }
-        // Copy the current word to the array
-        int word_length = end_word - start_word;
+void arena_free(struct arena *a) {
+    arena_reset(a);
+    free(a->head);
+    a->head = NULL;
+}
 
-        if (word_length > 0) {
-            argv[i] = (char *) malloc((word_length + 1) * sizeof(char));
-            if (argv[i] == NULL) {
-                printf("Error: malloc failed\n");
-                return SYSTEM_FAILURES;
-            }
-            strncpy(argv[i], start_word, word_length);
-            argv[i][word_length] = '\0';
+/********************************************* ENVIRONMENT VARIABLES MANAGEMENT ****************************************************************/
+//the variables live in an open-addressing hash table (linear probing), which grows when it's half full.
+//names & values are copied into one arena. a value that is replaced by a longer one leaves garbage in it,
+//and when the garbage is the bigger part of the arena, the live strings are copied into a new one
 
-            if (strlen(argv[i]) > 1 && (*start_word) == '$' && argv[i][1] != '"' &&
-                argv[i][1] != ' ') {//maybe it's a shell variable
-                char *q = strchr(argv[i], '"'); //need to cover: <var_name>"gibberish" without spaces
-                int after_name_ind = word_length;
-                if (q != NULL) {
-                    after_name_ind = q - argv[i];
-                    (*q) = 0;
-                }
+//an entry in j can be moved back to the hole in i only if its home slot isn't between the hole & j (cyclically)
+int can_fill_slot(int hole, int j, int home) {
+    if (j > hole)
+        return home <= hole || home > j;
+    return home <= hole && home > j;
+}
 
-                var_value = my_getenv(argv[i] + 1);
-                if (var_value != NULL) {//it's an environment variable!
-                    free(argv[i]);
+//returns the slot of name's entry of that kind, or the empty slot where it should be inserted
+int find_env_slot(char *name, unsigned long hash, int kind) {
+    int mask = env_var_capacity - 1;
+    int i = (int) (hash & mask);
+    while (env_vars[i].name != NULL &&
+           (env_vars[i].hash != hash || env_vars[i].kind != kind || strcmp(env_vars[i].name, name) != 0))
+        i = (i + 1) & mask;
+    return i;
+}
 
-                    argv[i] = (char *) malloc((strlen(var_value) + (word_length - after_name_ind)) * sizeof(char));
-                    if (argv[i] == NULL) {
-                        printf("Error: malloc failed\n");
-                        return SYSTEM_FAILURES;
-                    }
-                    strcpy(argv[i], var_value);
-                    if (q != NULL) {
-                        char p = (*end_word);
-                        (*end_word = 0);//so it will copy only till the end of the word
-                        strcat(argv[i], start_word + after_name_ind);
-                        (*end_word) = p;
-                    }
-                } else
-                    strcpy(argv[i], " "); //print space only
-            }
-            remove_quotes(argv[i]);
-
-            if (strchr(argv[i], '>') != NULL) {
-                char copy[(strlen(argv[i]))];
-                strcpy(copy, argv[i]);
-                free(argv[i]);
-                divide_string(copy, &argv[i], &argv[i + 1], &argv[i + 2], &i);
-                //divide-string increases the counter
-            } else
-                i++;
+int grow_env_vars() {
+    int old_capacity = env_var_capacity;
+    struct env_var *old = env_vars;
 
-            // Handle too many words in the input string: echo + strings
-            if (i > MAX_ARGS) {
-                printf("Error: Too many words in input string\n");
-                argv[i] = NULL;
-                return INVALID_INPUT;
-            }
-        }
-        start_word = end_word;  // Move to the next word
+    env_var_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    env_vars = calloc(env_var_capacity, sizeof(struct env_var));
+    if (env_vars == NULL) {
+        fprintf(stderr, "Error: failed to allocate memory for environment variables\n");
+        env_vars = old;
+        env_var_capacity = old_capacity;
+        return SYSTEM_FAILURES;
     }
-
-    // Handle unbalanced quotes at end of string
-    if (in_quotes != 0) {
-        printf("Error: Unbalanced quotes in input string\n");
-        argv[i] = NULL;
-        return INVALID_INPUT;
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].name != NULL)
+            env_vars[find_env_slot(old[i].name, old[i].hash, old[i].kind)] = old[i];
     }
-
-    *(args_index) = i;  // Update number of arguments
+    free(old);
     return SUCCESS;
 }
 
-//divide string according to '>'(write to file) character
-void divide_string(char *str, char **first, char **second, char **third, int *arg_index) {
-    char copy_str[strlen(str)];
-    strcpy(copy_str, str);
-    char *ptr = strchr(copy_str, '>');
-    if (ptr == NULL) {
-        // ">" not found in string
-        *first = strdup(copy_str);
-        (*arg_index)++;
-    } else {
-        *ptr = '\0'; // replace ">" with null character
-        if (ptr == copy_str) {
-            // ">" is first character in string
-            *first = strdup(">");
-            if (strcmp(str, ">") == 0) { //use str because copy_str was changed
-                (*arg_index)++;
-                return;
-            }
-            *second = strdup(ptr + 1);
-            (*arg_index) += 2;
-        } else if (ptr == copy_str + strlen(str) - 1) { //use str because copy_str was changed
-            // ">" is last character in string
-            *first = strdup(copy_str);
-            *second = strdup(">");
-            (*arg_index) += 2;
-            // *ptr = '\0'; // replace ">" with null character
-        } else {
-            // ">" is in the middle of the string
-            *first = strdup(copy_str);
-            *second = strdup(">");
-            *third = strdup(ptr + 1);
-            (*arg_index) += 3;
+//copies the live names & values into a new arena & frees the old one with all its garbage
+int compact_env_strings() {
+    struct arena compacted = {NULL, 0};
+    for (int i = 0; i < env_var_capacity; i++) {
+        if (env_vars[i].name == NULL)
+            continue;
+        char *name = arena_strdup(&compacted, env_vars[i].name);
+        char *value = arena_strdup(&compacted, env_vars[i].value);
+        if (name == NULL || value == NULL) {
+            arena_free(&compacted); //the old arena is still complete
+            return SYSTEM_FAILURES;
         }
+        env_vars[i].name = name;
+        env_vars[i].value = value;
     }
+    arena_free(&env_strings);
+    env_strings = compacted;
+    env_garbage = 0;
+    return SUCCESS;
 }
 
-int count_arguments(char **arr, int n) {
-    int count = 0;
-    int in_quote = 0;
-    for (int i = 0; i < n; i++) {
-        char *str = arr[i];
-        int len = strlen(str);
-        for (int j = 0; j < len; j++) {
-            if (str[j] == '"') {
-                in_quote = !in_quote;
-            } else if (!in_quote && str[j] == ' ') {
-                count++;
-            }
-            if (str[j] == '>') {//count > argument
-                if (str[j - 1] != ' ' && str[j + 1] != ' ')
-                    count += 2;
-                else if (str[j - 1] != ' ' || str[j + 1] != ' ')
-                    count += 1;
-            }
+//The setenv() function takes a name and a value as arguments, and searches through the existing environment variables to see if the name already exists.
+// If it does, the value is updated; if not, a new variable is added to the table.
+//a value returned by my_getenv() is valid only until the next my_setenv() or my_unsetenv().
+//PATH is also copied to the real environment, so the commands & the command path cache see the new value
+int my_setenv(char *name, char *value) {
+    if (strcmp(name, "PATH") == 0 && setenv("PATH", value, 1) == -1) {
+        perror("setenv");
+        return SYSTEM_FAILURES;
+    }
+    return set_env_entry(name, ENTRY_VARIABLE, value) == -1 ? SYSTEM_FAILURES : SUCCESS;
+}
+
+//sets the value of the entry (a new one has no definition), and returns its slot, or -1 if there's no memory
+int set_env_entry(char *name, int kind, char *value) {
+    unsigned long hash = hash_string(name);
+    int i;
+    if ((env_var_count + 1) * 2 > env_var_capacity && grow_env_vars() == SYSTEM_FAILURES)
+        return -1;
+
+    i = find_env_slot(name, hash, kind);
+    if (env_vars[i].name != NULL) { //update the existing value
+        size_t old_len = strlen(env_vars[i].value);
+        if (strlen(value) <= old_len) { //fits in the old place. the bytes after it are garbage from now on
+            strcpy(env_vars[i].value, value);
+            env_garbage += old_len - strlen(value);
+            return i;
+        }
+        char *copy = arena_strdup(&env_strings, value);  // allocate new value
+        if (copy == NULL) {
+            fprintf(stderr, "Error: failed to allocate memory for environment variable value\n");
+            return -1;
+        }
+        env_vars[i].value = copy;
+        env_garbage += old_len + 1;
+    } else {
+        env_vars[i].name = arena_strdup(&env_strings, name);  // allocate name
+        if (env_vars[i].name == NULL) {
+            fprintf(stderr, "Error: failed to allocate memory for environment variable name\n");
+            return -1;
         }
-        if (!in_quote && len > 0 && str[len - 1] != ' ') {
-            count++; // count last word in string
+        env_vars[i].value = arena_strdup(&env_strings, value);  // allocate value
+        if (env_vars[i].value == NULL) {
+            fprintf(stderr, "Error: failed to allocate memory for environment variable value\n");
+            env_vars[i].name = NULL; //the name stays in the arena as garbage
+            return -1;
         }
+        env_vars[i].hash = hash;
+        env_vars[i].kind = kind;
+        env_vars[i].definition = NULL;
+        env_var_count++;
     }
-    return count;
+    if (env_garbage > ARENA_CHUNK_SIZE && env_garbage * 2 > env_strings.used)
+        compact_env_strings(); //if it fails the variables are still fine, only the garbage stays
+    return i;
 }
 
-void catch_child(int sig) {
-    signal(SIGCHLD, catch_child);
-    waitpid(-1, NULL, WNOHANG);
+//takes a name as an argument, finds the matching name in the table, and returns the corresponding value.
+char *my_getenv(char *name) {
+    if (env_var_count == 0)
+        return NULL;
+    int i = find_env_slot(name, hash_string(name), ENTRY_VARIABLE);
+    return env_vars[i].value == NULL ? NULL : env_vars[i].value;
 }
 
+//a setting of the shell (PIPE_METER, BG_LIMIT...): the shell variable, or the environment's if there's no such
+//variable - so 'PIPE_METER=1 ./ex1 script.sh' works too. the variables aren't imported from the environment
+char *get_option(char *name) {
+    char *value = my_getenv(name);
+    return value != NULL ? value : getenv(name);
+}
 
-void catch_stop(int sig) {
-    signal(SIGTSTP, catch_stop);
-    if ((waitpid(run_now, NULL, WNOHANG)) == 0) //there is a killed child
-        stopped_process = run_now;
-    //kill(run_now, SIGTSTP);  // don't need to send signal - they are all from the same group
+void my_unsetenv(char *name) {
+    if (strcmp(name, "PATH") == 0 && my_getenv(name) != NULL)
+        unsetenv("PATH");
+    unset_env_entry(name, ENTRY_VARIABLE);
 }
 
-/********************************************* ENVIRONMENT VARIABLES MANAGEMENT ****************************************************************/
-//The setenv() function takes a name and a value as arguments, and searches through the existing environment variables to see if the name already exists.
-// If it does, the value is updated; if not, a new variable is added to the end of the list
-int my_setenv(char *name, char *value) {
-    int i;
-    for (i = 0; i < env_var_count; i++) {
-        if (strcmp(env_vars[i].name, name) == 0) {
-            free(env_vars[i].value);  // free existing value
-            env_vars[i].value = strdup(value);  // allocate new value
-            return SUCCESS;
-        }
-    }
-    if (env_var_count >= MAX_ENV_VARS) {
-        fprintf(stderr, "Error: maximum number of environment variables exceeded\n");
-        return SYSTEM_FAILURES;
-    }
-    env_vars[env_var_count].name = strdup(name);  // allocate name
-    if (env_vars[env_var_count].name == NULL) {
-        fprintf(stderr, "Error: failed to allocate memory for environment variable name\n");
-        return SYSTEM_FAILURES;
-    }
-    env_vars[env_var_count].value = strdup(value);  // allocate value
-    if (env_vars[env_var_count].value == NULL) {
-        fprintf(stderr, "Error: failed to allocate memory for environment variable value\n");
-        free(env_vars[env_var_count].name);  // free name
-        return SYSTEM_FAILURES;
+//removes the entry (& its definition), and moves back the entries of its probe chain so no lookup stops at the hole
+void unset_env_entry(char *name, int kind) {
+    if (env_var_count == 0)
+        return;
+    int mask = env_var_capacity - 1;
+    int i = find_env_slot(name, hash_string(name), kind);
+    if (env_vars[i].name == NULL) //there is no such entry
+        return;
+    if (env_vars[i].definition != NULL) {
+        free_definition(env_vars[i].definition);
+        function_count -= kind == ENTRY_FUNCTION;
+        alias_count -= kind == ENTRY_ALIAS;
     }
-    env_var_count++;
-    return SUCCESS;
-}
 
-//takes a name as an argument, and searches through the environment variables to find the matching name, and returns the corresponding value.
-char *my_getenv(char *name) {
-    int i;
-    for (i = 0; i < env_var_count; i++) {
-        if (strcmp(env_vars[i].name, name) == 0) {
-            return env_vars[i].value;
+    env_garbage += strlen(env_vars[i].name) + strlen(env_vars[i].value) + 2;
+    env_vars[i].name = env_vars[i].value = NULL;
+    env_vars[i].definition = NULL;
+    env_var_count--;
+    for (int j = (i + 1) & mask; env_vars[j].name != NULL; j = (j + 1) & mask) {
+        if (can_fill_slot(i, j, (int) (env_vars[j].hash & mask))) {
+            env_vars[i] = env_vars[j];
+            env_vars[j].name = env_vars[j].value = NULL;
+            env_vars[j].definition = NULL;
+            i = j;
         }
     }
-    return NULL;
 }
 
 void free_env_vars() { //frees the data structure
-    int i;
-    for (i = 0; i < env_var_count; i++) {
-        free(env_vars[i].name);
-        free(env_vars[i].value);
+    clear_hashed_commands();
+    for (int i = 0; i < env_var_capacity; i++) {
+        if (env_vars[i].name != NULL && env_vars[i].definition != NULL)
+            free_definition(env_vars[i].definition);
     }
-    env_var_count = 0;
+    function_count = alias_count = 0;
+    free(env_vars);
+    env_vars = NULL;
+    env_var_capacity = env_var_count = 0;
+    arena_free(&env_strings);
+    env_garbage = 0;
 }
-
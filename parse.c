@@ -0,0 +1,1062 @@
+/*
+the parser of the shell: one pass over the line splits it into words & operators, and builds the tree on the way
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+
+//the operators, and what isn't one
+#define OP_NONE -1
+#define OP_SEMICOLON 0
+#define OP_PIPE 1
+#define OP_REDIRECT 2
+#define OP_BACKGROUND 3
+#define OP_AND 4
+#define OP_OR 5
+
+//the part of a compound command the next node (or word) goes into
+#define PART_LIST 0 //the line itself
+#define PART_COND 1 //between if/while/until and then/do
+#define PART_BODY 2 //between then/do and elif/else/fi/done
+#define PART_OTHER 3 //between else and fi
+#define PART_FUNCTION 4 //after name(): {
+#define PART_FOR_NAME 5 //after for: the name of the variable
+#define PART_FOR_IN 6 //after the name: in or do
+#define PART_FOR_WORDS 7 //after in: the words, up to ; or a newline
+#define PART_FOR_DO 8 //after the words: do
+
+//the reserved words, which are recognized only at the beginning of a command
+#define KEYWORD_NONE -1
+#define KEYWORD_IF 0
+#define KEYWORD_THEN 1
+#define KEYWORD_ELIF 2
+#define KEYWORD_ELSE 3
+#define KEYWORD_FI 4
+#define KEYWORD_WHILE 5
+#define KEYWORD_UNTIL 6
+#define KEYWORD_FOR 7
+#define KEYWORD_DO 8
+#define KEYWORD_DONE 9
+#define KEYWORD_OPEN_BRACE 10
+#define KEYWORD_CLOSE_BRACE 11
+
+int is_blank(char c);
+
+int operator_type(char c);
+
+int operator_at(const char *s, int *type, int *len);
+
+const char *substitution_end(const char *s);
+
+int reserve(void **array, int count, int *capacity, size_t size);
+
+int add_word(struct parser *parser, struct parse_state *state, struct word *w);
+
+int keyword_type(struct word *w);
+
+int add_keyword(struct parser *parser, struct parse_state *state, int keyword);
+
+int add_for_word(struct parser *parser, struct frame *frame, struct word *w);
+
+int add_node(struct parser *parser, struct parse_state *state, int type);
+
+int open_compound(struct parser *parser, struct parse_state *state, int type, int part);
+
+int syntax_error(struct parser *parser, const char *error);
+
+int is_function_header(struct word *w);
+
+int copy_list(struct parser *to, const struct parser *from, int first);
+
+int copy_pipeline(struct parser *to, const struct parser *from, int index);
+
+int copy_word(struct parser *to, const struct parser *from, const struct word *w, struct word *copy);
+
+int copy_words(struct parser *to, const struct parser *from, int first, int count);
+
+size_t packed_arrays_size(const struct parser *tree);
+
+char *pack_text(const char *text, char *to, size_t *used);
+
+int unpack_array(void **array, int count, size_t size, const char *block, size_t *at);
+
+int unpack_text(char **text, struct parser *to, size_t text_size);
+
+int check_tree(const struct parser *tree);
+
+int check_word(const struct parser *tree, const struct word *w);
+
+int in_range(int first, int count, int size);
+
+int is_forward_link(int link, int from, int count);
+
+int add_redirection(struct parser *parser, struct parse_state *state, int type, struct word *target);
+
+int add_operator(struct parser *parser, struct parse_state *state, int op, int type);
+
+int after_pipe(struct parser *parser, struct parse_state *state);
+
+int start_pipeline(struct parser *parser, struct parse_state *state);
+
+int start_command(struct parser *parser, struct parse_state *state);
+
+void end_command(struct parser *parser, struct parse_state *state);
+
+int end_pipeline(struct parser *parser, struct parse_state *state, int background);
+
+int end_line(struct parser *parser, struct parse_state *state);
+
+/*nothing is copied: a word's quotes are removed by moving the rest of the word back over them,
+ and the word is null terminated in place. quotes keep spaces & operators inside a word ("a b;c" is one word).
+ the $NAME references of every word are recorded on the way, so expanding them doesn't scan the word again.
+ a command substitution is kept as it was written (its quotes belong to the command inside it), and is parsed
+ only when it's run*/
+int parse_line(struct parser *parser, char *line) {
+    parser->pipeline_count = parser->command_count = parser->word_count = 0;
+    parser->redirection_count = parser->var_count = parser->heredoc_count = 0;
+    parser->node_count = parser->frame_count = 0;
+    parser->root = -1;
+    if (!reserve((void **) &parser->frames, parser->frame_count, &parser->frame_capacity, sizeof(struct frame)))
+        return PARSE_NO_MEMORY;
+    parser->frames[parser->frame_count++] = (struct frame) {-1, PART_LIST, -1};
+    parser->state = (struct parse_state) {-1, -1, REDIRECT_NONE, CONNECT_ALWAYS};
+    return parse_more(parser, line);
+}
+
+int parse_more(struct parser *parser, char *line) {
+    char *read = line, *write; //quotes are skipped by read, so write stays behind it
+    struct parse_state local = parser->state, *state = &local; //kept in the parser only between lines
+    struct word w;
+    int in_quotes, op, type, len, ret;
+    const char *end;
+    char c;
+
+    parser->error = NULL;
+    while (1) {
+        while (is_blank(*read))
+            read++;
+        if (*read == 0)
+            break;
+        if ((op = operator_at(read, &type, &len)) != OP_NONE) {
+            read += len;
+            if ((ret = add_operator(parser, state, op, type)) != PARSE_OK)
+                return ret;
+            continue;
+        }
+        //a word
+        in_quotes = 0;
+        w.text = write = read;
+        w.first_var = parser->var_count;
+        w.var_count = 0;
+        w.quoted = 0;
+        while (*read != 0 && (in_quotes || (!is_blank(*read) && operator_type(*read) == OP_NONE))) {
+            if (*read == '"') {
+                in_quotes = !in_quotes;
+                w.quoted = 1;
+                read++;
+            } else if (*read == '$' && (is_name_char(read[1], 1) || is_special_parameter(read[1]))) {
+                if (!reserve((void **) &parser->vars, parser->var_count, &parser->var_capacity, sizeof(struct var_ref)))
+                    return PARSE_NO_MEMORY;
+                struct var_ref *ref = &parser->vars[parser->var_count++];
+                ref->offset = write - w.text;
+                *write++ = *read++;
+                if (is_special_parameter(*read))
+                    *write++ = *read++;
+                else {
+                    while (is_name_char(*read, 0))
+                        *write++ = *read++;
+                }
+                ref->len = (write - w.text) - ref->offset - 1;
+                ref->type = VAR_NAME;
+                ref->quoted = in_quotes;
+                w.var_count++;
+            } else if ((*read == '$' && read[1] == '(') || *read == '`') {
+                if ((end = substitution_end(read)) == NULL) {
+                    parser->error = *read == '`' ? "Error: Unbalanced quotes in input string"
+                                                 : "Error: Unbalanced parentheses in input string";
+                    return PARSE_ERROR;
+                }
+                if (!reserve((void **) &parser->vars, parser->var_count, &parser->var_capacity, sizeof(struct var_ref)))
+                    return PARSE_NO_MEMORY;
+                struct var_ref *ref = &parser->vars[parser->var_count++];
+                ref->offset = write - w.text;
+                ref->len = end - read;
+                ref->type = VAR_COMMAND;
+                ref->quoted = in_quotes;
+                while (read <= end)
+                    *write++ = *read++;
+                w.var_count++;
+            } else
+                *write++ = *read++;
+        }
+        if (in_quotes) {
+            parser->error = "Error: Unbalanced quotes in input string";
+            return PARSE_ERROR;
+        }
+        //what ended the word must be read before the null terminator may overwrite it
+        c = *read;
+        op = operator_at(read, &type, &len);
+        *write = 0;
+        if ((ret = add_word(parser, state, &w)) != PARSE_OK)
+            return ret;
+        if (c == 0)
+            break;
+        if (op == OP_NONE) {
+            read++;
+            continue;
+        }
+        read += len;
+        if ((ret = add_operator(parser, state, op, type)) != PARSE_OK)
+            return ret;
+    }
+    parser->line_len = read - line;
+    ret = end_line(parser, state);
+    parser->state = local;
+    return ret;
+}
+
+//a newline ends the pipeline & the words of a for. the line is incomplete if a compound command or && / || is open
+int end_line(struct parser *parser, struct parse_state *state) {
+    struct frame *frame = &parser->frames[parser->frame_count - 1];
+
+    if (after_pipe(parser, state))
+        return syntax_error(parser, "Error: Unexpected end of input after '|'");
+    if (end_pipeline(parser, state, 0) != PARSE_OK)
+        return PARSE_NO_MEMORY;
+    if (frame->part == PART_FOR_IN || frame->part == PART_FOR_WORDS)
+        frame->part = PART_FOR_DO;
+    return parser->frame_count > 1 || state->connector != CONNECT_ALWAYS ? PARSE_INCOMPLETE : PARSE_OK;
+}
+
+void move_line(struct parser *parser, const char *from, char *to) {
+    for (int i = 0; i < parser->word_count; i++) {
+        if (parser->words[i].text >= from && parser->words[i].text <= from + parser->line_len)
+            parser->words[i].text = to + (parser->words[i].text - from);
+    }
+    for (int i = 0; i < parser->redirection_count; i++) {
+        struct word *target = &parser->redirections[i].target;
+        if (target->text != NULL && target->text >= from && target->text <= from + parser->line_len)
+            target->text = to + (target->text - from);
+    }
+}
+
+void free_parser(struct parser *parser) {
+    free(parser->pipelines);
+    free(parser->commands);
+    free(parser->words);
+    free(parser->redirections);
+    free(parser->vars);
+    free(parser->nodes);
+    free(parser->frames);
+    free(parser->text);
+    memset(parser, 0, sizeof(struct parser));
+}
+
+int copy_tree(struct parser *to, const struct parser *from, int first) {
+    size_t size = 1;
+    char *end;
+
+    if ((to->root = copy_list(to, from, first)) == -2)
+        return PARSE_NO_MEMORY;
+    for (int i = 0; i < to->word_count; i++)
+        size += strlen(to->words[i].text) + 1;
+    for (int i = 0; i < to->redirection_count; i++)
+        size += to->redirections[i].target.text != NULL ? strlen(to->redirections[i].target.text) + 1 : 0;
+    if ((to->text = end = malloc(size)) == NULL)
+        return PARSE_NO_MEMORY;
+    for (int i = 0; i < to->word_count; i++) {
+        char *text = end;
+        end = stpcpy(end, to->words[i].text) + 1;
+        to->words[i].text = text;
+    }
+    for (int i = 0; i < to->redirection_count; i++) {
+        struct word *target = &to->redirections[i].target;
+        if (target->text == NULL)
+            continue;
+        char *text = end;
+        end = stpcpy(end, target->text) + 1;
+        target->text = text;
+    }
+    return PARSE_OK;
+}
+
+//copies the nodes of a list & returns the index of the first copy: -1 for an empty list, -2 if there's no memory
+int copy_list(struct parser *to, const struct parser *from, int first) {
+    int head = -1, prev = -1, index, part;
+
+    for (; first != -1; first = from->nodes[first].next) {
+        const struct node *node = &from->nodes[first];
+        if (!reserve((void **) &to->nodes, to->node_count, &to->node_capacity, sizeof(struct node)))
+            return -2;
+        index = to->node_count++;
+        to->nodes[index] = *node;
+        to->nodes[index].next = -1;
+        if (prev != -1)
+            to->nodes[prev].next = index;
+        else
+            head = index;
+        prev = index;
+
+        //the indices change, and the array may move while the parts are copied, so nothing is kept as a pointer
+        if (node->type == NODE_PIPELINE && (to->nodes[index].pipeline = copy_pipeline(to, from, node->pipeline)) == -1)
+            return -2;
+        if (node->type == NODE_FOR || node->type == NODE_FUNCTION) {
+            int count = node->type == NODE_FOR && node->word_count > 0 ? node->word_count + 1 : 1;
+            if ((to->nodes[index].first_word = copy_words(to, from, node->first_word, count)) == -1)
+                return -2;
+        }
+        if ((part = copy_list(to, from, node->cond)) == -2)
+            return -2;
+        to->nodes[index].cond = part;
+        if ((part = copy_list(to, from, node->body)) == -2)
+            return -2;
+        to->nodes[index].body = part;
+        if ((part = copy_list(to, from, node->other)) == -2)
+            return -2;
+        to->nodes[index].other = part;
+    }
+    return head;
+}
+
+//returns the index of the copy, -1 if there's no memory
+int copy_pipeline(struct parser *to, const struct parser *from, int index) {
+    const struct pipeline *pipeline = &from->pipelines[index];
+
+    if (!reserve((void **) &to->pipelines, to->pipeline_count, &to->pipeline_capacity, sizeof(struct pipeline)))
+        return -1;
+    to->pipelines[to->pipeline_count] = *pipeline;
+    to->pipelines[to->pipeline_count].first_command = to->command_count;
+    for (int i = 0; i < pipeline->command_count; i++) {
+        const struct command *command = &from->commands[pipeline->first_command + i];
+        if (!reserve((void **) &to->commands, to->command_count, &to->command_capacity, sizeof(struct command)))
+            return -1;
+        struct command copy = *command;
+        if ((copy.first_word = copy_words(to, from, command->first_word, command->word_count)) == -1)
+            return -1;
+        copy.first_redirection = to->redirection_count;
+        for (int j = 0; j < command->redirection_count; j++) {
+            const struct redirection *r = &from->redirections[command->first_redirection + j];
+            if (!reserve((void **) &to->redirections, to->redirection_count, &to->redirection_capacity,
+                         sizeof(struct redirection)))
+                return -1;
+            struct redirection *r_copy = &to->redirections[to->redirection_count++];
+            r_copy->type = r->type;
+            if (copy_word(to, from, &r->target, &r_copy->target) != PARSE_OK)
+                return -1;
+            to->heredoc_count += r->type == REDIRECT_HEREDOC;
+        }
+        to->commands[to->command_count++] = copy;
+    }
+    return to->pipeline_count++;
+}
+
+//the counts of a packed tree's arrays, which follow it in this order, and then the text.
+//in the packed arrays a text is the offset of its string in the text + 1, 0 for NULL
+struct packed_tree {
+    int pipeline_count, command_count, word_count, redirection_count, var_count, node_count;
+    int heredoc_count;
+    int root;
+    size_t text_size;
+};
+
+size_t packed_size(const struct parser *tree) {
+    size_t size = packed_arrays_size(tree);
+    for (int i = 0; i < tree->word_count; i++)
+        size += strlen(tree->words[i].text) + 1;
+    for (int i = 0; i < tree->redirection_count; i++)
+        size += tree->redirections[i].target.text != NULL ? strlen(tree->redirections[i].target.text) + 1 : 0;
+    for (int i = 0; i < tree->command_count; i++)
+        size += tree->commands[i].error != NULL ? strlen(tree->commands[i].error) + 1 : 0;
+    return size;
+}
+
+//the header & the arrays of a packed tree, without the text
+size_t packed_arrays_size(const struct parser *tree) {
+    return sizeof(struct packed_tree) + tree->pipeline_count * sizeof(struct pipeline) +
+           tree->command_count * sizeof(struct command) + tree->word_count * sizeof(struct word) +
+           tree->redirection_count * sizeof(struct redirection) + tree->var_count * sizeof(struct var_ref) +
+           tree->node_count * sizeof(struct node);
+}
+
+//the block has packed_size() bytes. everything is memcpy()ed into it, so it doesn't have to be aligned
+void pack_tree(const struct parser *tree, char *block) {
+    struct packed_tree header = {tree->pipeline_count, tree->command_count, tree->word_count,
+                                 tree->redirection_count, tree->var_count, tree->node_count,
+                                 tree->heredoc_count, tree->root, 0};
+    char *text = block + packed_arrays_size(tree), *at = block + sizeof(header);
+    struct command c;
+    struct word w;
+    struct redirection r;
+
+    if (tree->pipeline_count > 0) //an empty array may be NULL
+        memcpy(at, tree->pipelines, tree->pipeline_count * sizeof(struct pipeline));
+    at += tree->pipeline_count * sizeof(struct pipeline);
+    for (int i = 0; i < tree->command_count; i++, at += sizeof(c)) {
+        c = tree->commands[i];
+        c.error = pack_text(c.error, text, &header.text_size);
+        memcpy(at, &c, sizeof(c));
+    }
+    for (int i = 0; i < tree->word_count; i++, at += sizeof(w)) {
+        w = tree->words[i];
+        w.text = pack_text(w.text, text, &header.text_size);
+        memcpy(at, &w, sizeof(w));
+    }
+    for (int i = 0; i < tree->redirection_count; i++, at += sizeof(r)) {
+        r = tree->redirections[i];
+        r.target.text = pack_text(r.target.text, text, &header.text_size);
+        memcpy(at, &r, sizeof(r));
+    }
+    if (tree->var_count > 0)
+        memcpy(at, tree->vars, tree->var_count * sizeof(struct var_ref));
+    at += tree->var_count * sizeof(struct var_ref);
+    if (tree->node_count > 0)
+        memcpy(at, tree->nodes, tree->node_count * sizeof(struct node));
+    memcpy(block, &header, sizeof(header));
+}
+
+//copies text to to[*used..], and returns where it is as a packed text
+char *pack_text(const char *text, char *to, size_t *used) {
+    size_t offset = *used;
+    if (text == NULL)
+        return NULL;
+    strcpy(to + offset, text);
+    (*used) += strlen(text) + 1;
+    return (char *) (offset + 1);
+}
+
+int unpack_tree(struct parser *to, const char *block, size_t size) {
+    struct packed_tree header;
+    size_t at = sizeof(header);
+    char *error;
+
+    memset(to, 0, sizeof(struct parser));
+    if (size < sizeof(header))
+        return PARSE_ERROR;
+    memcpy(&header, block, sizeof(header));
+    if (header.pipeline_count < 0 || header.command_count < 0 || header.word_count < 0 ||
+        header.redirection_count < 0 || header.var_count < 0 || header.node_count < 0 || header.text_size > size)
+        return PARSE_ERROR;
+    to->pipeline_count = to->pipeline_capacity = header.pipeline_count;
+    to->command_count = to->command_capacity = header.command_count;
+    to->word_count = to->word_capacity = header.word_count;
+    to->redirection_count = to->redirection_capacity = header.redirection_count;
+    to->var_count = to->var_capacity = header.var_count;
+    to->node_count = to->node_capacity = header.node_count;
+    to->heredoc_count = header.heredoc_count;
+    to->root = header.root;
+    if (packed_arrays_size(to) + header.text_size != size ||
+        (header.text_size > 0 && block[size - 1] != 0)) { //every text ends inside the block
+        memset(to, 0, sizeof(struct parser));
+        return PARSE_ERROR;
+    }
+    if (!unpack_array((void **) &to->pipelines, header.pipeline_count, sizeof(struct pipeline), block, &at) ||
+        !unpack_array((void **) &to->commands, header.command_count, sizeof(struct command), block, &at) ||
+        !unpack_array((void **) &to->words, header.word_count, sizeof(struct word), block, &at) ||
+        !unpack_array((void **) &to->redirections, header.redirection_count, sizeof(struct redirection), block, &at) ||
+        !unpack_array((void **) &to->vars, header.var_count, sizeof(struct var_ref), block, &at) ||
+        !unpack_array((void **) &to->nodes, header.node_count, sizeof(struct node), block, &at) ||
+        (to->text = malloc(header.text_size + 1)) == NULL) {
+        free_parser(to);
+        return PARSE_NO_MEMORY;
+    }
+    memcpy(to->text, block + at, header.text_size);
+    for (int i = 0; i < to->command_count; i++) {
+        error = (char *) to->commands[i].error;
+        if (!unpack_text(&error, to, header.text_size))
+            return free_parser(to), PARSE_ERROR;
+        to->commands[i].error = error;
+    }
+    for (int i = 0; i < to->word_count; i++) {
+        if (!unpack_text(&to->words[i].text, to, header.text_size) || to->words[i].text == NULL)
+            return free_parser(to), PARSE_ERROR;
+    }
+    for (int i = 0; i < to->redirection_count; i++) {
+        if (!unpack_text(&to->redirections[i].target.text, to, header.text_size))
+            return free_parser(to), PARSE_ERROR;
+    }
+    if (!check_tree(to))
+        return free_parser(to), PARSE_ERROR;
+    return PARSE_OK;
+}
+
+//every index of an unpacked tree is inside its array, and the nodes link only to later nodes (like copy_tree()
+//makes them), so a broken block can't make the shell read out of bounds or run a list for ever
+int check_tree(const struct parser *tree) {
+    const struct node *node;
+    const struct command *c;
+    const struct redirection *r;
+
+    if (tree->root < -1 || tree->root >= tree->node_count)
+        return 0;
+    for (int i = 0; i < tree->node_count; i++) {
+        node = &tree->nodes[i];
+        if (node->type < NODE_PIPELINE || node->type > NODE_FUNCTION || node->connector < CONNECT_ALWAYS ||
+            node->connector > CONNECT_OR || !is_forward_link(node->next, i, tree->node_count) ||
+            !is_forward_link(node->cond, i, tree->node_count) || !is_forward_link(node->body, i, tree->node_count) ||
+            !is_forward_link(node->other, i, tree->node_count))
+            return 0;
+        if (node->type == NODE_PIPELINE && (node->pipeline < 0 || node->pipeline >= tree->pipeline_count))
+            return 0;
+        if (node->type == NODE_FOR && (node->word_count < -1 || //the name, and the values after it
+                                       !in_range(node->first_word, 1 + (node->word_count > 0 ? node->word_count : 0),
+                                                 tree->word_count)))
+            return 0;
+        if (node->type == NODE_FUNCTION && !in_range(node->first_word, 1, tree->word_count))
+            return 0;
+    }
+    for (int i = 0; i < tree->pipeline_count; i++) {
+        if (tree->pipelines[i].command_count < 1 ||
+            !in_range(tree->pipelines[i].first_command, tree->pipelines[i].command_count, tree->command_count))
+            return 0;
+    }
+    for (int i = 0; i < tree->command_count; i++) {
+        c = &tree->commands[i];
+        if (!in_range(c->first_word, c->word_count, tree->word_count) ||
+            !in_range(c->first_redirection, c->redirection_count, tree->redirection_count))
+            return 0;
+    }
+    for (int i = 0; i < tree->word_count; i++) {
+        if (!check_word(tree, &tree->words[i]))
+            return 0;
+    }
+    for (int i = 0; i < tree->redirection_count; i++) {
+        r = &tree->redirections[i];
+        if (r->type < REDIRECT_OUT || r->type > REDIRECT_OUT_TO_ERR ||
+            (r->target.text == NULL) != (r->type == REDIRECT_ERR_TO_OUT || r->type == REDIRECT_OUT_TO_ERR) ||
+            (r->target.text != NULL && !check_word(tree, &r->target)))
+            return 0;
+    }
+    return 1;
+}
+
+//the word's references are in vars[], and each one is inside the word's text
+int check_word(const struct parser *tree, const struct word *w) {
+    const struct var_ref *ref;
+    int len = (int) strlen(w->text);
+
+    if (!in_range(w->first_var, w->var_count, tree->var_count))
+        return 0;
+    for (int i = 0; i < w->var_count; i++) {
+        ref = &tree->vars[w->first_var + i];
+        if (ref->offset < 0 || ref->len < 1 || ref->offset > len - 1 - ref->len ||
+            (ref->type != VAR_NAME && ref->type != VAR_COMMAND) ||
+            (ref->type == VAR_COMMAND && w->text[ref->offset] == '$' && ref->len < 2)) // $( ) has both parentheses
+            return 0;
+    }
+    return 1;
+}
+
+//array[first..first + count) is inside an array of size elements
+int in_range(int first, int count, int size) {
+    return first >= 0 && count >= 0 && first <= size - count;
+}
+
+//a link of nodes[from]: -1 for none, or a node after it
+int is_forward_link(int link, int from, int count) {
+    return link == -1 || (link > from && link < count);
+}
+
+//a malloc()ed copy of count elements at block[*at], and *at moves after them. returns 0 if there's no memory
+int unpack_array(void **array, int count, size_t size, const char *block, size_t *at) {
+    if (count == 0)
+        return 1;
+    if (((*array) = malloc(count * size)) == NULL)
+        return 0;
+    memcpy(*array, block + *at, count * size);
+    (*at) += count * size;
+    return 1;
+}
+
+//turns a packed text into a pointer into the tree's text. returns 0 if it's outside the text
+int unpack_text(char **text, struct parser *to, size_t text_size) {
+    size_t offset = (size_t) (*text);
+    if (offset > text_size)
+        return 0;
+    (*text) = offset > 0 ? to->text + offset - 1 : NULL;
+    return 1;
+}
+
+//copies words[first..first + count) to the end of to's words, and returns the index of the first copy (-1 - no memory)
+int copy_words(struct parser *to, const struct parser *from, int first, int count) {
+    int index = to->word_count;
+    for (int i = 0; i < count; i++) {
+        if (!reserve((void **) &to->words, to->word_count, &to->word_capacity, sizeof(struct word)) ||
+            copy_word(to, from, &from->words[first + i], &to->words[to->word_count]) != PARSE_OK)
+            return -1;
+        to->word_count++;
+    }
+    return index;
+}
+
+//copies the word's references. its text is still the original's, until copy_tree() copies all the texts
+int copy_word(struct parser *to, const struct parser *from, const struct word *w, struct word *copy) {
+    (*copy) = *w;
+    copy->first_var = to->var_count;
+    for (int i = 0; i < w->var_count; i++) {
+        if (!reserve((void **) &to->vars, to->var_count, &to->var_capacity, sizeof(struct var_ref)))
+            return PARSE_NO_MEMORY;
+        to->vars[to->var_count++] = from->vars[w->first_var + i];
+    }
+    return PARSE_OK;
+}
+
+int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+//returns the operator a character starts, or OP_NONE if it doesn't start an operator
+int operator_type(char c) {
+    switch (c) {
+        case ';':
+            return OP_SEMICOLON;
+        case '|':
+            return OP_PIPE;
+        case '>':
+        case '<':
+            return OP_REDIRECT;
+        case '&':
+            return OP_BACKGROUND;
+        default:
+            return OP_NONE;
+    }
+}
+
+/*the operator at s & its length: ; | & && || or a redirection - > >> < << <<< 2> 2>> 2>&1 >&2 1>&2, whose
+ REDIRECT_* is put in type. "2>" & "1>&2" are redirections only at the beginning of a word, which is the only place
+ they're looked for. any other >& is a redirection of type REDIRECT_NONE, which add_operator() rejects*/
+int operator_at(const char *s, int *type, int *len) {
+    int err = s[0] == '2' && s[1] == '>';
+    const char *op = s + err;
+
+    (*type) = REDIRECT_NONE;
+    (*len) = 1 + err;
+    if ((s[0] == '&' || s[0] == '|') && s[1] == s[0]) {
+        (*len) = 2;
+        return s[0] == '&' ? OP_AND : OP_OR;
+    }
+    if (s[0] == '1' && s[1] == '>' && s[2] == '&' && s[3] == '2') {
+        (*len) = 4;
+        (*type) = REDIRECT_OUT_TO_ERR;
+        return OP_REDIRECT;
+    }
+    if (operator_type(*op) != OP_REDIRECT)
+        return operator_type(*op);
+    if (op[0] == '<') {
+        (*len) += (op[1] == '<') + (op[1] == '<' && op[2] == '<');
+        (*type) = (*len) == 3 ? REDIRECT_HERESTRING : (*len) == 2 ? REDIRECT_HEREDOC : REDIRECT_IN;
+    } else if (err && op[1] == '&' && op[2] == '1') {
+        (*len) = 4;
+        (*type) = REDIRECT_ERR_TO_OUT;
+    } else if (!err && op[1] == '&' && op[2] == '2') {
+        (*len) = 3;
+        (*type) = REDIRECT_OUT_TO_ERR;
+    } else if (op[1] == '&') {
+        (*len) += 1;
+        (*type) = REDIRECT_NONE;
+    } else if (op[1] == '>') {
+        (*len)++;
+        (*type) = err ? REDIRECT_ERR_APPEND : REDIRECT_APPEND;
+    } else
+        (*type) = err ? REDIRECT_ERR : REDIRECT_OUT;
+    return OP_REDIRECT;
+}
+
+/*the closing ')' of the $( at s, or the closing '`' of the ` at s. NULL if it isn't closed.
+ parentheses inside the command are counted, except inside quotes, so $(echo "(" $(pwd)) ends at the last ')'*/
+const char *substitution_end(const char *s) {
+    int depth = 1, in_quotes = 0;
+
+    if (*s == '`')
+        return strchr(s + 1, '`');
+    for (s += 2; *s != 0; s++) {
+        if (*s == '"')
+            in_quotes = !in_quotes;
+        else if (!in_quotes && *s == '(')
+            depth++;
+        else if (!in_quotes && *s == ')' && --depth == 0)
+            return s;
+    }
+    return NULL;
+}
+
+//$0-$9 (the positional parameters), $# (their number), $@ & $* (all of them), $? (the last exit status)
+//& $! (the last background job)
+int is_special_parameter(char c) {
+    return (c >= '0' && c <= '9') || c == '#' || c == '@' || c == '*' || c == '?' || c == '!';
+}
+
+int is_name_char(char c, int is_first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!is_first && c >= '0' && c <= '9');
+}
+
+int is_assignment(char *word) {
+    if (!is_name_char(word[0], 1))
+        return 0;
+    while (is_name_char(*word, 0))
+        word++;
+    return (*word) == '=';
+}
+
+//makes room for one more element in the array. returns 0 if it couldn't grow
+int reserve(void **array, int count, int *capacity, size_t size) {
+    if (count < (*capacity))
+        return 1;
+    int grown_capacity = (*capacity) == 0 ? 16 : (*capacity) * 2;
+    void *grown = realloc(*array, grown_capacity * size);
+    if (grown == NULL)
+        return 0;
+    (*array) = grown;
+    (*capacity) = grown_capacity;
+    return 1;
+}
+
+/*a word is an argument of the current command, the target of a redirection, the 'time' prefix of a new pipeline,
+ a reserved word (if, then, do...) at the beginning of a command, or a part of the header of a for*/
+int add_word(struct parser *parser, struct parse_state *state, struct word *w) {
+    struct frame *frame = &parser->frames[parser->frame_count - 1];
+    int keyword;
+
+    if (frame->part >= PART_FOR_NAME)
+        return add_for_word(parser, frame, w);
+    if (frame->part == PART_FUNCTION) {
+        if (keyword_type(w) != KEYWORD_OPEN_BRACE)
+            return syntax_error(parser, "Error: the body of a function must be in { }");
+        frame->part = PART_BODY;
+        return PARSE_OK;
+    }
+    if (state->pipeline == -1 && (keyword = keyword_type(w)) != KEYWORD_NONE)
+        return add_keyword(parser, state, keyword);
+    if (state->pipeline == -1 && is_function_header(w)) {
+        if (!reserve((void **) &parser->words, parser->word_count, &parser->word_capacity, sizeof(struct word)) ||
+            open_compound(parser, state, NODE_FUNCTION, PART_FUNCTION) != PARSE_OK)
+            return PARSE_NO_MEMORY;
+        w->text[strlen(w->text) - 2] = 0; //the name without ()
+        parser->nodes[parser->frames[parser->frame_count - 1].node].first_word = parser->word_count;
+        parser->words[parser->word_count++] = *w;
+        return PARSE_OK;
+    }
+    if (state->pipeline == -1 && start_pipeline(parser, state) != PARSE_OK)
+        return PARSE_NO_MEMORY;
+    struct pipeline *pipeline = &parser->pipelines[state->pipeline];
+    if (state->command == -1 && pipeline->command_count == 0 && w->var_count == 0) {
+        if (pipeline->timed == TIME_NONE && strcmp(w->text, "time") == 0) {
+            pipeline->timed = TIME_TEXT;
+            return PARSE_OK;
+        }
+        if (pipeline->timed == TIME_TEXT && strcmp(w->text, "-j") == 0) {
+            pipeline->timed = TIME_JSON;
+            return PARSE_OK;
+        }
+    }
+    if (state->command == -1 && start_command(parser, state) != PARSE_OK)
+        return PARSE_NO_MEMORY;
+    struct command *command = &parser->commands[state->command];
+
+    if (state->redirect != REDIRECT_NONE)
+        return add_redirection(parser, state, state->redirect, w);
+    if (!reserve((void **) &parser->words, parser->word_count, &parser->word_capacity, sizeof(struct word)))
+        return PARSE_NO_MEMORY;
+    if (command->word_count == 0)
+        command->is_assignment = is_assignment(w->text);
+    parser->words[parser->word_count++] = *w;
+    command->word_count++;
+    return PARSE_OK;
+}
+
+//the KEYWORD_* of a word, KEYWORD_NONE if it isn't one. a quoted word or one with variables is never a keyword
+int keyword_type(struct word *w) {
+    static const char *keywords[] = {"if", "then", "elif", "else", "fi", "while", "until", "for", "do", "done", "{", "}"};
+
+    if (w->quoted || w->var_count > 0 || strchr("defituw{}", w->text[0]) == NULL || w->text[0] == 0)
+        return KEYWORD_NONE; //most commands are rejected by their first character
+    for (int i = 0; i < (int) (sizeof(keywords) / sizeof(keywords[0])); i++) {
+        if (w->text[0] == keywords[i][0] && strcmp(w->text, keywords[i]) == 0)
+            return i;
+    }
+    return KEYWORD_NONE;
+}
+
+/*a reserved word opens a compound command, moves it to its next part, or closes it.
+ elif is an if that is opened in the else part, and is closed by the same fi*/
+int add_keyword(struct parser *parser, struct parse_state *state, int keyword) {
+    struct frame *frame = &parser->frames[parser->frame_count - 1];
+    int type = frame->node != -1 ? parser->nodes[frame->node].type : -1, node;
+    int is_loop = type == NODE_WHILE || type == NODE_UNTIL || type == NODE_FOR;
+
+    switch (keyword) {
+        case KEYWORD_IF:
+            return open_compound(parser, state, NODE_IF, PART_COND);
+        case KEYWORD_WHILE:
+            return open_compound(parser, state, NODE_WHILE, PART_COND);
+        case KEYWORD_UNTIL:
+            return open_compound(parser, state, NODE_UNTIL, PART_COND);
+        case KEYWORD_FOR:
+            if (open_compound(parser, state, NODE_FOR, PART_FOR_NAME) != PARSE_OK)
+                return PARSE_NO_MEMORY;
+            parser->nodes[parser->node_count - 1].word_count = -1; //until 'in' is found
+            return PARSE_OK;
+        case KEYWORD_OPEN_BRACE:
+            return open_compound(parser, state, NODE_GROUP, PART_BODY);
+        case KEYWORD_CLOSE_BRACE:
+            if ((type != NODE_GROUP && type != NODE_FUNCTION) || frame->part != PART_BODY)
+                return syntax_error(parser, "Error: '}' without '{'");
+            if (frame->tail == -1)
+                return syntax_error(parser, "Error: Unexpected token '}': the body is empty");
+            parser->frame_count--;
+            return PARSE_OK;
+        case KEYWORD_THEN:
+            if (type != NODE_IF || frame->part != PART_COND)
+                return syntax_error(parser, "Error: 'then' without 'if'");
+            frame->part = PART_BODY;
+            break;
+        case KEYWORD_ELIF:
+            if (type != NODE_IF || frame->part != PART_BODY)
+                return syntax_error(parser, "Error: 'elif' without 'then'");
+            frame->part = PART_OTHER;
+            frame->tail = -1;
+            if ((node = add_node(parser, state, NODE_IF)) == -1)
+                return PARSE_NO_MEMORY;
+            frame->node = node;
+            frame->part = PART_COND;
+            break;
+        case KEYWORD_ELSE:
+            if (type != NODE_IF || frame->part != PART_BODY)
+                return syntax_error(parser, "Error: 'else' without 'then'");
+            frame->part = PART_OTHER;
+            break;
+        case KEYWORD_FI:
+            if (type != NODE_IF || frame->part == PART_COND)
+                return syntax_error(parser, "Error: 'fi' without 'then'");
+            parser->frame_count--;
+            return PARSE_OK;
+        case KEYWORD_DO:
+            if ((type != NODE_WHILE && type != NODE_UNTIL) || frame->part != PART_COND)
+                return syntax_error(parser, "Error: 'do' without 'while', 'until' or 'for'");
+            frame->part = PART_BODY;
+            break;
+        case KEYWORD_DONE:
+            if (!is_loop || frame->part != PART_BODY)
+                return syntax_error(parser, "Error: 'done' without 'do'");
+            parser->frame_count--;
+            return PARSE_OK;
+    }
+    frame->tail = -1; //a new part starts an empty list
+    return PARSE_OK;
+}
+
+//the header of a for: the variable's name, then 'in' & the words to loop over, up to ; or a newline, then 'do'
+int add_for_word(struct parser *parser, struct frame *frame, struct word *w) {
+    struct node *node = &parser->nodes[frame->node];
+    int keyword = keyword_type(w);
+
+    switch (frame->part) {
+        case PART_FOR_NAME:
+            if (w->quoted || w->var_count > 0 || !is_name_char(w->text[0], 1))
+                return syntax_error(parser, "Error: 'for' needs a variable name");
+            for (char *c = w->text; *c != 0; c++) {
+                if (!is_name_char(*c, 0))
+                    return syntax_error(parser, "Error: 'for' needs a variable name");
+            }
+            node->first_word = parser->word_count;
+            frame->part = PART_FOR_IN;
+            break;
+        case PART_FOR_IN:
+            if (!w->quoted && strcmp(w->text, "in") == 0) {
+                node->word_count = 0;
+                frame->part = PART_FOR_WORDS;
+                return PARSE_OK;
+            }
+            //fall through - 'for name do'
+        case PART_FOR_DO:
+            if (keyword != KEYWORD_DO)
+                return syntax_error(parser, "Error: 'for' needs 'in' or 'do'");
+            frame->part = PART_BODY;
+            frame->tail = -1;
+            return PARSE_OK;
+        default: //PART_FOR_WORDS
+            node->word_count++;
+    }
+    if (!reserve((void **) &parser->words, parser->word_count, &parser->word_capacity, sizeof(struct word)))
+        return PARSE_NO_MEMORY;
+    parser->words[parser->word_count++] = *w;
+    return PARSE_OK;
+}
+
+/*adds a node to the end of the list that's being built, with the connector that came before it.
+ returns its index, or -1 if there's no memory*/
+int add_node(struct parser *parser, struct parse_state *state, int type) {
+    if (!reserve((void **) &parser->nodes, parser->node_count, &parser->node_capacity, sizeof(struct node)))
+        return -1;
+    struct frame *frame = &parser->frames[parser->frame_count - 1];
+    int index = parser->node_count++;
+    parser->nodes[index] = (struct node) {type, state->connector, -1, -1, -1, -1, -1, 0, 0};
+    state->connector = CONNECT_ALWAYS;
+
+    if (frame->tail != -1)
+        parser->nodes[frame->tail].next = index;
+    else if (frame->node == -1)
+        parser->root = index;
+    else if (frame->part == PART_COND)
+        parser->nodes[frame->node].cond = index;
+    else if (frame->part == PART_BODY)
+        parser->nodes[frame->node].body = index;
+    else
+        parser->nodes[frame->node].other = index;
+    frame->tail = index;
+    return index;
+}
+
+//adds the node of a compound command, whose parts are built until it's closed
+int open_compound(struct parser *parser, struct parse_state *state, int type, int part) {
+    int node = add_node(parser, state, type);
+    if (node == -1 ||
+        !reserve((void **) &parser->frames, parser->frame_count, &parser->frame_capacity, sizeof(struct frame)))
+        return PARSE_NO_MEMORY;
+    parser->frames[parser->frame_count++] = (struct frame) {node, part, -1};
+    return PARSE_OK;
+}
+
+/*name() at the beginning of a command starts a function. the name is like a variable's, but may also have - . :
+ after its first character (lib::helper, git-wrapper)*/
+int is_function_header(struct word *w) {
+    size_t len = strlen(w->text);
+
+    if (w->quoted || w->var_count > 0 || len < 3 || strcmp(w->text + len - 2, "()") != 0 ||
+        !is_name_char(w->text[0], 1))
+        return 0;
+    for (size_t i = 1; i < len - 2; i++) {
+        if (!is_name_char(w->text[i], 0) && w->text[i] != '-' && w->text[i] != '.' && w->text[i] != ':')
+            return 0;
+    }
+    return 1;
+}
+
+int syntax_error(struct parser *parser, const char *error) {
+    parser->error = error;
+    return PARSE_ERROR;
+}
+
+int add_redirection(struct parser *parser, struct parse_state *state, int type, struct word *target) {
+    if (!reserve((void **) &parser->redirections, parser->redirection_count, &parser->redirection_capacity,
+                 sizeof(struct redirection)))
+        return PARSE_NO_MEMORY;
+    struct redirection *r = &parser->redirections[parser->redirection_count++];
+    r->type = type;
+    r->target = *target;
+    parser->commands[state->command].redirection_count++;
+    parser->heredoc_count += type == REDIRECT_HEREDOC;
+    state->redirect = REDIRECT_NONE;
+    return PARSE_OK;
+}
+
+int add_operator(struct parser *parser, struct parse_state *state, int op, int type) {
+    static const char *unexpected[] = {"Error: Unexpected token ';'", "Error: Unexpected token '|'", NULL,
+                                       "Error: Unexpected token '&'", "Error: Unexpected token '&&'",
+                                       "Error: Unexpected token '||'"};
+    struct frame *frame = &parser->frames[parser->frame_count - 1];
+
+    if (frame->part == PART_FUNCTION)
+        return syntax_error(parser, "Error: the body of a function must be in { }");
+    if (frame->part >= PART_FOR_NAME) { //only ; may end the words of a for
+        if (op != OP_SEMICOLON || frame->part == PART_FOR_NAME)
+            return syntax_error(parser, "Error: 'for' needs a variable name, 'in' & words, and 'do'");
+        frame->part = PART_FOR_DO;
+        return PARSE_OK;
+    }
+    //every stage of a pipeline needs a command: '| cmd', 'cmd | | cmd', 'cmd ||| cmd' & 'cmd | ;' are errors
+    if (op != OP_REDIRECT && state->command == -1 && (op == OP_PIPE || after_pipe(parser, state)))
+        return syntax_error(parser, unexpected[op]);
+    if (op == OP_REDIRECT) {
+        if (type == REDIRECT_NONE)
+            return syntax_error(parser, "Error: only 2>&1 & >&2 can duplicate a file descriptor");
+        if (state->command == -1 && state->pipeline == -1 && start_pipeline(parser, state) != PARSE_OK)
+            return PARSE_NO_MEMORY;
+        if (state->command == -1 && start_command(parser, state) != PARSE_OK)
+            return PARSE_NO_MEMORY;
+        struct command *command = &parser->commands[state->command];
+        //a redirection needs a command before it & a target after it
+        if (command->word_count == 0 || state->redirect != REDIRECT_NONE)
+            command->error = "enter source & dest";
+        if (type != REDIRECT_ERR_TO_OUT && type != REDIRECT_OUT_TO_ERR) {
+            state->redirect = type;
+            return PARSE_OK;
+        }
+        struct word none = {NULL, 0, 0, 0};
+        return add_redirection(parser, state, type, &none);
+    }
+    end_command(parser, state);
+    if (op == OP_PIPE)
+        return PARSE_OK;
+    if (end_pipeline(parser, state, op == OP_BACKGROUND) != PARSE_OK)
+        return PARSE_NO_MEMORY;
+    if (op == OP_AND || op == OP_OR)
+        state->connector = op == OP_AND ? CONNECT_AND : CONNECT_OR;
+    return PARSE_OK;
+}
+
+//just after a '|': the pipeline has commands, but its next stage didn't start
+int after_pipe(struct parser *parser, struct parse_state *state) {
+    return state->pipeline != -1 && state->command == -1 && parser->pipelines[state->pipeline].command_count > 0;
+}
+
+int start_pipeline(struct parser *parser, struct parse_state *state) {
+    if (!reserve((void **) &parser->pipelines, parser->pipeline_count, &parser->pipeline_capacity,
+                 sizeof(struct pipeline)))
+        return PARSE_NO_MEMORY;
+    struct pipeline *pipeline = &parser->pipelines[parser->pipeline_count];
+    pipeline->first_command = parser->command_count;
+    pipeline->command_count = 0;
+    pipeline->background = 0;
+    pipeline->timed = TIME_NONE;
+    state->pipeline = parser->pipeline_count++;
+    return PARSE_OK;
+}
+
+int start_command(struct parser *parser, struct parse_state *state) {
+    if (!reserve((void **) &parser->commands, parser->command_count, &parser->command_capacity,
+                 sizeof(struct command)))
+        return PARSE_NO_MEMORY;
+    struct command *command = &parser->commands[parser->command_count];
+    command->first_word = parser->word_count;
+    command->word_count = 0;
+    command->first_redirection = parser->redirection_count;
+    command->redirection_count = 0;
+    command->is_assignment = 0;
+    command->error = NULL;
+    state->command = parser->command_count++;
+    parser->pipelines[state->pipeline].command_count++;
+    return PARSE_OK;
+}
+
+void end_command(struct parser *parser, struct parse_state *state) {
+    if (state->command == -1)
+        return;
+    struct command *command = &parser->commands[state->command];
+    if (state->redirect != REDIRECT_NONE) //a redirection without a target
+        command->error = "enter source & dest";
+    if (command->is_assignment && command->redirection_count > 0)
+        command->error = "assign in this pattern: <variable name>=<value>";
+    state->command = -1;
+    state->redirect = REDIRECT_NONE;
+}
+
+/*a pipeline that ended becomes a node of the list that's being built.
+ an empty pipeline (;; or a lone &) isn't kept, unless it's timed - 'time' alone reports an empty run*/
+int end_pipeline(struct parser *parser, struct parse_state *state, int background) {
+    end_command(parser, state);
+    if (state->pipeline == -1)
+        return PARSE_OK;
+    struct pipeline *pipeline = &parser->pipelines[state->pipeline];
+    int index = state->pipeline, node;
+    pipeline->background = background;
+    state->pipeline = -1;
+    if (pipeline->command_count == 0 && pipeline->timed == TIME_NONE) {
+        parser->pipeline_count--;
+        return PARSE_OK;
+    }
+    if ((node = add_node(parser, state, NODE_PIPELINE)) == -1)
+        return PARSE_NO_MEMORY;
+    parser->nodes[node].pipeline = index;
+    return PARSE_OK;
+}
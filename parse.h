@@ -0,0 +1,176 @@
+/*
+the parser of the shell: turns an input line into a tree of lists, pipelines, commands & words, without running anything
+ */
+
+#ifndef PARSE_H
+#define PARSE_H
+
+//what parse_line() returns
+#define PARSE_OK 0
+#define PARSE_ERROR 1 //the line can't be parsed at all (unbalanced quotes or $( ), parser->error says why
+#define PARSE_NO_MEMORY 2
+#define PARSE_INCOMPLETE 3 //the line ended inside an if/while/for, or after && / ||: parse_more() adds the next line
+
+//the kinds of redirections
+#define REDIRECT_NONE -1 //the end of a command's redirections in the shell
+#define REDIRECT_OUT 0 // > file
+#define REDIRECT_APPEND 1 // >> file
+#define REDIRECT_IN 2 // < file
+#define REDIRECT_ERR 3 // 2> file
+#define REDIRECT_ERR_APPEND 4 // 2>> file
+#define REDIRECT_ERR_TO_OUT 5 // 2>&1, which has no target
+#define REDIRECT_HEREDOC 6 // <<DELIMITER, the next lines of the input up to DELIMITER
+#define REDIRECT_HERESTRING 7 // <<< word, the word & a newline
+#define REDIRECT_OUT_TO_ERR 8 // >&2 or 1>&2, which has no target
+
+//the kinds of nodes
+#define NODE_PIPELINE 0
+#define NODE_IF 1 // if cond; then body; [elif ...;] [else other;] fi - an elif is an if that is the whole else part
+#define NODE_WHILE 2 // while cond; do body; done
+#define NODE_UNTIL 3 // until cond; do body; done
+#define NODE_FOR 4 // for name [in words]; do body; done
+#define NODE_GROUP 5 // { body; }
+#define NODE_FUNCTION 6 // name() { body; } - defines the function, the body runs when it's called
+
+//when a node runs, by the operator before it
+#define CONNECT_ALWAYS 0 // ; & a newline, or the first node of a list
+#define CONNECT_AND 1 // && - only if the last exit status is 0
+#define CONNECT_OR 2 // || - only if it isn't
+
+//how a pipeline is timed by the 'time' prefix
+#define TIME_NONE 0
+#define TIME_TEXT 1 // time
+#define TIME_JSON 2 // time -j
+
+//the kinds of var_refs
+#define VAR_NAME 0 // $NAME
+#define VAR_COMMAND 1 // $(command) or `command`, which is replaced by the command's output
+
+/*a $NAME or a command substitution inside a word: where it starts in the word's text & its length without the first
+ character - the name of $NAME, or the command & the closing ')' / '`' of a substitution.
+ the special parameters $0-$9, $#, $@, $* & $? are names of one character*/
+struct var_ref {
+    int offset;
+    int len;
+    int type; //VAR_*
+    int quoted; //it's inside double quotes, so a command's output isn't split into words
+};
+
+//a word of the line. its text is null terminated inside the line, without its quotes.
+//its $NAME references & command substitutions are vars[first_var..first_var + var_count)
+struct word {
+    char *text;
+    int first_var, var_count;
+    int quoted; //it had quotes
+};
+
+//a redirection & the word after it. the target of 2>&1 has no text
+struct redirection {
+    int type;
+    struct word target;
+};
+
+/*a simple command: the words words[first_word..first_word + word_count) & the redirections
+ redirections[first_redirection..first_redirection + redirection_count), in the order they were written*/
+struct command {
+    int first_word, word_count;
+    int first_redirection, redirection_count;
+    int is_assignment; //<name>=<value>... sets a variable instead of running a command
+    const char *error; //a syntax error in the command, which is reported only when the command is reached
+};
+
+//commands joined by '|', commands[first_command..first_command + command_count). a single command is a pipeline of one
+struct pipeline {
+    int first_command, command_count;
+    int background; //ended with '&'
+    int timed; //TIME_*
+};
+
+/*a pipeline or a compound command. the nodes of a list are linked by next, and the parts of a compound command
+ are lists, so a loop's body is parsed once and run again & again*/
+struct node {
+    int type; //NODE_*
+    int connector; //CONNECT_*
+    int next; //the next node of the list, -1 at its end
+    int pipeline; //NODE_PIPELINE: pipelines[pipeline]
+    int cond, body, other; //the first nodes of the parts of a compound command, -1 for an empty part
+    //NODE_FOR: the name is words[first_word], and the word_count words after it are the values (-1 without 'in').
+    //NODE_FUNCTION: the name is words[first_word]
+    int first_word, word_count;
+};
+
+//a compound command that isn't closed yet, and which of its lists gets the next node
+struct frame {
+    int node; //-1 for the line itself
+    int part; //PART_* in parse.c
+    int tail; //the last node of the list, -1 while it's empty
+};
+
+//where the parser is inside the tree: -1 when a new pipeline/command is started by the next word
+struct parse_state {
+    int pipeline, command;
+    int redirect; //the REDIRECT_* that waits for its target word, REDIRECT_NONE if there is none
+    int connector; //the CONNECT_* of the next node
+};
+
+/*the tree of the last parsed line, and the arrays it's kept in. the arrays are reused for every line,
+ so they only grow for a longer line than ever before. the structs refer to each other by indices,
+ and the words' text points into the line, so the line must live as long as the tree is used*/
+struct parser {
+    struct pipeline *pipelines;
+    int pipeline_count, pipeline_capacity;
+    struct command *commands;
+    int command_count, command_capacity;
+    struct word *words;
+    int word_count, word_capacity;
+    struct redirection *redirections;
+    int redirection_count, redirection_capacity;
+    int heredoc_count; //their bodies are the next lines, which the caller reads after this line
+    struct var_ref *vars;
+    int var_count, var_capacity;
+    struct node *nodes;
+    int node_count, node_capacity;
+    int root; //the first node of the line, -1 if it's empty
+    struct frame *frames; //frames[0] is the line, the others are the open compound commands
+    int frame_count, frame_capacity;
+    struct parse_state state; //where the last line stopped, parse_more() goes on from there
+    size_t line_len; //the length of the last line
+    char *text; //the words' text of a tree made by copy_tree(), in one block. NULL when the words are in a line
+    const char *error;
+};
+
+//parses line (changed in place) into the parser's arrays. it doesn't print, expand variables or run anything
+int parse_line(struct parser *parser, char *line);
+
+//adds the next line to a tree that parse_line() returned PARSE_INCOMPLETE for, as if a newline separated them
+int parse_more(struct parser *parser, char *line);
+
+//the last line was copied from from to to: its words point into the copy from now on
+void move_line(struct parser *parser, const char *from, char *to);
+
+/*copies the list that starts at from->nodes[first], with everything inside it, into to (an empty parser), so it
+ can be kept after the line is gone. the words' text is copied too. to->root is the copy of first*/
+int copy_tree(struct parser *to, const struct parser *from, int first);
+
+/*the size of the block pack_tree() makes of a tree made by copy_tree(): the counts of its arrays, the arrays and
+ the text of its words (and of its commands' errors), so the tree can be written to a file*/
+size_t packed_size(const struct parser *tree);
+
+void pack_tree(const struct parser *tree, char *block);
+
+//makes a tree like copy_tree() does out of a block of pack_tree(), which may be unaligned (a mapped file).
+//PARSE_ERROR if the block isn't one
+int unpack_tree(struct parser *to, const char *block, size_t size);
+
+void free_parser(struct parser *parser);
+
+//a variable name is letters, digits & '_', and doesn't start with a digit
+int is_name_char(char c, int is_first);
+
+//$0-$9, $#, $@, $* & $?: a '$' followed by this character is a special parameter
+int is_special_parameter(char c);
+
+//<name>= at the beginning of a word, where the name is a legal variable name
+int is_assignment(char *word);
+
+#endif
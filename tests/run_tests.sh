@@ -0,0 +1,300 @@
+#!/bin/sh
+#the regression tests of the shell: every test runs commands with 'ex1 -c' and compares what they printed.
+#tests/run_tests.sh [shell] - the shell is ./ex1 by default. it exits with the number of failed tests
+
+SHELL_UNDER_TEST=${1:-./ex1}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+failed=0
+
+#check <name> <commands> <expected output>
+check() {
+    actual=$(cd "$TMP" && "$SHELL_UNDER_TEST" -c "$2" 2>&1)
+    if [ "$actual" = "$3" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        printf '  expected: %s\n  actual:   %s\n' "$3" "$actual"
+        failed=$((failed + 1))
+    fi
+}
+
+case $SHELL_UNDER_TEST in
+    /*) ;;
+    *) SHELL_UNDER_TEST=$(pwd)/$SHELL_UNDER_TEST ;; #the tests run in a temporary directory
+esac
+
+for engine in spawn fork zygote; do
+    export EX1_LAUNCH=$engine
+    check "$engine: commands, pipes & a missing command" '/bin/echo a b; /bin/echo c | tr c C; nosuchcmd 2> /dev/null; echo $?' \
+"a b
+C
+127"
+done
+unset EX1_LAUNCH
+check "a missing command reports the call that failed" 'nosuchcmd' "nosuchcmd: posix_spawnp: No such file or directory"
+
+export EX1_LAUNCH=zygote
+check "zygote: limits, PATH & redirections go with the request" 'ulimit -n 64; /bin/sh -c "ulimit -n"; PATH=/usr/bin:/bin; env | grep ^PATH=; echo hi > f; tr h H < f; cat nosuch 2> err; cat err; i=; while [ "$i" != 0000000000 ]; do i="$i"0; /bin/true; done; echo $?' \
+"64
+PATH=/usr/bin:/bin
+Hi
+cat: nosuch: No such file or directory
+0"
+unset EX1_LAUNCH
+
+check "nice, ulimit, prlimit & taskset apply to the command's process" 'nice -n 5 /bin/sh -c nice; ulimit -n 100; /bin/sh -c "ulimit -n"; prlimit --nofile=50 /bin/sh -c "ulimit -n"; taskset -c 0 grep Cpus_allowed_list /proc/self/status | cut -f2; PIPE_SPREAD=1; /bin/echo spread | cat' \
+"$(($(nice) + 5))
+100
+50
+0
+spread"
+
+mkdir "$TMP/a" "$TMP/b"
+printf '#!/bin/sh\necho from a\n' > "$TMP/a/tool"
+printf '#!/bin/sh\necho from b\n' > "$TMP/b/tool"
+chmod +x "$TMP/a/tool" "$TMP/b/tool"
+check "hash caches the path & drops a missing binary or a new PATH" 'PATH=$(pwd)/a:$(pwd)/b:/bin; tool; hash; /bin/rm a/tool; tool; hash; PATH=/bin; hash' \
+"from a
+hits	command
+   1	$TMP/a/tool
+from b
+hits	command
+   1	$TMP/b/tool
+hash: hash table empty"
+
+many=$(seq 1 3000 | sed 's/.*/v&=x&;/' | tr -d '\n')
+check "thousands of variables, overwrite & unset" "$many"' v2=y; echo $v1 $v2 $v3000; unset v2; echo "[$v2]" $v3' \
+"x1 y x3000
+[] x3"
+
+check "long expansions & thousands of arguments" 'x=aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa; x=$x$x$x$x$x$x$x$x$x$x; x=$x$x$x$x$x$x$x$x$x$x; for i in 1 2 3; do echo $x$x$x $i >> out; done; wc -c < out; /bin/echo $(seq 1 5000) | wc -w' \
+"90009
+5000"
+
+check "quotes, spacing & operators without spaces" 'x=v;echo a    b"  c  "d;echo "$x"x"";/bin/echo "a;b|c"|tr a A;echo hi>f;cat<f;echo "[$x $y]"' \
+"a b  c  d
+vx
+A;b|c
+hi
+[v ]"
+
+printf 'echo one\nA=2\necho $A\nfalse' > "$TMP/script.sh" #no newline at the end
+check "a script file, piped stdin & their exit status" "$SHELL_UNDER_TEST script.sh; echo \$?; echo \"echo piped; exit 4\" | $SHELL_UNDER_TEST; echo \$?" \
+"one
+2
+1
+piped
+4"
+
+check "pwd, true, false & exit" 'pwd; true; echo $?; false; echo $?; /bin/sh -c "exit 5"; echo $?; exit 3; echo not here' \
+"$TMP
+0
+1
+5"
+
+check "\$! is the last background job" 'echo "[$!]"; /bin/sh -c "exit 3" & wait $!; echo $?; /bin/sleep 0.1 & p=$!; kill -0 $p && echo alive; BG_LIMIT=1; /bin/sh -c "exit 4" & wait $!; echo $?' \
+"[]
+3
+alive
+4"
+
+check "PIPE_METER from the environment" "env PIPE_METER=1 $SHELL_UNDER_TEST -c \"seq 1000 | cat > /dev/null\" 2> err; cut -c1-36 err" \
+"stage  command                 bytes
+    1  seq                      3893
+    2  cat                         -"
+
+printf 'python3 -c "import fcntl; print(fcntl.fcntl(1, 1032))" | cat\n' > "$TMP/pipesize.sh" #F_GETPIPE_SZ
+check "PIPE_SIZE from a variable or the environment" "PIPE_SIZE=131072; "'python3 -c "import fcntl; print(fcntl.fcntl(1, 1032))" | cat;'" unset PIPE_SIZE; env PIPE_SIZE=262144 $SHELL_UNDER_TEST pipesize.sh" \
+"131072
+262144"
+
+#a metered pipeline that is stopped (like by ^Z) goes on when it's continued
+cat > "$TMP/slow.sh" <<'EOF'
+i=0; while [ $i -lt 30 ]; do echo x; sleep 0.02; i=$((i+1)); done
+EOF
+cat > "$TMP/stop.sh" <<'EOF'
+sleep 0.2; kill -TSTP $(pgrep -P $PPID -f slow.sh) #the first stage: one signal, so fg can't come between
+EOF
+cat > "$TMP/meter.sh" <<'EOF'
+PIPE_METER=1
+/bin/sh stop.sh &
+/bin/sh slow.sh | cat | wc -l
+echo $?
+fg
+echo $?
+EOF
+#its output goes to a file: if the job stays stopped, its processes don't keep the test waiting
+check "a metered pipeline stops & continues" "$SHELL_UNDER_TEST meter.sh > out 2> /dev/null; cat out" \
+"
+[2]+  Stopped		/bin/sh slow.sh | cat | wc -l
+148
+/bin/sh slow.sh | cat | wc -l
+30
+0"
+
+printf 'time -j /bin/sh -c "exit 3" | /bin/sh -c "exit 4"\necho $?\ntime /bin/true\n' > "$TMP/time.sh"
+check "time reports every stage & keeps the exit status" "$SHELL_UNDER_TEST time.sh 2> report; "'grep -o "status.:[0-9]" report; cut -f1 report | cut -d" " -f1 | grep -v "^{"' \
+"4
+status\":4
+status\":3
+status\":4
+
+real
+user
+sys
+maxrss
+faults
+ctxsw"
+
+printf 'METRICS_FILE=m.prom\n/bin/true\n/bin/true\n/bin/true\nfalse\nfalse\nnosuch 2> /dev/null\nstats > s\n' > "$TMP/stats.sh"
+check "stats counts commands & exit statuses, METRICS_FILE exports them" "$SHELL_UNDER_TEST stats.sh; head -5 s; grep ^exit s; grep -e ^ex1_commands_total -e ^ex1_exit_status_total m.prom | env LC_ALL=C sort" \
+"commands: 6, failed: 3
+      runs     failed  command
+         3          0  /bin/true
+         2          2  false
+         1          1  nosuch
+exit statuses: 0:3 1:2 127:1
+ex1_commands_total{command=\"/bin/true\"} 3
+ex1_commands_total{command=\"false\"} 2
+ex1_commands_total{command=\"nosuch\"} 1
+ex1_commands_total{command=\"stats\"} 1
+ex1_exit_status_total{status=\"0\"} 4
+ex1_exit_status_total{status=\"1\"} 2
+ex1_exit_status_total{status=\"127\"} 1"
+
+printf '/bin/true | cat\necho x > /dev/null\n' > "$TMP/trace.sh"
+names="import json, sys; print(' '.join(sorted(set(e['name'] for e in json.load(open(sys.argv[1]))))))"
+check "EX1_TRACE & trace write a Chrome trace of the phases" "env EX1_TRACE=t1.json $SHELL_UNDER_TEST trace.sh; trace t2.json; /bin/true; trace off; python3 -c \"$names\" t1.json; python3 -c \"$names\" t2.json" \
+"builtin exec expand parse pipeline process_name read_command stage wait
+exec expand process_name wait"
+
+mkdir "$TMP/glob" "$TMP/glob/d"
+(cd "$TMP/glob" && touch a.c b.c c.h .hid.c log.1 log.2 logx d/x.c)
+check "wildcards, hidden files, no match & a loop that creates files" 'echo glob/*.c; echo glob/log.[0-9] glob/log?; echo glob/?.h glob/*/*.c; echo glob/.*.c; echo "glob/*.c" glob/nomatch*; x="glob/*.h"; echo $x; for i in 1 2; do touch glob/new$i; echo glob/new*; done' \
+"glob/a.c glob/b.c
+glob/log.1 glob/log.2 glob/logx
+glob/c.h glob/d/x.c
+glob/.hid.c
+glob/*.c glob/nomatch*
+glob/c.h
+glob/new1
+glob/new1 glob/new2"
+
+#the editor needs a terminal: script(1) runs the shell in one, & the keys are typed all at once
+mkdir "$TMP/bin"
+printf '#!/bin/sh\necho ran zzunique\n' > "$TMP/bin/zzuniquecmd"
+chmod +x "$TMP/bin/zzuniquecmd"
+echo content > "$TMP/zzfile.txt"
+printf 'PATH=%s/bin:/bin\nZZVARIABLE=val\nzzuniq\t\necho $ZZVARI\t\ncat zzfi\t\nexit\n' "$TMP" > "$TMP/keys"
+printf 'script -qec "env EX1RC= HISTFILE=history.tty %s" /dev/null < keys | tr -d "\\r" | grep -x -e "ran zzunique" -e val -e content\n' "$SHELL_UNDER_TEST" > "$TMP/editor.sh"
+check "<tab> completes commands, variables & files in a terminal" "/bin/sh editor.sh" \
+"ran zzunique
+val
+content"
+
+#the rc file runs only in a terminal. the trace tells if it was parsed or copied out of the snapshot
+printf 'GREETING=hi\ngreet() { echo "$GREETING $1"; }\nalias gg="greet there"\n' > "$TMP/rc"
+printf 'gg\nexit\n' > "$TMP/rc.keys"
+printf 'script -qec "env EX1RC=rc EX1_TRACE=rc.json HISTFILE=history.tty %s" /dev/null < rc.keys | tr -d "\\r" | grep -x ".* there"\ngrep -o -e "command.:.parsed" -e "command.:.snapshot" rc.json\n' "$SHELL_UNDER_TEST" > "$TMP/rc.sh"
+check "the rc file is parsed, then loaded from its snapshot until it changes" "/bin/sh rc.sh; /bin/sh rc.sh; echo GREETING=hello >> rc; /bin/sh rc.sh" \
+"hi there
+command\":\"parsed
+hi there
+command\":\"snapshot
+hello there
+command\":\"parsed"
+
+deep=$(i=1; while [ $i -lt 64 ]; do printf ' | cat'; i=$((i + 1)); done)
+check "the benchmark's workloads: a deep pipeline & redirections" "echo data$deep; echo line 1 > out0; echo line 2 > out0; echo line 3 >> out0; cat out0" \
+"data
+line 2
+line 3"
+
+check "&&, || & ; are parsed before anything runs" 'false && echo no || echo yes; true || echo no && echo yes2; echo "a;b" ; /bin/echo bg & wait' \
+"yes
+yes2
+a;b
+bg"
+
+check "a syntax error runs nothing" 'echo before; for do; done' "Error: 'for' needs 'in' or 'do'"
+check "an empty pipeline stage is a syntax error" 'echo a ||| echo b' "Error: Unexpected token '|'"
+check "a pipeline can't end at a '|' or a ';'" 'echo a |; echo b | ; echo c; echo $?' "Error: Unexpected token ';'"
+check "a line can't end at a '|'" 'echo a |' "Error: Unexpected end of input after '|'"
+
+check "if, while, until, for, continue & break 2" 'i=; while [ "$i" != xxx ]; do i="$i"x; if [ $i = xx ]; then continue; elif [ $i = x ]; then echo one; else echo three; fi; done; until true; do echo never; done; for a in 1 2 3; do for b in x y; do [ $b = y ] && break 2; echo $a$b; done; done; if false; then :; fi; echo $?' \
+"one
+three
+1x
+0"
+
+#the history is only added to in a terminal, so the log is written here. its index is built & then caught up
+printf 'echo one\necho two\necho three\n' > "$TMP/history"
+export HISTFILE="$TMP/history"
+check "history lists & searches the log" 'history 2; history -s o' \
+"    2  echo two
+    3  echo three
+    1  echo one
+    2  echo two
+    3  echo three"
+printf 'echo four\n' >> "$TMP/history"
+check "history sees the entries another shell added" 'history 1' "    4  echo four"
+unset HISTFILE
+
+check "printf keeps the format after %b" 'printf "%b|\n" x; printf "[%b] %s\n" "a\tlong-argument-longer-than-the-format" end' \
+"x|
+[a	long-argument-longer-than-the-format] end"
+
+check "queued jobs start before the shell exits" 'BG_LIMIT=1; sleep 0.2 & /bin/echo queued & /bin/echo last &' \
+"queued
+last"
+
+check "parallel runs at most N at once & counts the failures" 'parallel -j 2 "sleep 0.2; echo slow" "echo fast" "false" "exit 3"; echo $?; printf "echo a\necho b\n" | parallel -j 1' \
+"fast
+slow
+2
+a
+b"
+
+check "BG_LIMIT from the environment queues jobs" "env BG_LIMIT=1 $SHELL_UNDER_TEST -c \"sleep 0.3 & /bin/echo q & jobs; wait\"" \
+"[1]   Running                 sleep 0.3 &
+[2]+  Queued                  /bin/echo q &
+q"
+
+check "a stage whose redirection fails doesn't run" 'echo LEAKED | cat < /nonexistent | cat; echo $PIPESTATUS; echo hi | cat > /nonexistent/x; echo $?' \
+"cannot open file
+0 1 0
+cannot open file
+1"
+
+check ">&2 duplicates stderr, any other >& is an error" 'echo hi 2> /dev/null >&2; echo a >&2 2> e1; echo "[$(cat e1)]"; echo b 1>&2 | tr b B; /bin/sh -c "echo x; echo y >&2" 2>&1 > /dev/null | tr y Y' \
+"a
+[]
+b
+Y"
+check "a >& that isn't >&2 runs nothing" 'echo before; echo x >&3' "Error: only 2>&1 & >&2 can duplicate a file descriptor"
+
+printf 'X=x\ntr a-z A-Z <<EOF\nfirst $X\nEOF\ncat <<"EOF"\nsecond $X\nEOF\ntr a-z A-Z <<< "here string"\n' > "$TMP/heredoc.sh"
+check "here-docs & here-strings" "$SHELL_UNDER_TEST heredoc.sh" \
+"FIRST X
+second \$X
+HERE STRING"
+
+check "functions take positional parameters, aliases expand" 'f() { echo "$# $1 $2"; return 3; }; f a b; echo $?; alias hi="echo hello"; hi there' \
+"2 a b
+3
+hello there"
+check "an unclosed function body names the '}'" 'f() { echo hi;' "Error: Unexpected end of input: '}' is missing"
+check "an empty function body is a syntax error" 'f() { }; echo not here' "Error: Unexpected token '}': the body is empty"
+
+check "\$(...) doesn't change the shell" 'A=0; f() { echo outer; }; x=$(A=1; f() { echo inner; }; f; unset A); echo "$x $A $(pwd)"; x=$(for A in 2; do echo; done); f; echo $A' \
+"inner 0 $TMP
+outer
+0"
+
+check "backticks, \$(...) inside quotes & nested" 'x=`echo back`; echo $x "`echo q`" "[$(echo a b)]" $(echo `echo nest`); echo $(printf "a\n\n") end' \
+"back q [a b] nest
+a end"
+
+echo "$failed failed"
+exit $failed